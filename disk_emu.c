@@ -1,180 +1,647 @@
-#include <stdio.h>
-#include <stdlib.h> 
-#include <string.h>
-#include <unistd.h>
-#include <time.h>
-#include "disk_emu.h"
-
-
-FILE* fp = NULL;
-double L, p;
-double r;
-int BLOCK_SIZE, MAX_BLOCK, MAX_RETRY, lru;
-
-/*----------------------------------------------------------*/
-/*Close the disk file filled when you don't need it anymore. */
-/*----------------------------------------------------------*/
-int close_disk()
-{
-    if(NULL != fp)
-    {
-        fclose(fp);
-    }
-    return 0;
-}
-
-/*---------------------------------------*/
-/*Initializes a disk file filled with 0's*/
-/*---------------------------------------*/
-int init_fresh_disk(char *filename, int block_size, int num_blocks)
-{
-    int i, j;
-    
-    /*Set up latency at 0.02 second*/
-    L = 00000.f;
-    /*Set up failure at 10%*/
-    p = -1.f;
-    /*Set up max retry attempts after failure to 3*/
-    MAX_RETRY = 3;
-
-    BLOCK_SIZE = block_size;
-    MAX_BLOCK = num_blocks;
-    
-    /*Initializes the random number generator*/
-    srand((unsigned int)(time( 0 )) );
-    /*Creates a new file*/
-    fp = fopen (filename, "w+b");
-
-    if (fp == NULL)
-    {
-        printf("Could not create new disk file %s\n\n", filename);
-        return -1;
-    }
-    
-    /*Fills the file with 0's to its given size*/
-    for (i = 0; i < MAX_BLOCK; i++)
-    {
-        for (j = 0; j < BLOCK_SIZE; j++)
-        {
-            fputc(0, fp);
-        }
-    }
-    return 0;
-}
-/*----------------------------*/
-/*Initializes an existing disk*/
-/*----------------------------*/
-int init_disk(char *filename, int block_size, int num_blocks)
-{
-    /*Set up latency at 0.02 second*/
-    L = 00000.f;
-    /*Set up failure at 10%*/
-    p = -1.f;
-    /*Set up max retry attempts after failure to 3*/
-    MAX_RETRY = 3;
-
-    BLOCK_SIZE = block_size;
-    MAX_BLOCK = num_blocks;
-    
-    /*Initializes the random number generator*/
-    srand((unsigned int)(time( 0 )) );
-    
-    /*Opens a file*/
-    fp = fopen (filename, "r+b");
-
-    if (fp == NULL)
-    {
-        printf("Could not open %s\n\n", filename);
-        return -1;
-    }
-    return 0;
-}
-
-/*-------------------------------------------------------------------*/
-/*Reads a series of blocks from the disk into the buffer             */
-/*-------------------------------------------------------------------*/
-int read_blocks(int start_address, int nblocks, void *buffer)
-{
-    int i, j, e, s;
-    e = 0;
-    s = 0;
-
-    /*Sets up a temporary buffer*/
-    void* blockRead = (void*) malloc(BLOCK_SIZE);
-
-    /*Checks that the data requested is within the range of addresses of the disk*/
-    if (start_address + nblocks > MAX_BLOCK)
-    {
-        printf("out of bound error %d\n", start_address);
-        return -1;
-    }
-
-    /*Goto the data requested from the disk*/
-    fseek(fp, start_address * BLOCK_SIZE, SEEK_SET);
-
-    /*For every block requested*/
-    for (i = 0; i < nblocks; ++i)
-    {
-        /*Pause until the latency duration is elapsed*/
-        // usleep(L);
-
-        s++;
-        fread(blockRead, BLOCK_SIZE, 1, fp);
-
-       for (j = 0; j < BLOCK_SIZE; j++)
-        {
-            memcpy(buffer+(i*BLOCK_SIZE), blockRead, BLOCK_SIZE);  
-        }
-    }
-
-    free(blockRead);
-
-
-    /*If no failure return the number of blocks read, else return the negative number of failures*/
-    if (e == 0)
-        return s;
-    else
-        return e;
-}
-
-/*------------------------------------------------------------------*/
-/*Writes a series of blocks to the disk from the buffer             */
-/*------------------------------------------------------------------*/
-int write_blocks(int start_address, int nblocks, void *buffer)
-{
-    int i, e, s;
-    e = 0;
-    s = 0;
-
-    void* blockWrite = (void*) malloc(BLOCK_SIZE);
-
-    /*Checks that the data requested is within the range of addresses of the disk*/
-    if (start_address + nblocks > MAX_BLOCK)
-    {
-        printf("out of bound error\n");
-        return -1;
-    }
-
-    /*Goto where the data is to be written on the disk*/        
-    fseek(fp, start_address * BLOCK_SIZE, SEEK_SET);
-
-    /*For every block requested*/        
-    for (i = 0; i < nblocks; ++i)
-    {
-        /*Pause until the latency duration is elapsed*/
-        usleep(L);
-
-        memcpy(blockWrite, buffer+(i*BLOCK_SIZE), BLOCK_SIZE);
-
-        fwrite(blockWrite, BLOCK_SIZE, 1, fp);
-        fflush(fp);
-        s++;
-    }
-    free(blockWrite);
-
-    /*If no failure return the number of blocks written, else return the negative number of failures*/
-    if (e == 0)
-        return s;
-    else
-        return e;
-}
+#include <stdio.h>
+#include <stdlib.h> 
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "disk_emu.h"
+#include "sfs_event.h"
+
+
+FILE* fp = NULL;
+double L, p;
+double r;
+int BLOCK_SIZE, MAX_BLOCK, MAX_RETRY, lru;
+
+/*Image files of the disk. The disk is striped (RAID-0) over device_count devices: block b sits in
+chunk b/stripe_chunk and chunks go round robin over the devices. Every device is kept as copy_count
+identical copies (RAID-1). Writes go to every copy that still works, reads go to one copy and fall over
+to the next when it fails. With the defaults there is one device with one copy, the file name passed
+to init_disk / init_fresh_disk, and the mapping is the identity.*/
+FILE* devices[MAX_DEVICES][MAX_COPIES];
+char *device_names[MAX_DEVICES][MAX_COPIES];
+int device_count = 0;
+int copy_count = 1;
+int stripe_chunk = 1;
+/*A copy that failed an open, read or write is left out from then on*/
+int copy_failed[MAX_DEVICES][MAX_COPIES];
+/*Block just past the last transfer of each copy, where its head is in the latency model*/
+int head_position[MAX_DEVICES][MAX_COPIES];
+
+/*Largest request whose bookkeeping transfer_blocks keeps on the stack*/
+#define SMALL_REQUEST 16
+
+/*A run of blocks that are consecutive on one device*/
+typedef struct Transfer{
+    int device;
+    int device_block;
+    int nblocks;
+    char *buffer;
+}Transfer;
+
+/*A run sent to one copy of its device*/
+typedef struct Task{
+    int run;
+    int copy;
+    int failed;
+}Task;
+
+/*Count of the Device_Works of one request that are not done yet, the request waits for it to reach 0*/
+typedef struct Completion{
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    int pending;
+}Completion;
+
+/*The tasks of one request that go to one copy of one device, done by one thread*/
+typedef struct Device_Work{
+    Transfer *runs;
+    Task *tasks;
+    int count;
+    int write;
+    Completion *completion;
+    struct Device_Work *next;
+}Device_Work;
+
+/*Long lived thread of one copy of one device. set_disk_stripes and set_disk_mirrors start one per copy
+of every device when there is more than one, transfer_blocks queues the work of a request on them
+instead of starting threads of its own.*/
+typedef struct Device_Worker{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    Device_Work *head;
+    Device_Work *tail;
+    int running;
+    int stopping;
+}Device_Worker;
+
+Device_Worker workers[MAX_DEVICES][MAX_COPIES];
+int workers_started = 0;
+
+static void stop_workers();
+static void start_workers();
+
+/*----------------------------------------------------------*/
+/*Stripe the disk over count image files, chunk_blocks blocks */
+/*at a time. Takes effect at the next init_(fresh_)disk.      */
+/*----------------------------------------------------------*/
+int set_disk_stripes(char **filenames, int count, int chunk_blocks)
+{
+    int i;
+
+    if (count < 1 || count > MAX_DEVICES || chunk_blocks < 1)
+        return -1;
+
+    stop_workers();
+    for (i = 0; i < count; i++)
+        device_names[i][0] = filenames[i];
+    device_count = count;
+    copy_count = 1;
+    stripe_chunk = chunk_blocks;
+    start_workers();
+    return 0;
+}
+
+/*----------------------------------------------------------*/
+/*Mirror the disk over count image files, each holds all of  */
+/*it. Takes effect at the next init_(fresh_)disk.            */
+/*----------------------------------------------------------*/
+int set_disk_mirrors(char **filenames, int count)
+{
+    int i;
+
+    if (count < 1 || count > MAX_COPIES)
+        return -1;
+
+    stop_workers();
+    for (i = 0; i < count; i++)
+        device_names[0][i] = filenames[i];
+    device_count = 1;
+    copy_count = count;
+    stripe_chunk = 1;
+    start_workers();
+    return 0;
+}
+
+/*Number of copies every block is kept in*/
+int disk_copies()
+{
+    return copy_count;
+}
+
+/*Device holding block and the block number inside that device*/
+static void map_block(int block, int *device, int *device_block)
+{
+    int chunk = block / stripe_chunk;
+    *device = chunk % device_count;
+    *device_block = (chunk / device_count) * stripe_chunk + block % stripe_chunk;
+}
+
+/*----------------------------------------------------------*/
+/*Close the disk file filled when you don't need it anymore. */
+/*----------------------------------------------------------*/
+int close_disk()
+{
+    int d, c;
+
+    for (d = 0; d < MAX_DEVICES; d++)
+    {
+        for (c = 0; c < MAX_COPIES; c++)
+        {
+            if (NULL != devices[d][c])
+            {
+                fclose(devices[d][c]);
+                devices[d][c] = NULL;
+            }
+        }
+    }
+    fp = NULL;
+    return 0;
+}
+
+/*Open every copy of every device with mode, the single device default is filename.
+A copy that does not open is marked failed, the disk only fails when a device has no copy left.*/
+static int open_devices(char *filename, char *mode)
+{
+    int d, c, working;
+
+    close_disk();
+    if (device_count == 0)
+    {
+        device_names[0][0] = filename;
+        device_count = 1;
+        copy_count = 1;
+    }
+
+    for (d = 0; d < device_count; d++)
+    {
+        working = 0;
+        for (c = 0; c < copy_count; c++)
+        {
+            head_position[d][c] = 0;
+            copy_failed[d][c] = 0;
+            devices[d][c] = fopen(device_names[d][c], mode);
+            if (devices[d][c] == NULL)
+            {
+                printf("Could not open %s\n\n", device_names[d][c]);
+                copy_failed[d][c] = 1;
+                continue;
+            }
+            working++;
+        }
+        if (working == 0)
+        {
+            close_disk();
+            return -1;
+        }
+    }
+    fp = devices[0][0];
+    return 0;
+}
+
+/*---------------------------------------*/
+/*Initializes a disk file filled with 0's*/
+/*---------------------------------------*/
+int init_fresh_disk(char *filename, int block_size, int num_blocks)
+{
+    int i, j, d, c, device_blocks;
+    
+    /*Set up latency at 0.02 second*/
+    L = 00000.f;
+    /*Set up failure at 10%*/
+    p = -1.f;
+    /*Set up max retry attempts after failure to 3*/
+    MAX_RETRY = 3;
+
+    BLOCK_SIZE = block_size;
+    MAX_BLOCK = num_blocks;
+    
+    /*Initializes the random number generator*/
+    srand((unsigned int)(time( 0 )) );
+    /*Creates the new files*/
+    if (open_devices(filename, "w+b") == -1)
+    {
+        printf("Could not create new disk file %s\n\n", filename);
+        return -1;
+    }
+    
+    /*Fills every file with 0's, enough whole chunks to hold its share of the blocks*/
+    device_blocks = (MAX_BLOCK + stripe_chunk * device_count - 1) / (stripe_chunk * device_count) * stripe_chunk;
+    for (d = 0; d < device_count; d++)
+    {
+        for (c = 0; c < copy_count; c++)
+        {
+            if (copy_failed[d][c])
+                continue;
+            for (i = 0; i < device_blocks; i++)
+            {
+                for (j = 0; j < BLOCK_SIZE; j++)
+                {
+                    fputc(0, devices[d][c]);
+                }
+            }
+            fflush(devices[d][c]);
+        }
+    }
+    return 0;
+}
+/*----------------------------*/
+/*Initializes an existing disk*/
+/*----------------------------*/
+int init_disk(char *filename, int block_size, int num_blocks)
+{
+    /*Set up latency at 0.02 second*/
+    L = 00000.f;
+    /*Set up failure at 10%*/
+    p = -1.f;
+    /*Set up max retry attempts after failure to 3*/
+    MAX_RETRY = 3;
+
+    BLOCK_SIZE = block_size;
+    MAX_BLOCK = num_blocks;
+    
+    /*Initializes the random number generator*/
+    srand((unsigned int)(time( 0 )) );
+    
+    /*Opens the files*/
+    return open_devices(filename, "r+b");
+}
+
+/*Move one run of blocks between the buffer and one copy of its device. pread/pwrite keep no file position,
+so the devices of one request can be worked on from several threads.*/
+static int do_transfer(Transfer *t, int copy, int write)
+{
+    int fd = fileno(devices[t->device][copy]);
+    size_t length = (size_t)t->nblocks * BLOCK_SIZE;
+    off_t offset = (off_t)t->device_block * BLOCK_SIZE;
+    size_t done = 0;
+
+    EVENT_BEGIN(EVENT_IO, write ? "device write" : "device read", t->device_block, t->nblocks);
+    while (done < length)
+    {
+        ssize_t n;
+        if (write)
+        {
+            /*Pause until the latency duration is elapsed*/
+            usleep(L);
+            n = pwrite(fd, t->buffer + done, length - done, offset + done);
+        }
+        else
+            n = pread(fd, t->buffer + done, length - done, offset + done);
+        if (n <= 0)
+        {
+            EVENT_END(EVENT_IO, write ? "device write" : "device read", t->device_block, -1);
+            return -1;
+        }
+        done += n;
+    }
+    EVENT_END(EVENT_IO, write ? "device write" : "device read", t->device_block, t->nblocks);
+    return 0;
+}
+
+static void do_work(Device_Work *work)
+{
+    int i;
+
+    for (i = 0; i < work->count; i++)
+    {
+        Task *task = &work->tasks[i];
+        task->failed = do_transfer(&work->runs[task->run], task->copy, work->write) == -1;
+    }
+}
+
+/*Take work off the queue of one worker in order until it is stopped and the queue is empty*/
+static void *device_worker(void *arg)
+{
+    Device_Worker *worker = (Device_Worker*) arg;
+    Device_Work *work;
+
+    pthread_mutex_lock(&worker->lock);
+    for (;;)
+    {
+        while (worker->head == NULL && !worker->stopping)
+            pthread_cond_wait(&worker->ready, &worker->lock);
+        if (worker->head == NULL)
+            break;
+        work = worker->head;
+        worker->head = work->next;
+        if (worker->head == NULL)
+            worker->tail = NULL;
+        pthread_mutex_unlock(&worker->lock);
+
+        do_work(work);
+        pthread_mutex_lock(&work->completion->lock);
+        if (--work->completion->pending == 0)
+            pthread_cond_signal(&work->completion->done);
+        pthread_mutex_unlock(&work->completion->lock);
+
+        pthread_mutex_lock(&worker->lock);
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return NULL;
+}
+
+/*Queue work on the worker of its copy, returns -1 if that worker is not running*/
+static int queue_work(int device, int copy, Device_Work *work)
+{
+    Device_Worker *worker = &workers[device][copy];
+
+    if (!worker->running)
+        return -1;
+    work->next = NULL;
+    pthread_mutex_lock(&worker->lock);
+    if (worker->tail)
+        worker->tail->next = work;
+    else
+        worker->head = work;
+    worker->tail = work;
+    pthread_cond_signal(&worker->ready);
+    pthread_mutex_unlock(&worker->lock);
+    return 0;
+}
+
+/*One worker per copy of every device, when a request can involve more than one*/
+static void start_workers()
+{
+    int d, c;
+
+    if (device_count * copy_count < 2)
+        return;
+    for (d = 0; d < device_count; d++)
+    {
+        for (c = 0; c < copy_count; c++)
+        {
+            Device_Worker *worker = &workers[d][c];
+            pthread_mutex_init(&worker->lock, NULL);
+            pthread_cond_init(&worker->ready, NULL);
+            worker->head = NULL;
+            worker->tail = NULL;
+            worker->stopping = 0;
+            worker->running = pthread_create(&worker->thread, NULL, device_worker, worker) == 0;
+        }
+    }
+    workers_started = 1;
+}
+
+/*Let the workers finish their queues and end them*/
+static void stop_workers()
+{
+    int d, c;
+
+    if (!workers_started)
+        return;
+    for (d = 0; d < MAX_DEVICES; d++)
+    {
+        for (c = 0; c < MAX_COPIES; c++)
+        {
+            Device_Worker *worker = &workers[d][c];
+            if (!worker->running)
+                continue;
+            pthread_mutex_lock(&worker->lock);
+            worker->stopping = 1;
+            pthread_cond_signal(&worker->ready);
+            pthread_mutex_unlock(&worker->lock);
+            pthread_join(worker->thread, NULL);
+            pthread_mutex_destroy(&worker->lock);
+            pthread_cond_destroy(&worker->ready);
+            worker->running = 0;
+        }
+    }
+    workers_started = 0;
+}
+
+/*Copy of device to read the next run from: the one with the fewest runs of this request so far,
+then the one whose head is closest to block. -1 if every copy failed.*/
+static int pick_copy(int device, int block, int *assigned)
+{
+    int c, best = -1;
+
+    for (c = 0; c < copy_count; c++)
+    {
+        if (copy_failed[device][c])
+            continue;
+        if (best == -1 || assigned[c] < assigned[best]
+            || (assigned[c] == assigned[best]
+                && abs(head_position[device][c] - block) < abs(head_position[device][best] - block)))
+            best = c;
+    }
+    return best;
+}
+
+/*Split a request into runs per device and do them, on the worker of each copy of a device when more than one is involved.
+Writes go to every working copy, reads to one copy (only_copy if it is not -1) and fall over to the others on error.
+The bookkeeping of a request of up to SMALL_REQUEST blocks, which is nearly every request, lives on the stack.
+Returns the number of blocks moved, or minus the number of runs that failed.*/
+static int transfer_blocks(int start_address, int nblocks, char *buffer, int write, int only_copy)
+{
+    Transfer small_runs[SMALL_REQUEST];
+    Task small_tasks[SMALL_REQUEST * MAX_COPIES];
+    Task small_sorted[SMALL_REQUEST * MAX_COPIES];
+    int small_run_ok[SMALL_REQUEST];
+    int small = nblocks <= SMALL_REQUEST;
+    Transfer *runs = small ? small_runs : malloc(nblocks * sizeof(Transfer));
+    Task *tasks = small ? small_tasks : malloc(nblocks * copy_count * sizeof(Task));
+    Task *sorted = small ? small_sorted : malloc(nblocks * copy_count * sizeof(Task));
+    int *run_ok = small ? small_run_ok : malloc(nblocks * sizeof(int));
+    Device_Work work[MAX_DEVICES][MAX_COPIES];
+    int queued[MAX_DEVICES][MAX_COPIES];
+    Completion completion;
+    int assigned[MAX_DEVICES][MAX_COPIES];
+    int count = 0;
+    int task_count = 0;
+    int i, d, c, device, device_block, failed;
+
+    memset(run_ok, 0, nblocks * sizeof(int));
+    EVENT_BEGIN(EVENT_IO, write ? "disk write" : "disk read", start_address, nblocks);
+    /*Blocks that follow each other on the same device join one run*/
+    for (i = 0; i < nblocks; i++)
+    {
+        map_block(start_address + i, &device, &device_block);
+        if (count > 0 && runs[count-1].device == device
+            && runs[count-1].device_block + runs[count-1].nblocks == device_block
+            && runs[count-1].buffer + runs[count-1].nblocks * BLOCK_SIZE == buffer + i * BLOCK_SIZE)
+        {
+            runs[count-1].nblocks++;
+            continue;
+        }
+        runs[count].device = device;
+        runs[count].device_block = device_block;
+        runs[count].nblocks = 1;
+        runs[count].buffer = buffer + i * BLOCK_SIZE;
+        count++;
+    }
+
+    /*Hand the runs to copies*/
+    memset(assigned, 0, sizeof(assigned));
+    for (i = 0; i < count; i++)
+    {
+        d = runs[i].device;
+        for (c = 0; c < copy_count; c++)
+        {
+            if (copy_failed[d][c])
+                continue;
+            if (!write && c != (only_copy == -1 ? pick_copy(d, runs[i].device_block, assigned[d]) : only_copy))
+                continue;
+            tasks[task_count].run = i;
+            tasks[task_count].copy = c;
+            tasks[task_count].failed = 0;
+            task_count++;
+            assigned[d][c]++;
+        }
+    }
+
+    /*Group the tasks by copy, one worker each*/
+    int used = 0;
+    int busy = 0;
+    for (d = 0; d < device_count; d++)
+    {
+        for (c = 0; c < copy_count; c++)
+        {
+            work[d][c].runs = runs;
+            work[d][c].tasks = sorted + used;
+            work[d][c].count = 0;
+            work[d][c].write = write;
+            for (i = 0; i < task_count; i++)
+            {
+                if (runs[tasks[i].run].device == d && tasks[i].copy == c)
+                {
+                    sorted[used++] = tasks[i];
+                    work[d][c].count++;
+                }
+            }
+            if (work[d][c].count > 0)
+                busy++;
+        }
+    }
+
+    /*The work of a copy whose worker is not running is done here once the rest is queued*/
+    pthread_mutex_init(&completion.lock, NULL);
+    pthread_cond_init(&completion.done, NULL);
+    completion.pending = 0;
+    for (d = 0; d < device_count; d++)
+    {
+        for (c = 0; c < copy_count; c++)
+        {
+            queued[d][c] = 0;
+            if (work[d][c].count == 0 || busy < 2)
+                continue;
+            work[d][c].completion = &completion;
+            pthread_mutex_lock(&completion.lock);
+            completion.pending++;
+            pthread_mutex_unlock(&completion.lock);
+            if (queue_work(d, c, &work[d][c]) == 0)
+            {
+                queued[d][c] = 1;
+                continue;
+            }
+            pthread_mutex_lock(&completion.lock);
+            completion.pending--;
+            pthread_mutex_unlock(&completion.lock);
+        }
+    }
+    for (d = 0; d < device_count; d++)
+    {
+        for (c = 0; c < copy_count; c++)
+        {
+            if (work[d][c].count > 0 && !queued[d][c])
+                do_work(&work[d][c]);
+        }
+    }
+    pthread_mutex_lock(&completion.lock);
+    while (completion.pending > 0)
+        pthread_cond_wait(&completion.done, &completion.lock);
+    pthread_mutex_unlock(&completion.lock);
+    pthread_mutex_destroy(&completion.lock);
+    pthread_cond_destroy(&completion.done);
+
+    for (d = 0; d < device_count; d++)
+    {
+        for (c = 0; c < copy_count; c++)
+        {
+            for (i = 0; i < work[d][c].count; i++)
+            {
+                Task *task = &work[d][c].tasks[i];
+                Transfer *run = &runs[task->run];
+                if (task->failed)
+                {
+                    /*Losing a copy does not stop the disk while another copy works*/
+                    copy_failed[d][c] = 1;
+                    continue;
+                }
+                run_ok[task->run] = 1;
+                head_position[d][c] = run->device_block + run->nblocks;
+            }
+        }
+    }
+
+    /*Reads that failed are tried again on the copies left*/
+    failed = 0;
+    for (i = 0; i < count; i++)
+    {
+        d = runs[i].device;
+        while (!write && !run_ok[i] && only_copy == -1 && (c = pick_copy(d, runs[i].device_block, assigned[d])) != -1)
+        {
+            if (do_transfer(&runs[i], c, 0) == -1)
+                copy_failed[d][c] = 1;
+            else
+                run_ok[i] = 1;
+        }
+        if (!run_ok[i])
+            failed++;
+    }
+
+    if (!small)
+    {
+        free(run_ok);
+        free(sorted);
+        free(tasks);
+        free(runs);
+    }
+    EVENT_END(EVENT_IO, write ? "disk write" : "disk read", start_address, failed ? -failed : nblocks);
+    return failed ? -failed : nblocks;
+}
+
+/*-------------------------------------------------------------------*/
+/*Reads a series of blocks from one copy of the disk, used to fetch   */
+/*a good copy of a block that failed its checksum                    */
+/*-------------------------------------------------------------------*/
+int read_blocks_copy(int start_address, int nblocks, void *buffer, int copy)
+{
+    if (start_address < 0 || nblocks < 0 || start_address + nblocks > MAX_BLOCK || copy < 0 || copy >= copy_count)
+        return -1;
+
+    return transfer_blocks(start_address, nblocks, (char*) buffer, 0, copy);
+}
+
+/*-------------------------------------------------------------------*/
+/*Reads a series of blocks from the disk into the buffer             */
+/*-------------------------------------------------------------------*/
+int read_blocks(int start_address, int nblocks, void *buffer)
+{
+    /*Checks that the data requested is within the range of addresses of the disk*/
+    if (start_address < 0 || nblocks < 0 || start_address + nblocks > MAX_BLOCK)
+    {
+        printf("out of bound error %d\n", start_address);
+        return -1;
+    }
+
+    /*If no failure return the number of blocks read, else return the negative number of failures*/
+    return transfer_blocks(start_address, nblocks, (char*) buffer, 0, -1);
+}
+
+/*------------------------------------------------------------------*/
+/*Writes a series of blocks to the disk from the buffer             */
+/*------------------------------------------------------------------*/
+int write_blocks(int start_address, int nblocks, void *buffer)
+{
+    /*Checks that the data requested is within the range of addresses of the disk*/
+    if (start_address < 0 || nblocks < 0 || start_address + nblocks > MAX_BLOCK)
+    {
+        printf("out of bound error\n");
+        return -1;
+    }
+
+    /*If no failure return the number of blocks written, else return the negative number of failures*/
+    return transfer_blocks(start_address, nblocks, (char*) buffer, 1, -1);
+}
@@ -1,3 +1,14 @@
+/*Most image files a disk can be striped over, and most copies it can be mirrored in*/
+#define MAX_DEVICES 8
+#define MAX_COPIES 4
+
+/*Stripe the disk over count image files, chunk_blocks blocks per chunk, from the next init on*/
+int set_disk_stripes(char **filenames, int count, int chunk_blocks);
+/*Keep the disk as count identical image files from the next init on*/
+int set_disk_mirrors(char **filenames, int count);
+int disk_copies();
+/*Read from the given copy only, -1 if there is no such copy or it failed*/
+int read_blocks_copy(int start_address, int nblocks, void *buffer, int copy);
 int init_fresh_disk(char *filename, int block_size, int num_blocks);
 int init_disk(char *filename, int block_size, int num_blocks);
 int read_blocks(int start_address, int nblocks, void *buffer);
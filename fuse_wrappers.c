@@ -22,6 +22,7 @@
 #include <dirent.h>
 #include <errno.h>
 #include <sys/time.h>
+#include <linux/falloc.h>
 #include "disk_emu.h"
 #include "sfs_api.h"
 #include "tests.h"
@@ -30,14 +31,14 @@
 static int fuse_getattr(const char *path, struct stat *stbuf)
 {
     int res = 0;
-    int size;
+    long long size;
     
     memset(stbuf, 0, sizeof(struct stat));
     
     if (strcmp(path, "/") == 0) {
         stbuf->st_mode = S_IFDIR | 0755;
         stbuf->st_nlink = 2;
-    } else if((size = sfs_get_file_size(&path[1])) != -1) {
+    } else if((size = sfs_get_file_size64(&path[1])) != -1) {
         stbuf->st_mode = S_IFREG | 0444;
         stbuf->st_nlink = 1;
         stbuf->st_size = size;
@@ -104,10 +105,7 @@ static int fuse_read(const char *path, char *buf, size_t size, off_t offset,
     if (fd == -1)
         return -errno;
     
-    if(sfs_frseek(fd, offset) == -1)
-        return -errno;
-    
-    res = sfs_fread(fd, buf, size);
+    res = sfs_pread64(fd, buf, size, offset);
     if (res == -1)
         return -errno;
     
@@ -129,10 +127,7 @@ static int fuse_write(const char *path, const char *buf, size_t size,
     if (fd == -1) 
         return -errno;
     
-    if(sfs_fwseek(fd, offset) == -1)
-        return -errno;
-    
-    res = sfs_fwrite(fd, buf, size);
+    res = sfs_pwrite64(fd, (char *)buf, size, offset);
     if (res == -1)
         return -errno;
     
@@ -140,6 +135,42 @@ static int fuse_write(const char *path, const char *buf, size_t size,
     return res;
 }
 
+static int fuse_fallocate(const char *path, int mode, off_t offset,
+        off_t length, struct fuse_file_info *fi)
+{
+    int fd;
+    int res;
+    
+    char filename[MAX_FNAME_LENGTH];
+    
+    if (mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE))
+        return -EOPNOTSUPP;
+    /* Like Linux, a hole is only punched without changing the size */
+    if ((mode & FALLOC_FL_PUNCH_HOLE) && !(mode & FALLOC_FL_KEEP_SIZE))
+        return -EOPNOTSUPP;
+    
+    strcpy(filename, &path[1]);
+    
+    fd = sfs_fopen(filename);
+    if (fd == -1) 
+        return -errno;
+    
+    if (mode & FALLOC_FL_PUNCH_HOLE) {
+        res = sfs_fallocate64(fd, offset, length, SFS_FALLOC_PUNCH_HOLE);
+        sfs_fclose(fd);
+        if (res == -1)
+            return -EIO;
+        return 0;
+    }
+    
+    res = sfs_fallocate64(fd, offset, length, mode & FALLOC_FL_KEEP_SIZE ? SFS_FALLOC_KEEP_SIZE : 0);
+    sfs_fclose(fd);
+    if (res == -1)
+        return -ENOSPC;
+    
+    return 0;
+}
+
 static int fuse_truncate(const char *path, off_t size)
 {
     char filename[MAX_FNAME_LENGTH];
@@ -188,6 +219,7 @@ static struct fuse_operations xmp_oper = {
     .open = fuse_open, 
     .read = fuse_read, 
     .write = fuse_write, 
+    .fallocate = fuse_fallocate,
     .access = fuse_access,
     .create = fuse_create,
 };
@@ -1,301 +1,865 @@
 #include "sfs_api.h"
 #include "disk_emu.h"
+#include "sfs_layout.h"
+#include "sfs_dir.h"
+#include "sfs_lz.h"
+#include "sfs_hash.h"
+#include "sfs_crc.h"
+#include "sfs_trace.h"
+#include "sfs_event.h"
+#include "sfs_pool.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
 
-#define BLOCK_SIZE 1024
-#define MAX_BLOCK 100
-#define INODE_COUNT 40
 char *filename = "file_system";
 
-/*ROOT DIRECTORY STRUCT*/
-typedef struct root_directory_entry{
-  int inode_id : 32;
-  /*Should equate to a file name with max 16 charcters*/
-  char filename[21];
-  int in_use : 8;
-}root_directory_entry;
-
-/*I_NODE STRUCT*/
-typedef struct I_Node{
-  int size;
-  int is_free;
-  int block_pointers[25];
-  int indirect_pointer;
-}I_Node;
-
-/*SUPER NODE STRUCT*/
-typedef struct Super_Node{
-  int magic_number : 32;
-  int block_size : 32;
-  int block_amount : 32;
-  int i_node_block_length : 32;
-  I_Node root_node;
-}Super_Node;
-
-/*FILE DESCRIPTOR TYPE*/
+/*FILE DESCRIPTOR TYPE
+Every descriptor has its own read and write pointers, any number of them can be open on one inode
+and they share its state through inode_table. The descriptors open on an inode are linked through
+next_fd and prev_fd, a free entry is linked into the free list through next_fd.
+An entry takes a whole cache line, threads working through different descriptors never share one.*/
 typedef struct File_Descriptor{
-  int inode_id;
-  int read_pointer;
-  int write_pointer;
+  _Alignas(64) int inode_id;
   int is_free;
+  long long read_pointer;
+  long long write_pointer;
+  int next_fd;
+  int prev_fd;
 }File_Descriptor;
 
+/*The fd table grows a chunk of FD_CHUNK entries at a time, up to FD_MAX_CHUNKS chunks.
+Chunks never move once made, so an entry stays where it is while the table grows.*/
+#define FD_CHUNK 256
+#define FD_MAX_CHUNKS 4096
+
 /*All in memory tables and variables*/
-root_directory_entry rt[INODE_COUNT];
-int rt_pointer = 0;
 I_Node inode_table[INODE_COUNT];
+/*The inode table blocks as they are on disk*/
+char inode_table_disk[INODE_TABLE_BLOCKS*BLOCK_SIZE];
+/*Bit map, holds the number of references to each block (0 is a free block)*/
 int bm[MAX_BLOCK];
-int current_file_count;
-File_Descriptor fd_table[INODE_COUNT];
+/*Blocks reserved by sfs_fallocate and not written since, they read as zeros without touching the disk*/
+unsigned char block_unwritten[MAX_BLOCK];
+/*The bit map block as it is on disk, a flush that would write the same bytes is skipped*/
+char bit_map_disk[BLOCK_SIZE];
+int volume_flags = 0;
+
+/*Fingerprint index of the data blocks written while deduplication is on.
+Blocks with the same fingerprint modulo FINGERPRINT_BUCKETS are chained through fingerprint_next.
+The index lives in memory only, after a remount deduplication starts from the blocks written since.*/
+#define FINGERPRINT_BUCKETS 128
+int fingerprint_head[FINGERPRINT_BUCKETS];
+int fingerprint_next[MAX_BLOCK];
+unsigned long long fingerprint[MAX_BLOCK];
+int fingerprint_indexed[MAX_BLOCK];
+File_Descriptor *fd_chunks[FD_MAX_CHUNKS];
+/*Entries in the chunks made so far*/
+int fd_count = 0;
+
+/*Checksum of every block written through write_meta_block and write_data_block.
+It is stored in the bit map block, so it reaches the disk with the bit map flush that follows every change.*/
+Checksum_Table checksum_table;
+int checksum_errors = 0;
+
+/*While commit_depth is above 0 the inode table and bit map flushes are held back and
+done once by end_commit, so a run of calls pays for one metadata commit*/
+int commit_depth = 0;
+int commit_pending = 0;
+
+/*Index block of each snapshot (saved in the super block) and the images read so far*/
+int snapshot_index[SNAPSHOT_COUNT];
+Snapshot_Image *snapshot_cache[SNAPSHOT_COUNT];
+
+/*Free lists over the in memory tables.
+Each free entry stores the index of the next free entry in the *_free_next array, -1 ends a list.
+Allocation pops the head and release pushes the entry back, so both are constant time.
+Free inodes are kept in one list per block group.*/
+int inode_free_head[BLOCK_GROUPS];
+int inode_free_next[INODE_COUNT];
+int fd_free_head = -1;
+
+/*Reverse index from an inode id to the first descriptor open on it, -1 if it is not open*/
+int inode_fd[INODE_COUNT];
+
+/*Free blocks and free inodes left in each block group*/
+int group_free_blocks[BLOCK_GROUPS];
+int group_free_inodes[BLOCK_GROUPS];
+
+/*Write a metadata block, its checksum is always kept*/
+void write_meta_block(int block, void *buffer){
+  write_blocks(block, 1, buffer);
+  checksum_table.crc[block] = crc32c(buffer, BLOCK_SIZE);
+  checksum_table.covered[block] = 1;
+}
+
+/*Write a file data block, its checksum is kept when the volume checksums data*/
+void write_data_block(int block, void *buffer){
+  write_blocks(block, 1, buffer);
+  block_unwritten[block] = 0;
+  if(volume_flags & VOLUME_CHECKSUM_DATA){
+    checksum_table.crc[block] = crc32c(buffer, BLOCK_SIZE);
+    checksum_table.covered[block] = 1;
+  }else{
+    checksum_table.covered[block] = 0;
+  }
+}
+
+/*Read a block and check it against its checksum.
+On a mirrored disk a block that does not match is read from the other copies, the first good one
+is written back over every copy. Returns 0, or -1 when no copy matches.
+Every mismatch counts as a checksum error, repaired or not.*/
+int read_block(int block, void *buffer){
+  if(block_unwritten[block]){
+    memset(buffer, 0, BLOCK_SIZE);
+    return 0;
+  }
+  read_blocks(block, 1, buffer);
+  if(!checksum_table.covered[block] || crc32c(buffer, BLOCK_SIZE) == checksum_table.crc[block]){
+    return 0;
+  }
+
+  checksum_errors++;
+  for(int copy=0; copy<disk_copies(); copy++){
+    if(read_blocks_copy(block, 1, buffer, copy) > 0 && crc32c(buffer, BLOCK_SIZE) == checksum_table.crc[block]){
+      write_blocks(block, 1, buffer);
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/*Flush the bit map block, which carries the checksum table and a checksum of itself.
+Nothing is written when the block did not change, like after an overwrite of preallocated blocks.*/
+void write_bit_map(){
+  if(commit_depth){
+    commit_pending = 1;
+    return;
+  }
+  Bit_Map_Block * buffer = pool_get_zeroed(BLOCK_SIZE);
+  memcpy(buffer->bm, bm, sizeof(bm));
+  buffer->checksums = checksum_table;
+  memcpy(buffer->unwritten, block_unwritten, sizeof(block_unwritten));
+  buffer->self_crc = crc32c(buffer, offsetof(Bit_Map_Block, self_crc));
+  if(memcmp(buffer, bit_map_disk, BLOCK_SIZE) != 0){
+    EVENT_BEGIN(EVENT_FLUSH, "bit map flush", BIT_MAP_START, 1);
+    write_blocks(BIT_MAP_START, 1, buffer);
+    memcpy(bit_map_disk, buffer, BLOCK_SIZE);
+    EVENT_END(EVENT_FLUSH, "bit map flush", BIT_MAP_START, 1);
+  }
+  pool_put(buffer);
+}
+
+/*Start a fresh disk with no checksums*/
+void init_checksum_table(){
+  memset(&checksum_table, 0, sizeof(checksum_table));
+  checksum_errors = 0;
+  /*Nothing of the bit map block is on the fresh disk yet*/
+  memset(bit_map_disk, 0xff, sizeof(bit_map_disk));
+}
+
+/*Read the bit map and the checksum table back from the bit map block of an existing disk.
+A bit map block that fails its own checksum leaves every block unchecked.*/
+void load_checksum_table(){
+  Bit_Map_Block * buffer = malloc(BLOCK_SIZE);
+  read_blocks(BIT_MAP_START, 1, buffer);
+  memcpy(bit_map_disk, buffer, BLOCK_SIZE);
+  memcpy(bm, buffer->bm, sizeof(bm));
+  memcpy(block_unwritten, buffer->unwritten, sizeof(block_unwritten));
+  checksum_errors = 0;
+  if(crc32c(buffer, offsetof(Bit_Map_Block, self_crc)) == buffer->self_crc){
+    checksum_table = buffer->checksums;
+  }else{
+    memset(&checksum_table, 0, sizeof(checksum_table));
+    checksum_errors++;
+  }
+  free(buffer);
+}
+
+/*Read the inode table back from an existing disk, checking its blocks against their checksums.
+A torn table write counts as a checksum error.*/
+void load_inode_table(){
+  for(int i=0; i<INODE_TABLE_BLOCKS; i++){
+    read_block(INODE_TABLE_START+i, inode_table_disk+i*BLOCK_SIZE);
+  }
+  memcpy(inode_table, inode_table_disk, sizeof(inode_table));
+}
+
+/*Flush the blocks of the inode table that changed since the last flush, then the bit map block
+that carries their checksums. A call usually changes one inode, so this is one block write.*/
+void write_inode_table(){
+  if(commit_depth){
+    commit_pending = 1;
+    return;
+  }
+  EVENT_BEGIN(EVENT_FLUSH, "inode table flush", INODE_TABLE_START, INODE_TABLE_BLOCKS);
+  char * buffer = pool_get_zeroed(INODE_TABLE_BLOCKS*BLOCK_SIZE);
+  memcpy(buffer, inode_table, sizeof(inode_table));
+  for(int i=0; i<INODE_TABLE_BLOCKS; i++){
+    if(memcmp(buffer+i*BLOCK_SIZE, inode_table_disk+i*BLOCK_SIZE, BLOCK_SIZE) != 0){
+      write_meta_block(INODE_TABLE_START+i, buffer+i*BLOCK_SIZE);
+      memcpy(inode_table_disk+i*BLOCK_SIZE, buffer+i*BLOCK_SIZE, BLOCK_SIZE);
+    }
+  }
+  pool_put(buffer);
+  write_bit_map();
+  EVENT_END(EVENT_FLUSH, "inode table flush", INODE_TABLE_START, INODE_TABLE_BLOCKS);
+}
+
+/*Hold back table flushes until the matching end_commit*/
+void begin_commit(){
+  commit_depth++;
+}
+
+/*Flush the tables once if anything was held back since the outermost begin_commit*/
+void end_commit(){
+  commit_depth--;
+  if(commit_depth == 0 && commit_pending){
+    commit_pending = 0;
+    write_inode_table();
+  }
+}
+
+/*Entry of descriptor fd, NULL if the table never grew that far*/
+File_Descriptor *get_fd(int fd){
+  if(fd<0 || fd>=fd_count){
+    return NULL;
+  }
+  return &fd_chunks[fd/FD_CHUNK][fd%FD_CHUNK];
+}
 
-/*Initialize all open fd entries to be empty*/
+/*Close every descriptor and give the chunks back, the table grows again from the first open*/
 void init_fd_table(){
-  for(int i=0; i<INODE_COUNT; i++){
-    fd_table[i].is_free = 1;
-    fd_table[i].inode_id = -1;
+  for(int i=0; i<fd_count/FD_CHUNK; i++){
+    free(fd_chunks[i]);
+    fd_chunks[i] = NULL;
+  }
+  fd_count = 0;
+}
+
+/*Add a chunk of free entries to the table and the free list, lowest first.
+Returns -1 once FD_MAX_CHUNKS chunks are in use or there is no memory left.*/
+int grow_fd_table(){
+  int chunk = fd_count/FD_CHUNK;
+  if(chunk == FD_MAX_CHUNKS){
+    return -1;
+  }
+  File_Descriptor *entries = aligned_alloc(_Alignof(File_Descriptor), FD_CHUNK*sizeof(File_Descriptor));
+  if(!entries){
+    return -1;
+  }
+  fd_chunks[chunk] = entries;
+  fd_count += FD_CHUNK;
+  for(int i=FD_CHUNK-1; i>=0; i--){
+    entries[i].inode_id = -1;
+    entries[i].is_free = 1;
+    entries[i].read_pointer = 0;
+    entries[i].write_pointer = 0;
+    entries[i].prev_fd = -1;
+    entries[i].next_fd = fd_free_head;
+    fd_free_head = chunk*FD_CHUNK+i;
   }
+  return 0;
 }
 
-/*Return first free fd_table entry*/
+/*Pop a free entry off the fd free list, growing the table when it is empty*/
 int find_free_fd_entry(){
-  for(int i=0; i<INODE_COUNT; i++){
-    if(fd_table[i].is_free == 1){
-      return i;
+  if(fd_free_head == -1 && grow_fd_table() == -1){
+    return -1;
+  }
+  int fd = fd_free_head;
+  fd_free_head = get_fd(fd)->next_fd;
+  get_fd(fd)->next_fd = -1;
+  return fd;
+}
+
+/*Add fd to the descriptors open on its inode*/
+void link_fd(int fd){
+  File_Descriptor *entry = get_fd(fd);
+  entry->prev_fd = -1;
+  entry->next_fd = inode_fd[entry->inode_id];
+  if(entry->next_fd != -1){
+    get_fd(entry->next_fd)->prev_fd = fd;
+  }
+  inode_fd[entry->inode_id] = fd;
+}
+
+/*Mark entry fd as open on inode_id*/
+void open_fd_entry(int fd, int inode_id, long long write_pointer){
+  File_Descriptor *entry = get_fd(fd);
+  entry->inode_id = inode_id;
+  entry->read_pointer = 0;
+  entry->write_pointer = write_pointer;
+  entry->is_free = 0;
+  link_fd(fd);
+}
+
+/*Set all attributes of entry fd to empty/free and push it back on the fd free list*/
+void release_fd_entry(int fd){
+  File_Descriptor *entry = get_fd(fd);
+  if(entry->inode_id != -1){
+    if(entry->prev_fd != -1){
+      get_fd(entry->prev_fd)->next_fd = entry->next_fd;
+    }else{
+      inode_fd[entry->inode_id] = entry->next_fd;
+    }
+    if(entry->next_fd != -1){
+      get_fd(entry->next_fd)->prev_fd = entry->prev_fd;
     }
   }
-  return -1;
+  entry->inode_id = -1;
+  entry->is_free = 1;
+  entry->read_pointer = 0;
+  entry->write_pointer = 0;
+  entry->prev_fd = -1;
+  entry->next_fd = fd_free_head;
+  fd_free_head = fd;
 }
 
 /*Initialize all inodes as empty except for inode pointing to root_directory*/
 void init_inode_table(){
+  /*Nothing of the table is on the fresh disk yet, every block gets written*/
+  memset(inode_table_disk, 0xff, sizeof(inode_table_disk));
 
   for(int i=0; i<INODE_COUNT; i++){
     inode_table[i].size = 0;
     inode_table[i].is_free = 1;
-    for(int j=0; j<12; j++){
+    inode_table[i].flags = 0;
+    for(int j=0; j<DIRECT_POINTERS; j++){
       inode_table[i].block_pointers[j] = -1;
     }
+    inode_table[i].indirect_pointer = -1;
   }
 
-  write_blocks(1, 1, &inode_table);
+  write_inode_table();
 }
 
-/*Return first free inode in inode table*/
+/*Pop a free inode off the free list of the group with the most free blocks, so new files spread over the disk*/
 int find_free_inode(){
-  for(int i=1; i<INODE_COUNT; i++){
-    if(inode_table[i].is_free){
-      return i;
+  int group = -1;
+  for(int g=0; g<BLOCK_GROUPS; g++){
+    if(group_free_inodes[g] && (group == -1 || group_free_blocks[g] > group_free_blocks[group])){
+      group = g;
     }
   }
-  return -1;
+  if(group == -1){
+    return -1;
+  }
+
+  int inode_id = inode_free_head[group];
+  inode_free_head[group] = inode_free_next[inode_id];
+  inode_free_next[inode_id] = -1;
+  group_free_inodes[group]--;
+  return inode_id;
+}
+
+/*Push inode_id back on the free list of its group*/
+void release_inode(int inode_id){
+  int group = inode_id/GROUP_INODES;
+  inode_free_next[inode_id] = inode_free_head[group];
+  inode_free_head[group] = inode_id;
+  group_free_inodes[group]++;
 }
 
 /*Initialize root directory which links inode pointers to filenames*/
-/*Maximum size of root_directory will be 22bytes per entry * 40 entries = 880bytes*/
+/*The directory is a B+tree (see sfs_dir.h) whose root node sits in block 3*/
 void init_root_directory(){
 
-  current_file_count = 0;
+  dir_format();
 
-  for(int i=0; i<INODE_COUNT; i++){
-    rt[i].inode_id = -1;
-    // rt[i].filename = "";
-    strcpy(rt[i].filename, "");
-    rt[i].in_use = 0;
-  }
+  /*Place it in the inode table*/
+  inode_table[0].size = BLOCK_SIZE;
+  inode_table[0].is_free = 0;
+  inode_table[0].block_pointers[0] = DIRECTORY_START;
 
-  write_blocks(3, 1, &rt);
+  write_inode_table();
+}
 
-  /*Place it in the inode table*/
-  void * buffer = malloc(1024*sizeof(char));
-  read_blocks(1, 1, buffer);
+/*Rebuild the inode and fd free lists, the group counters and the inode to fd index from the in memory tables.
+Lists are built back to front so that the lowest free index is handed out first.*/
+void init_free_lists(){
+  fd_free_head = -1;
+  for(int g=0; g<BLOCK_GROUPS; g++){
+    inode_free_head[g] = -1;
+    group_free_inodes[g] = 0;
+    group_free_blocks[g] = 0;
+  }
 
-  I_Node * inode = (I_Node*) buffer;
-  free(buffer);
+  for(int i=0; i<MAX_BLOCK; i++){
+    if(!bm[i]){
+      group_free_blocks[i/GROUP_BLOCKS]++;
+    }
+  }
 
-  inode[0].size = 1;
-  inode[0].is_free = 0;
-  inode[0].block_pointers[0] = 3;
+  for(int i=INODE_COUNT-1; i>=0; i--){
+    inode_fd[i] = -1;
 
-  write_blocks(1, 1, inode);
-}
+    inode_free_next[i] = -1;
+    /*Inode 0 belongs to the root directory and is never handed out*/
+    if(i>0 && inode_table[i].is_free){
+      inode_free_next[i] = inode_free_head[i/GROUP_INODES];
+      inode_free_head[i/GROUP_INODES] = i;
+      group_free_inodes[i/GROUP_INODES]++;
+    }
 
-/*Find the first free root directory entry*/
-int get_free_directory_entry(){
-  for(int i=0; i<INODE_COUNT; i++){
-    if(!rt[i].in_use){
-      return i;
+  }
+
+  for(int i=fd_count-1; i>=0; i--){
+    File_Descriptor *entry = get_fd(i);
+    if(entry->is_free){
+      entry->next_fd = fd_free_head;
+      fd_free_head = i;
+    }else{
+      link_fd(i);
     }
   }
+}
 
-  return -1;
+/*Find the inode id of the file with name "filename"*/
+int get_inode_id(char * name){
+  return dir_lookup(name);
 }
 
-/*Function used to defragment directory table*/
-void refactor_directory(){
-  root_directory_entry rt_temp[INODE_COUNT];
-  /*Initialize temp root directory*/
-  for(int i=0; i<INODE_COUNT; i++){
-    rt_temp[i].in_use = 0;
-    rt_temp[i].inode_id = -1;
-    strcpy(rt_temp[i].filename, "");
+/*Write the super block to the first block in the file system*/
+void write_super_node(){
+  void * buffer = pool_get_zeroed(BLOCK_SIZE);
+  Super_Node * super_node = (Super_Node*) buffer;
+  super_node->magic_number = 666;
+  super_node->block_size = BLOCK_SIZE;
+  super_node->block_amount = MAX_BLOCK;
+  super_node->i_node_block_length = INODE_COUNT;
+  super_node->flags = volume_flags;
+  memcpy(super_node->snapshots, snapshot_index, sizeof(snapshot_index));
+  super_node->version = SFS_VERSION;
+
+  EVENT_BEGIN(EVENT_FLUSH, "super block flush", SUPER_BLOCK, 1);
+  write_meta_block(SUPER_BLOCK, buffer);
+  write_bit_map();
+  pool_put(buffer);
+  EVENT_END(EVENT_FLUSH, "super block flush", SUPER_BLOCK, 1);
+}
+
+/*Initialize the super node in the first block of the SFS*/
+int init_fresh_super_node(){
+  volume_flags = 0;
+  for(int i=0; i<SNAPSHOT_COUNT; i++){
+    snapshot_index[i] = -1;
   }
+  write_super_node();
+
+  return 0;
+}
+
+/*Read the volume wide settings back from the super block of an existing disk*/
+void load_super_node(){
+  void * buffer = malloc(BLOCK_SIZE);
+  read_block(SUPER_BLOCK, buffer);
+  Super_Node * super_node = (Super_Node*) buffer;
+  volume_flags = super_node->flags;
+  memcpy(snapshot_index, super_node->snapshots, sizeof(snapshot_index));
+  free(buffer);
+}
 
-  /*Place contents of rt in rt_temp without segmentation*/
-  int temp_index = 0;
-  for(int j=0; j<INODE_COUNT; j++){
-    if(rt[j].in_use==1){
-      rt_temp[temp_index].in_use = 1;
-      strcpy(rt_temp[temp_index].filename, rt[j].filename);
-      rt_temp[temp_index].inode_id = rt[j].inode_id;
-      temp_index++;
+/*Drop the snapshot images read from the previous disk*/
+void init_snapshot_cache(){
+  for(int i=0; i<SNAPSHOT_COUNT; i++){
+    if(snapshot_cache[i]){
+      EVENT_INSTANT(EVENT_EVICT, "snapshot image dropped", i, SNAPSHOT_BLOCKS);
     }
+    free(snapshot_cache[i]);
+    snapshot_cache[i] = NULL;
   }
+}
 
-  /*Wipe contents of rt in memory*/
-  for(int k=0; k<INODE_COUNT; k++){
-    rt[k].inode_id = -1;
-    strcpy(rt[k].filename, "");
-    rt[k].in_use = 0;
-  }
+/*Set inital values of BIT_MAP (the blocks after the directory root will be empty)*/
+void init_bit_map(){
+  /*Super block in block 0*/
+  bm[SUPER_BLOCK] = 1;
 
-  /*Replace contents of rt with rt_temp in memory*/
-  for(int l=0; l<INODE_COUNT; l++){
-    if(rt_temp[l].in_use==1){
-      rt[l].in_use = 1;
-      rt[l].inode_id = rt_temp[l].inode_id;
-      strcpy(rt[l].filename, rt_temp[l].filename);
-    }
+  /*Inode table from block 1*/
+  for(int i=0; i<INODE_TABLE_BLOCKS; i++){
+    bm[INODE_TABLE_START+i] = 1;
   }
 
-  /*Flush changes to the disk*/
-  write_blocks(3, 1, &rt);
-}
+  /*Bit map after the inode table*/
+  bm[BIT_MAP_START] = 1;
 
-void set_rt_pointer(){
-  rt_pointer = 0;
-  for(int i=0; i<INODE_COUNT; i++){
-    if(rt[i].in_use==1){
-      rt_pointer++;
-    }
+  /*Root of the directory tree after the bit map*/
+  bm[DIRECTORY_START] = 1;
+
+  /*All other blocks set to empty i.e. 0*/
+  for(int i=DIRECTORY_START+1; i<MAX_BLOCK; i++){
+    bm[i] = 0;
   }
+  memset(block_unwritten, 0, sizeof(block_unwritten));
+
+  write_bit_map();
+
 }
 
-/*Find the inode id of the file with name "filename"*/
-int get_inode_id(char * name){
-  for(int i=0; i<INODE_COUNT; i++){
-    if(strcmp(rt[i].filename, name)==0 && rt[i].in_use==1){
-      return rt[i].inode_id;
+/*Take the first empty block of group, or of the groups after it when group is full (the caller flushes the bit map).
+The in memory bit map is used so blocks taken but not yet flushed are not handed out twice.
+Returns -1 if the disk is full.*/
+int take_block(int group){
+  for(int g=0; g<BLOCK_GROUPS; g++){
+    int current = (group+g)%BLOCK_GROUPS;
+    if(!group_free_blocks[current]){
+      continue;
+    }
+    for(int i=current*GROUP_BLOCKS; i<(current+1)*GROUP_BLOCKS; i++){
+      if(!bm[i]){
+        bm[i] = 1;
+        group_free_blocks[current]--;
+        return i;
+      }
     }
   }
+
   return -1;
 }
 
-/*Find the rt_index of the file with name "filename" in the root directory*/
-int get_rt_index(char * name){
-  for(int i=0; i<INODE_COUNT; i++){
-    if(strcmp(rt[i].filename, name)==0 && rt[i].in_use==1){
-      return i;
+/*Take count consecutive empty blocks, looking in group first and then in the groups after it
+(the caller flushes the bit map). A run may cross into the next group.
+Returns the first block of the run, or -1 if no run of that length is free.*/
+int take_run(int count, int group){
+  for(int g=0; g<BLOCK_GROUPS; g++){
+    int current = (group+g)%BLOCK_GROUPS;
+    int length = 0;
+    for(int i=current*GROUP_BLOCKS; i<MAX_BLOCK; i++){
+      length = bm[i] ? 0 : length+1;
+      if(length == count){
+        int first = i-count+1;
+        for(int b=first; b<=i; b++){
+          bm[b] = 1;
+          group_free_blocks[b/GROUP_BLOCKS]--;
+        }
+        return first;
+      }
+      /*Runs have to start inside this group*/
+      if(length == 0 && i >= (current+1)*GROUP_BLOCKS-1){
+        break;
+      }
     }
   }
   return -1;
 }
 
-/*Initialize the super node in the first block of the SFS*/
-int init_fresh_super_node(){
-  int magic_number = 666;
-  /*Write the super block to the first block in the file system*/
-  Super_Node super_node;
-  super_node.magic_number = magic_number;
-  super_node.block_size = BLOCK_SIZE;
-  super_node.block_amount = MAX_BLOCK;
-  super_node.i_node_block_length = INODE_COUNT;
-
-  write_blocks(0, 1, &super_node);
+/*Group whose blocks hold the data of the file with inode in*/
+int file_group(I_Node *in){
+  return (int)(in-inode_table)/GROUP_INODES;
+}
 
-  return 0;
+/*Take an empty block for metadata (directory nodes) and flush the bit map, -1 if the disk is full*/
+int allocate_block(){
+  int block = take_block(0);
+  if(block == -1){
+    return -1;
+  }
+  write_bit_map();
+  return block;
 }
 
-/*Set inital values of BIT_MAP (4-99 inclusively will be empty)*/
-void init_bit_map(){
-  /*Super block in block 0*/
-  bm[0] = 1;
+/*Drop block from the fingerprint index*/
+void forget_fingerprint(int block){
+  if(!fingerprint_indexed[block]){
+    return;
+  }
+  int *link = &fingerprint_head[fingerprint[block]%FINGERPRINT_BUCKETS];
+  while(*link != block){
+    link = &fingerprint_next[*link];
+  }
+  *link = fingerprint_next[block];
+  fingerprint_indexed[block] = 0;
+  EVENT_INSTANT(EVENT_EVICT, "fingerprint dropped", block, 1);
+}
 
-  /*Inode table in block 1*/
-  bm[1] = 1;
+/*Add block, whose content hashes to hash, to the fingerprint index*/
+void remember_fingerprint(int block, unsigned long long hash){
+  forget_fingerprint(block);
+  int bucket = hash%FINGERPRINT_BUCKETS;
+  fingerprint[block] = hash;
+  fingerprint_next[block] = fingerprint_head[bucket];
+  fingerprint_head[bucket] = block;
+  fingerprint_indexed[block] = 1;
+}
 
-  /*Bit map in block 2*/
-  bm[2] = 1;
+/*Empty the fingerprint index*/
+void init_fingerprint_index(){
+  for(int i=0; i<FINGERPRINT_BUCKETS; i++){
+    fingerprint_head[i] = -1;
+  }
+  for(int i=0; i<MAX_BLOCK; i++){
+    fingerprint_indexed[i] = 0;
+    fingerprint_next[i] = -1;
+  }
+}
 
-  /*Directory table in block 3*/
-  bm[3] = 1;
+/*Return an indexed block holding exactly the BLOCK_SIZE bytes of data, -1 if there is none.
+Candidates are compared byte for byte, so a fingerprint collision never shares the wrong data.*/
+int find_duplicate_block(unsigned long long hash, void *data){
+  int found = -1;
+  void * buffer = pool_get(BLOCK_SIZE);
+  for(int block = fingerprint_head[hash%FINGERPRINT_BUCKETS]; block != -1; block = fingerprint_next[block]){
+    if(fingerprint[block] != hash){
+      continue;
+    }
+    if(read_block(block, buffer) == 0 && memcmp(buffer, data, BLOCK_SIZE) == 0){
+      found = block;
+      break;
+    }
+  }
+  pool_put(buffer);
+  return found;
+}
 
-  /*All other blocks set to empty i.e. 0*/
-  for(int i=4; i<MAX_BLOCK; i++){
-    bm[i] = 0;
+/*Drop one reference to block, the block is free once nobody references it (the caller flushes the bit map)*/
+void unref_block(int block){
+  bm[block]--;
+  if(bm[block] == 0){
+    forget_fingerprint(block);
+    block_unwritten[block] = 0;
+    group_free_blocks[block/GROUP_BLOCKS]++;
   }
+}
 
-  write_blocks(2, 1, &bm);
+/*Return block to the bit map and flush it*/
+void release_block(int block){
+  unref_block(block);
+  write_bit_map();
+}
 
+/*Format version of the mounted disk, SFS_VERSION for a disk that is not a volume at all*/
+int read_format_version(){
+  Super_Node * super_node = malloc(BLOCK_SIZE);
+  read_blocks(SUPER_BLOCK, 1, super_node);
+  int version = super_node->version == 0 ? 1 : super_node->version;
+  if(super_node->magic_number != 666){
+    version = SFS_VERSION;
+  }
+  free(super_node);
+  return version;
 }
 
-/*Iterate through bit map on disk and find first empty block i.e 0 value*/
-int get_first_empty_block(){
-  /*Itialize empty buffer of one block size to read bit map from disk*/
-  void * buffer = malloc(1024*(sizeof(char)));
-  read_blocks(2, 1, buffer);
-  int * disk_bit_map = (int*) buffer;
+/*Fill in from a version 1 inode. Inline data that no longer fits in the smaller inode moves to a new
+data block of group. The block is written now, it was free in the old bit map so the old volume is
+not touched. Returns -1 if no block is free.*/
+int upgrade_inode(I_Node_V1 *old, I_Node *in, int group){
+  memset(in, 0, sizeof(I_Node));
+  in->size = old->size;
+  in->is_free = old->is_free;
+  in->flags = old->flags;
+  in->indirect_pointer = -1;
+  if(!(old->flags & INODE_INLINE)){
+    memcpy(in->block_pointers, old->block_pointers, sizeof(in->block_pointers));
+    return 0;
+  }
+  if(old->size <= INODE_INLINE_SIZE){
+    memcpy(in->inline_data, old->inline_data, INODE_INLINE_SIZE);
+    return 0;
+  }
+
+  int block = take_block(group);
+  if(block == -1){
+    return -1;
+  }
+  void * buffer = calloc(1, BLOCK_SIZE);
+  memcpy(buffer, old->inline_data, old->size);
+  write_data_block(block, buffer);
   free(buffer);
+  in->flags &= ~INODE_INLINE;
+  memset(in->block_pointers, 0xff, sizeof(in->block_pointers));
+  in->block_pointers[0] = block;
+  return 0;
+}
 
-  for(int i=0; i<MAX_BLOCK; i++){
-    if(!disk_bit_map[i]){
-      return i;
+/*Number of the count version 1 inodes whose inline data needs a data block in the current format*/
+int inline_overflow(I_Node_V1 *inodes, int count){
+  int needed = 0;
+  for(int i=0; i<count; i++){
+    if((inodes[i].flags & INODE_INLINE) && inodes[i].size > INODE_INLINE_SIZE){
+      needed++;
     }
   }
-
-  return -1;
+  return needed;
 }
 
-/*Determine whether a file is in the fd table*/
-int find_fd_index(char *name){
-  int inode_id = get_inode_id(name);
-  for(int i=0; i<INODE_COUNT; i++){
-    if(fd_table[i].inode_id==inode_id){
-      return i;
-    }
+/*Read snapshot id of a version 1 volume, blocks gets its index block. Returns NULL if a block is bad.*/
+Snapshot_Image_V1 *read_snapshot_v1(int id, int *blocks){
+  Snapshot_Image_V1 *old = malloc(SNAPSHOT_BLOCKS_V1*BLOCK_SIZE);
+  int failed = read_block(snapshot_index[id], blocks);
+  for(int i=0; i<SNAPSHOT_BLOCKS_V1 && !failed; i++){
+    failed = read_block(blocks[i], (char*)old+i*BLOCK_SIZE);
+  }
+  if(failed){
+    free(old);
+    return NULL;
   }
+  return old;
+}
 
-  /*File not found*/
-  return -1;
+/*Convert a version 1 snapshot image, returns the image in the current format or NULL if the disk is full*/
+Snapshot_Image *upgrade_snapshot(Snapshot_Image_V1 *old){
+  Snapshot_Image *image = calloc(1, SNAPSHOT_BLOCKS*BLOCK_SIZE);
+  image->entry_count = old->entry_count;
+  memcpy(image->entries, old->entries, sizeof(image->entries));
+  int failed = 0;
+  for(int i=0; i<INODE_COUNT && !failed; i++){
+    failed = upgrade_inode(&old->inodes[i], &image->inodes[i], 0);
+  }
+  if(failed){
+    free(image);
+    return NULL;
+  }
+  return image;
 }
 
-/*Return the number of files in the root directory*/
-int get_file_count(){
-  int count = 0;
+/*Bring a version 1 volume up to SFS_VERSION in place.
+The inodes are packed into the new table, inline files too long for the new inode get a data block,
+and the bit map and directory root move down to their new blocks, which frees the blocks they leave.
+Snapshot images shrink the same way and give back the blocks they no longer fill.
+Everything is converted in memory before the first metadata block is written and the super block goes
+last with the new version, but a crash in between still leaves a broken volume: keep a copy of an image
+that matters until it has mounted once. Every block of the old volume is read and the blocks the inline
+files need are counted before the first write, so it returns -1 with the disk as it was when the disk is
+too full for those files or a block of the old volume is bad. The tables in memory are not restored,
+the caller leaves the volume unmounted.*/
+int upgrade_volume(){
+  Bit_Map_Block * map = malloc(BLOCK_SIZE);
+  read_blocks(BIT_MAP_START_V1, 1, map);
+  memcpy(bm, map->bm, sizeof(bm));
+  memcpy(block_unwritten, map->unwritten, sizeof(block_unwritten));
+  if(crc32c(map, offsetof(Bit_Map_Block, self_crc)) == map->self_crc){
+    checksum_table = map->checksums;
+  }else{
+    memset(&checksum_table, 0, sizeof(checksum_table));
+  }
+  free(map);
+  load_super_node();
+
+  I_Node_V1 * old = malloc(INODE_TABLE_BLOCKS_V1*BLOCK_SIZE);
+  int failed = 0;
+  for(int i=0; i<INODE_TABLE_BLOCKS_V1; i++){
+    failed |= read_block(INODE_TABLE_START+i, (char*)old+i*BLOCK_SIZE);
+  }
+  void * root = malloc(BLOCK_SIZE);
+  failed |= read_block(DIRECTORY_START_V1, root);
+  Snapshot_Image_V1 *old_images[SNAPSHOT_COUNT] = {NULL};
+  int *blocks[SNAPSHOT_COUNT] = {NULL};
+  for(int id=0; id<SNAPSHOT_COUNT && !failed; id++){
+    if(snapshot_index[id] != -1){
+      blocks[id] = malloc(BLOCK_SIZE);
+      old_images[id] = read_snapshot_v1(id, blocks[id]);
+      failed = old_images[id] == NULL;
+    }
+  }
 
+  init_fd_table();
   for(int i=0; i<INODE_COUNT; i++){
-    if(rt[i].in_use){
-      count++;
+    inode_table[i].is_free = old[i].is_free;
+  }
+  init_free_lists();
+
+  /*upgrade_inode writes the block of an inline file as it goes, make sure every one of them fits first*/
+  int needed = inline_overflow(old, INODE_COUNT);
+  for(int id=0; id<SNAPSHOT_COUNT; id++){
+    if(old_images[id]){
+      needed += inline_overflow(old_images[id]->inodes, INODE_COUNT);
     }
   }
+  int free_blocks = 0;
+  for(int g=0; g<BLOCK_GROUPS; g++){
+    free_blocks += group_free_blocks[g];
+  }
+  failed |= needed > free_blocks;
 
-  return count;
+  for(int i=0; i<INODE_COUNT && !failed; i++){
+    failed = upgrade_inode(&old[i], &inode_table[i], i/GROUP_INODES);
+  }
+  inode_table[0].block_pointers[0] = DIRECTORY_START;
+  free(old);
+
+  Snapshot_Image *images[SNAPSHOT_COUNT] = {NULL};
+  for(int id=0; id<SNAPSHOT_COUNT && !failed; id++){
+    if(old_images[id]){
+      images[id] = upgrade_snapshot(old_images[id]);
+      failed = images[id] == NULL;
+    }
+  }
+
+  /*Nothing of the old metadata has been written over up to here.
+  The blocks of the old fixed area past the new one are free from now on.*/
+  if(!failed){
+    for(int b=DIRECTORY_START+1; b<=DIRECTORY_START_V1; b++){
+      bm[b] = 0;
+      block_unwritten[b] = 0;
+      checksum_table.covered[b] = 0;
+    }
+    for(int id=0; id<SNAPSHOT_COUNT; id++){
+      if(!images[id]){
+        continue;
+      }
+      for(int i=0; i<SNAPSHOT_BLOCKS; i++){
+        write_meta_block(blocks[id][i], (char*)images[id]+i*BLOCK_SIZE);
+      }
+      for(int i=SNAPSHOT_BLOCKS; i<SNAPSHOT_BLOCKS_V1; i++){
+        unref_block(blocks[id][i]);
+        blocks[id][i] = -1;
+      }
+      write_meta_block(snapshot_index[id], blocks[id]);
+    }
+    write_meta_block(DIRECTORY_START, root);
+    memset(inode_table_disk, 0xff, sizeof(inode_table_disk));
+    memset(bit_map_disk, 0xff, sizeof(bit_map_disk));
+    write_inode_table();
+    write_super_node();
+  }
+
+  for(int id=0; id<SNAPSHOT_COUNT; id++){
+    free(old_images[id]);
+    free(images[id]);
+    free(blocks[id]);
+  }
+  free(root);
+  return failed ? -1 : 0;
 }
 
-void mksfs(int fresh){
+/*Set by a mksfs that mounted the disk. Until then, and after a mksfs that could not, the tables in memory
+do not describe the disk and every call fails instead of reading them or writing them out.
+Changed under the volume lock, file_size reads it without the lock.*/
+static int volume_mounted = 0;
+
+static void mount_sfs(int fresh){
 
+  __atomic_store_n(&volume_mounted, 0, __ATOMIC_RELAXED);
 	/*Init disc if it does not already exist*/
 	if(fresh == 0){
 		init_disk(filename, BLOCK_SIZE, MAX_BLOCK);
+    /*An older volume is upgraded first, one that can not be is left alone and not mounted*/
+    if(read_format_version() < SFS_VERSION && upgrade_volume() == -1){
+      printf("Could not upgrade %s to format version %d\n", filename, SFS_VERSION);
+      return;
+    }
+    load_checksum_table();
+    load_super_node();
+    load_inode_table();
+    init_snapshot_cache();
+    init_fingerprint_index();
+    dir_mount();
 	}else{
 		/*Disc does not already exist*/
 		init_fresh_disk(filename, BLOCK_SIZE, MAX_BLOCK);
+    init_checksum_table();
     init_fresh_super_node();
     init_bit_map();
     init_inode_table();
     init_root_directory();
     init_fd_table();
+    init_fingerprint_index();
+    init_snapshot_cache();
     
     /*Testing purposes*/
     void * buffer = malloc(1024*(sizeof(char)));
@@ -305,13 +869,13 @@ void mksfs(int fresh){
     free(buffer);
 
     void * buffer2 = malloc(1024*(sizeof(char)));
-    read_blocks(2, 1, buffer2);
+    read_blocks(BIT_MAP_START, 1, buffer2);
     int * a = (int*) buffer2;
-    printf("Bit map: %d\n", a[3]);
+    printf("Bit map: %d\n", a[DIRECTORY_START]);
     free(buffer2);
 
     void * buffer3 = malloc(1024*(sizeof(char)));
-    read_blocks(1, 1, buffer3);
+    read_blocks(INODE_TABLE_START, 1, buffer3);
     I_Node * inode = (I_Node*) buffer3;
     printf("INode table: %d\n", inode[0].block_pointers[0]);
     free(buffer3);
@@ -319,94 +883,138 @@ void mksfs(int fresh){
 		fresh = 1;
 	}
 
+  init_free_lists();
+  __atomic_store_n(&volume_mounted, 1, __ATOMIC_RELAXED);
 }
 
-/*Find the next file being pointed in root_directory to and write filename into fname*/
-int sfs_get_next_file_name(char *fname){
-
-  int count = get_file_count();
-
-  if(rt_pointer== count){
-    rt_pointer=0;
-    return 0;
-  }else{
-    strcpy(fname, rt[rt_pointer].filename);
-    rt_pointer++;
-    return 1;
-  }
-
+/*Find the next file in the directory walk and write filename into fname
+Names come back in hash order by walking the leaves of the directory tree*/
+static int next_file_name(char *fname){
+  return dir_next(fname);
 }
 
-/*Return the size of a file stored in the inode of that file.*/
-int sfs_get_file_size(char* path){
-  int inode = get_inode_id(path);
+/*Change the size of a file, the store is atomic because file_size reads it without the volume lock*/
+static void set_file_size(I_Node *in, long long size){
+  __atomic_store_n(&in->size, size, __ATOMIC_RELAXED);
+}
 
-  return inode_table[inode].size;
+/*Return the size of a file stored in the inode of that file.
+It runs without the volume lock: the lookup and the size read share one directory read section,
+so a file removed or created meanwhile is looked up again instead of reporting another file's size.*/
+static long long file_size(char* path){
+  unsigned int sequence;
+  long long size;
+  do{
+    sequence = dir_read_begin();
+    int inode = get_inode_id(path);
+    size = !__atomic_load_n(&volume_mounted, __ATOMIC_RELAXED) || inode == -1 ? -1 : __atomic_load_n(&inode_table[inode].size, __ATOMIC_RELAXED);
+  }while(dir_read_retry(sequence));
+  return size;
 }
 
 /*Allocate inode and directory entry for new file*/
 int sfs_create(char *name){
   int inode_index = find_free_inode();
-  int free_directory_entry = get_free_directory_entry();
 
   /*No empty inodes*/
-  if(inode_index > INODE_COUNT){
+  if(inode_index == -1){
     return -1;
   }
 
-  /*Setting inode values*/
-  inode_table[inode_index].size = 0;
+  /*Setting inode values, a new file starts out with its data inline*/
+  set_file_size(&inode_table[inode_index], 0);
   inode_table[inode_index].is_free = 0;
+  inode_table[inode_index].flags = INODE_INLINE;
+  if(volume_flags & VOLUME_COMPRESSED){
+    inode_table[inode_index].flags |= INODE_COMPRESSED;
+  }
+  memset(inode_table[inode_index].inline_data, 0, INODE_INLINE_SIZE);
+
+  /*Setting directory values last, lockless lookups find the inode ready.
+  Fails on a name that is too long or a full disk.*/
+  if(dir_insert(name, inode_index) == -1){
+    inode_table[inode_index].is_free = 1;
+    inode_table[inode_index].flags = 0;
+    for(int i=0; i<DIRECT_POINTERS; i++){
+      inode_table[inode_index].block_pointers[i] = -1;
+    }
+    release_inode(inode_index);
+    return -1;
+  }
 
-  /*Setting directory values*/
-  rt[free_directory_entry].inode_id = inode_index;
-  rt[free_directory_entry].in_use = 1;
-  strcpy(rt[free_directory_entry].filename, name);
-
-  /*Flush changes to inode table and root_directory table*/
-  write_blocks(1, 1, &inode_table);
-  write_blocks(3, 1, &rt);
+  /*Flush changes to inode table, the directory tree flushed its own blocks*/
+  write_inode_table();
 
-  /*Increment number of files counter  rt_pointer*/
-  current_file_count++;
   return inode_index;
 }
 
+/*Make dst a copy of the file src without copying any data.
+dst gets the same inode contents and every data block of src gains a reference,
+the first write to either file copies the block it touches (see put_data_block and store_cluster).
+Returns 0, or -1 if src does not exist, dst already exists or there is no free inode.*/
+static int clone_file(char *src, char *dst){
+  int src_index = get_inode_id(src);
+  if(src_index <= 0 || get_inode_id(dst) > 0){
+    return -1;
+  }
+
+  int dst_index = sfs_create(dst);
+  if(dst_index == -1){
+    return -1;
+  }
+
+  /*Inline data lives in the inode and is copied with it*/
+  inode_table[dst_index] = inode_table[src_index];
+  if(!(inode_table[dst_index].flags & INODE_INLINE)){
+    for(int i=0; i<DIRECT_POINTERS; i++){
+      if(inode_table[dst_index].block_pointers[i] >= 0){
+        bm[inode_table[dst_index].block_pointers[i]]++;
+      }
+    }
+  }
+
+  /*Flush changes to inode table and bitmap*/
+  write_inode_table();
+
+  return 0;
+}
+
 /*Steps to open file
-1. Search for file in rt and find corresponding inode
-2. If found, fopen file with append mode and store FILE pointer in open_files table and return inode
+1. Search for file in the directory and find corresponding inode (index, looked up by the caller)
+2. If found, take a new fd table entry with the write pointer at the end of the file and return it
 3. Else, create file on top of everything else*/
-int sfs_fopen(char *name){
+static int open_inode(char *name, int index){
   int fd_table_index;
-  int index = get_inode_id(name);
 
   /*File exists*/
   if(index>0){
-    /*Check if already in fd_table*/
-    if(find_fd_index(name)!=-1){
+    /*A file open already gets another descriptor with pointers of its own*/
+    fd_table_index = find_free_fd_entry();
+    if(fd_table_index == -1){
       return -1;
     }
 
-    fd_table_index = find_free_fd_entry();
-
-    fd_table[fd_table_index].inode_id = index;
-    fd_table[fd_table_index].read_pointer = 0;
-    /*Change this to actual end of file*/
-    fd_table[fd_table_index].write_pointer = inode_table[index].size;
-    fd_table[fd_table_index].is_free = 0;
+    /*Write pointer starts at the end of file*/
+    open_fd_entry(fd_table_index, index, inode_table[index].size);
 
     return fd_table_index;
 
   /*File does not exist*/
   }else{
+    /*Take the fd first so a full fd table does not leave a created file behind*/
+    fd_table_index = find_free_fd_entry();
+    if(fd_table_index == -1){
+      return -1;
+    }
+
     /*Create file*/
     int inode_index = sfs_create(name);
-    fd_table_index = find_free_fd_entry();
+    if(inode_index == -1){
+      release_fd_entry(fd_table_index);
+      return -1;
+    }
 
-    fd_table[fd_table_index].inode_id = inode_index;
-    fd_table[fd_table_index].read_pointer = 0;
-    fd_table[fd_table_index].write_pointer = 0;
-    fd_table[fd_table_index].is_free = 0;
+    open_fd_entry(fd_table_index, inode_index, 0);
 
     return fd_table_index;
   }
@@ -414,326 +1022,1839 @@ int sfs_fopen(char *name){
   return -1;
 }
 
+static int open_file(char *name){
+  return open_inode(name, get_inode_id(name));
+}
+
+/*Check that fileID is an open entry of the fd table*/
+int is_open_fd(int fileID){
+  File_Descriptor *entry = get_fd(fileID);
+  return entry && !entry->is_free;
+}
+
 /*Find the file in the fd_table and set all attributes of that entry to empty/free*/
-int sfs_fclose(int fileID){
-  if(fileID<0 || fileID>INODE_COUNT){
-    return -1;
-  }else if(fd_table[fileID].is_free){
+static int close_file(int fileID){
+  if(!is_open_fd(fileID)){
     return -1;
   }
-  fd_table[fileID].inode_id = -1;
-  fd_table[fileID].is_free = 1;
-  fd_table[fileID].read_pointer = 0;
-  fd_table[fileID].write_pointer = 0;
+  release_fd_entry(fileID);
   return 0;
 }
 
 /*Move the read pointer between the start and end of the file*/
-int sfs_frseek(int fileID, int loc){
-  int inode_id = fd_table[fileID].inode_id;
-  I_Node in = inode_table[inode_id];
+static int seek_read(int fileID, long long loc){
+  if(!is_open_fd(fileID)){
+    return -1;
+  }
+
+  int inode_id = get_fd(fileID)->inode_id;
 
   if(loc<0){
     return -1;
   }
 
-  if(loc > in.size){
+  if(loc > inode_table[inode_id].size){
     return -1;
   }
 
-  fd_table[fileID].read_pointer = loc;
+  get_fd(fileID)->read_pointer = loc;
 
   return 0;
 }
 
-/*Move the write pointer between the start and end of the file*/
-int sfs_fwseek(int fileID, int loc){
-  int inode_id = fd_table[fileID].inode_id;
-  I_Node in = inode_table[inode_id];
+/*Move the write pointer anywhere up to the largest file size.
+Writing past the end of the file leaves a hole between the old end and the write, see write_at.*/
+static int seek_write(int fileID, long long loc){
+  if(!is_open_fd(fileID)){
+    return -1;
+  }
 
   if(loc<0){
     return -1;
   }
 
-  if(loc > in.size){
+  if(loc > MAX_FILE_SIZE){
     return -1;
   }
 
-  fd_table[fileID].write_pointer = loc;
+  get_fd(fileID)->write_pointer = loc;
 
   return 0;
 }
 
-/*Write the contents of buf of size length to fileID
-Strategy:
-1. Get file descriptor from file descriptor table
-2. Get Inode associated to file
-3. Compute which block to write to based on file's write pointer
-4. Compute size after write: write pointer + length
-5. Compute remaining space after write_pointer
-6. Read block containing write pointer and place in buffer
-*/
-int sfs_fwrite(int fileID, char *buf, int length){
-  /*Check if file is open*/
-  if(fd_table[fileID].is_free){
+/*Return the disk block holding block number "index" of the file.
+Returns -1 past the last direct pointer or for a block that was never written.*/
+int get_data_block(I_Node *in, int index){
+  if(index<0 || index>=DIRECT_POINTERS){
     return -1;
   }
 
-  int inode_id = fd_table[fileID].inode_id;
-  int write_pointer = fd_table[fileID].write_pointer;
-
-  I_Node in = inode_table[inode_id];
+  return in->block_pointers[index];
+}
 
-  /*If block not yet written to, find free block to write to*/
-  if(in.block_pointers[0] == -1){
-    /*Search bitmap for empty block*/
-    int free_block = get_first_empty_block();
-    bm[free_block] = 1;
-    in.block_pointers[0] = free_block;
+/*Make block number "index" of the file hold the BLOCK_SIZE bytes of data (the caller flushes the bit map).
+With deduplication on, a block that already holds the same bytes is shared instead of written.
+A block with more than one reference is never written in place, the file gets its own copy.
+Returns the block used, or -1 past the last direct pointer or when the disk is full.*/
+int put_data_block(I_Node *in, int index, void *data){
+  if(index<0 || index>=DIRECT_POINTERS){
+    return -1;
   }
 
-  /*Determinine the amount to be added to file.*/
-  /*If the size of the write_pointer offset and the length of the file to be added
-  is larger than the total size of the file before the write operation, than the new size 
-  will be write pointer offset + length of file.
-  Else size stays the same.*/
-  int new_size = write_pointer + length;
-  int size_in_blocks = (new_size/1024)+1;
-  if(new_size>in.size){
-    in.size = new_size;
+  int old = in->block_pointers[index];
+  unsigned long long hash = 0;
+
+  if(volume_flags & VOLUME_DEDUP){
+    hash = hash64(data, BLOCK_SIZE, 0);
+    int match = find_duplicate_block(hash, data);
+    if(match != -1){
+      if(match != old){
+        bm[match]++;
+        if(old != -1){
+          unref_block(old);
+        }
+        in->block_pointers[index] = match;
+      }
+      return match;
+    }
   }
 
-  /*block to write is the block which contains the write_pointer 
-  and the block in which writing will being*/
-  int block_to_write = write_pointer/1024;
+  int block = old;
+  if(block == -1 || bm[block] > 1){
+    block = take_block(file_group(in));
+    if(block == -1){
+      return -1;
+    }
+    if(old != -1){
+      unref_block(old);
+    }
+    in->block_pointers[index] = block;
+  }
+
+  write_data_block(block, data);
+  if(volume_flags & VOLUME_DEDUP){
+    remember_fingerprint(block, hash);
+  }else{
+    forget_fingerprint(block);
+  }
+  return block;
+}
 
-  /*block to end is the block in which the writing will stop*/
-  int block_to_end = (write_pointer+length)/1024;
+/*Move the data of an inline file out of the inode into its first data block.
+An empty file gets no block, so a first write past its end leaves block 0 a hole.
+Returns 0, or -1 when there is no free block (the file is left inline).*/
+int convert_inline_file(I_Node *in){
+  I_Node inline_node = *in;
 
-  /*Check if the starting node is greater than 10, requiring a search in the indirection node*/
-  if(block_to_write>11){
-    /*Check indirection block*/
+  in->flags &= ~INODE_INLINE;
+  for(int i=0; i<DIRECT_POINTERS; i++){
+    in->block_pointers[i] = -1;
+  }
+  in->indirect_pointer = -1;
+  if(in->size == 0){
+    return 0;
   }
 
-  if(block_to_end>11){
-    /*Check indrection block*/
+  void * buffer = pool_get_zeroed(BLOCK_SIZE);
+  memcpy(buffer, inline_node.inline_data, in->size);
+  int block = put_data_block(in, 0, buffer);
+  pool_put(buffer);
+
+  if(block == -1){
+    *in = inline_node;
+    return -1;
   }
+  return 0;
+}
 
-  /*
-  1) Container will act as a container for the old content before the write pointer, the new content,
-    and the content after the write_pointer+length.
-  2) Read the block in which the write pointer is located into void buffer.
-  3) Cast to char pointer and copy into container.
-  4) Copy the write content into the container starting at the write_pointer offset.
-  */
-  char * container = malloc(size_in_blocks*1024*sizeof(char));
+/*Write length bytes of buf at position of an uncompressed file, block by block.
+Returns the number of bytes written, short when the file is at its last pointer or the disk is full.*/
+long long write_file_blocks(I_Node *in, char *buf, long long position, long long length){
+  long long written = 0;
+  void * buffer = pool_get(BLOCK_SIZE);
+  while(written<length){
+    int offset = (position+written)%BLOCK_SIZE;
+    int amount = BLOCK_SIZE-offset;
+    if(amount > length-written){
+      amount = length-written;
+    }
 
-  void * start_buffer = malloc(1024*sizeof(char));
-  read_blocks(in.block_pointers[block_to_write], 1, start_buffer);
-  char * start_block = (char*) start_buffer;
-  free(start_buffer);
+    if(position+written >= MAX_FILE_SIZE){
+      break;
+    }
+    int index = (position+written)/BLOCK_SIZE;
+
+    /*A partly overwritten block keeps the bytes around the new content*/
+    int block = get_data_block(in, index);
+    if(amount<BLOCK_SIZE && block != -1){
+      /*Do not carry a corrupt block forward*/
+      if(read_block(block, buffer) == -1){
+        break;
+      }
+    }else if(amount<BLOCK_SIZE){
+      memset(buffer, 0, BLOCK_SIZE);
+    }
+    memcpy((char*)buffer+offset, buf+written, amount);
 
-  /*Block holding write pointer is placed in container*/
-  strcpy(container, start_block);
+    /*Disk full*/
+    if(put_data_block(in, index, buffer) == -1){
+      break;
+    }
 
-  /*Content to be written, now written to position of write_pointer
-  Container now contains the old block and the new content*/
-  strcpy(container+write_pointer, buf);
+    written += amount;
+  }
+  pool_put(buffer);
+  return written;
+}
 
-  /*Keep writing what's in container until nothing left*/
-  int current_block = block_to_write;
-  char * current_content_block;
-  int free_block;
-  while(size_in_blocks>0){
+/*Read count consecutive blocks from block on straight into buf with one disk read, then check each.
+A block that fails its checksum goes through read_block, which looks for a good copy.
+Returns the number of blocks from the start of the run that were read good.*/
+int read_block_run(int block, int count, char *buf){
+  if(read_blocks(block, count, buf) < count){
+    count = 0;
+  }
+  for(int i=0; i<count; i++){
+    char *data = buf+i*BLOCK_SIZE;
+    if(checksum_table.covered[block+i] && crc32c(data, BLOCK_SIZE) != checksum_table.crc[block+i] &&
+      read_block(block+i, data) == -1){
+      return i;
+    }
+  }
+  return count;
+}
 
-    /*If block not yet written to, find free block to write to*/
-    if(in.block_pointers[current_block] == -1){
-      /*Search bitmap for empty block*/
-      free_block = get_first_empty_block();
-      bm[free_block] = 1;
-      in.block_pointers[current_block] = free_block;
+/*Read length bytes at position of an uncompressed file into buf, returns the number of bytes read.
+Whole blocks that lie next to each other on disk are read together, so a contiguous file costs one
+disk read per run instead of one per block. Holes read as zeros without a disk read.
+The read stops short at a block that fails its checksum.*/
+long long read_file_blocks(I_Node *in, char *buf, long long position, long long length){
+  long long done = 0;
+  void * buffer = pool_get(BLOCK_SIZE);
+  while(done<length){
+    int offset = (position+done)%BLOCK_SIZE;
+    int amount = BLOCK_SIZE-offset;
+    if(amount > length-done){
+      amount = length-done;
     }
 
-    /*Segment contianer into block increments*/
-    current_content_block = malloc(1024*sizeof(char));
-    strncpy(current_content_block, container, 1024);
+    int index = (position+done)/BLOCK_SIZE;
+    int block = get_data_block(in, index);
+    if(block == -1){
+      memset(buf+done, 0, amount);
+      done += amount;
+      continue;
+    }
 
-    /*Remove 1 blocks worth of content*/
-    strcpy(container, container+1024);
+    /*Unwritten blocks go through read_block, which fills in their zeros*/
+    if(offset == 0 && amount == BLOCK_SIZE && !block_unwritten[block]){
+      int run = 1;
+      while((run+1)*BLOCK_SIZE <= length-done && get_data_block(in, index+run) == block+run &&
+        !block_unwritten[block+run]){
+        run++;
+      }
+      int good = read_block_run(block, run, buf+done);
+      done += good*BLOCK_SIZE;
+      if(good < run){
+        break;
+      }
+      continue;
+    }
 
-    /*Write the block segment into */
-    write_blocks(in.block_pointers[current_block], 1, current_content_block);
-    free(current_content_block);
+    if(read_block(block, buffer) == -1){
+      break;
+    }
+    memcpy(buf+done, (char*)buffer+offset, amount);
 
-    current_block++;
-    size_in_blocks--;
+    done += amount;
   }
+  pool_put(buffer);
+  return done;
+}
 
-  /*Update fd_table and inode table*/
-  fd_table[fileID].write_pointer = write_pointer + length;
-  inode_table[inode_id].size = in.size;
-  for(int k=0; k<12; k++){
-    inode_table[inode_id].block_pointers[k] = in.block_pointers[k];
+/*Read cluster number "cluster" of a compressed file into data (CLUSTER_SIZE bytes).
+Bytes past the end of the file are zero. Returns -1 if a block fails its checksum or a compressed cluster fails to decode.*/
+int load_cluster(I_Node *in, int cluster, char *data){
+  int *slots = &in->block_pointers[cluster*CLUSTER_BLOCKS];
+  int compressed = 0;
+  int stored = 0;
+  for(int i=0; i<CLUSTER_BLOCKS; i++){
+    if(slots[i] == BLOCK_COMPRESSED){
+      compressed = 1;
+    }else if(slots[i] >= 0){
+      stored++;
+    }
   }
 
-  /*Flush changes to inode table and bitmap*/
-  write_blocks(1, 1, &inode_table);
-  write_blocks(2, 1, &bm);
+  memset(data, 0, CLUSTER_SIZE);
+
+  /*Raw cluster, one block per pointer*/
+  if(!compressed){
+    for(int i=0; i<CLUSTER_BLOCKS; i++){
+      if(slots[i] >= 0 && read_block(slots[i], data+i*BLOCK_SIZE) == -1){
+        return -1;
+      }
+    }
+    return 0;
+  }
 
-  free(container);
-  return length;
+  void * buffer = pool_get(stored*BLOCK_SIZE);
+  for(int i=0; i<stored; i++){
+    if(read_block(slots[i], (char*)buffer+i*BLOCK_SIZE) == -1){
+      pool_put(buffer);
+      return -1;
+    }
+  }
+
+  Cluster_Header * header = (Cluster_Header*) buffer;
+  int length = -1;
+  if(header->compressed_length >= 0 && header->compressed_length <= stored*BLOCK_SIZE-(int)sizeof(Cluster_Header)){
+    length = lz_decompress((char*)buffer+sizeof(Cluster_Header), header->compressed_length, data, CLUSTER_SIZE);
+  }
+  if(length != header->raw_length){
+    length = -1;
+  }
+  pool_put(buffer);
+
+  return length == -1 ? -1 : 0;
 }
 
-/*Read the content of the of fileID into buf*/
-int sfs_fread(int fileID, char *buf, int length){
-  /*Check if file is open*/
-  if(fd_table[fileID].is_free){
+/*Store the first length bytes of data as cluster number "cluster" of a compressed file.
+The cluster is compressed when that saves at least one block, else it is written raw.
+Blocks it already had are reused first. Returns -1 when the disk is full, leaving the old cluster in place.*/
+int store_cluster(I_Node *in, int cluster, char *data, int length){
+  int *slots = &in->block_pointers[cluster*CLUSTER_BLOCKS];
+  int raw_blocks = (length+BLOCK_SIZE-1)/BLOCK_SIZE;
+
+  void * buffer = pool_get(CLUSTER_SIZE);
+  int blocks = raw_blocks;
+  int compressed = 0;
+  if(raw_blocks > 1){
+    int capacity = (raw_blocks-1)*BLOCK_SIZE-(int)sizeof(Cluster_Header);
+    int compressed_length = lz_compress(data, length, (char*)buffer+sizeof(Cluster_Header), capacity);
+    if(compressed_length != -1){
+      Cluster_Header * header = (Cluster_Header*) buffer;
+      header->compressed_length = compressed_length;
+      header->raw_length = length;
+      blocks = (compressed_length+(int)sizeof(Cluster_Header)+BLOCK_SIZE-1)/BLOCK_SIZE;
+      memset((char*)buffer+sizeof(Cluster_Header)+compressed_length, 0,
+        blocks*BLOCK_SIZE-sizeof(Cluster_Header)-compressed_length);
+      compressed = 1;
+    }
+  }
+
+  /*Blocks only this cluster references can be rewritten in place, shared ones are let go*/
+  int physical[CLUSTER_BLOCKS];
+  int shared[CLUSTER_BLOCKS];
+  int owned = 0;
+  int shared_count = 0;
+  for(int i=0; i<CLUSTER_BLOCKS; i++){
+    if(slots[i] >= 0 && bm[slots[i]] == 1){
+      physical[owned++] = slots[i];
+    }else if(slots[i] >= 0){
+      shared[shared_count++] = slots[i];
+    }
+  }
+
+  /*Top up or give back the difference*/
+  int count = owned;
+  while(count < blocks){
+    int free_block = take_block(file_group(in));
+    if(free_block == -1){
+      for(int i=owned; i<count; i++){
+        unref_block(physical[i]);
+      }
+      pool_put(buffer);
+      return -1;
+    }
+    physical[count++] = free_block;
+  }
+  for(int i=blocks; i<owned; i++){
+    unref_block(physical[i]);
+  }
+  for(int i=0; i<shared_count; i++){
+    unref_block(shared[i]);
+  }
+
+  for(int i=0; i<CLUSTER_BLOCKS; i++){
+    if(i < blocks){
+      slots[i] = physical[i];
+      forget_fingerprint(physical[i]);
+      write_data_block(physical[i], compressed ? (char*)buffer+i*BLOCK_SIZE : data+i*BLOCK_SIZE);
+    }else{
+      slots[i] = compressed ? BLOCK_COMPRESSED : -1;
+    }
+  }
+
+  pool_put(buffer);
+  return 0;
+}
+
+/*Write length bytes of buf at position of a compressed file one cluster at a time.
+Each cluster is decoded, patched and stored again. Returns the number of bytes written.*/
+long long write_compressed(I_Node *in, char *buf, long long position, long long length){
+  long long written = 0;
+  void * cluster_data = pool_get(CLUSTER_SIZE);
+  while(written<length){
+    int cluster = (position+written)/CLUSTER_SIZE;
+    int offset = (position+written)%CLUSTER_SIZE;
+    int amount = CLUSTER_SIZE-offset;
+    if(amount > length-written){
+      amount = length-written;
+    }
+    if((cluster+1)*CLUSTER_BLOCKS > DIRECT_POINTERS){
+      break;
+    }
+
+    /*Bytes of this cluster that are in the file once the write is done*/
+    long long in_file = in->size-(long long)cluster*CLUSTER_SIZE;
+    int cluster_length = in_file > CLUSTER_SIZE ? CLUSTER_SIZE : (int)in_file;
+    if(cluster_length < offset+amount){
+      cluster_length = offset+amount;
+    }
+
+    if(load_cluster(in, cluster, cluster_data) == -1){
+      break;
+    }
+    memcpy((char*)cluster_data+offset, buf+written, amount);
+    if(store_cluster(in, cluster, cluster_data, cluster_length) == -1){
+      break;
+    }
+
+    written += amount;
+  }
+  pool_put(cluster_data);
+  return written;
+}
+
+/*Read length bytes at position of a compressed file into buf, returns the number of bytes read*/
+long long read_compressed(I_Node *in, char *buf, long long position, long long length){
+  long long done = 0;
+  void * cluster_data = pool_get(CLUSTER_SIZE);
+  while(done<length){
+    int cluster = (position+done)/CLUSTER_SIZE;
+    int offset = (position+done)%CLUSTER_SIZE;
+    int amount = CLUSTER_SIZE-offset;
+    if(amount > length-done){
+      amount = length-done;
+    }
+
+    if(load_cluster(in, cluster, cluster_data) == -1){
+      break;
+    }
+    memcpy(buf+done, (char*)cluster_data+offset, amount);
+
+    done += amount;
+  }
+  pool_put(cluster_data);
+  return done;
+}
+
+/*Turn compression on or off for an open file. Only allowed before the file has any data block.*/
+static int set_file_compression(int fileID, int enable){
+  if(!is_open_fd(fileID)){
     return -1;
   }
 
-  int inode_id = fd_table[fileID].inode_id;
-  int read_pointer = fd_table[fileID].read_pointer;
-  I_Node inode = inode_table[inode_id];
+  I_Node *in = &inode_table[get_fd(fileID)->inode_id];
+  if(!(in->flags & INODE_INLINE)){
+    return -1;
+  }
+
+  if(enable){
+    in->flags |= INODE_COMPRESSED;
+  }else{
+    in->flags &= ~INODE_COMPRESSED;
+  }
+  write_inode_table();
+  return 0;
+}
+
+/*Turn flag of the volume (VOLUME_DEDUP, VOLUME_COMPRESSED or VOLUME_CHECKSUM_DATA) on or off.
+Compression applies to files created from now on. Blocks written before a change of the checksum
+setting keep the one they were written with, metadata blocks are always checksummed.*/
+static void set_volume_flag(int flag, int enable){
+  if(enable){
+    volume_flags |= flag;
+  }else{
+    volume_flags &= ~flag;
+  }
+  write_super_node();
+}
 
-  /*Do not read if file is empty*/
-  if(inode.size == 0){
+/*Return the number of blocks in use, shared blocks count once*/
+static int used_blocks(){
+  int used = 0;
+  for(int i=0; i<MAX_BLOCK; i++){
+    if(bm[i]){
+      used++;
+    }
+  }
+  return used;
+}
+
+/*Reserve the blocks under offset to offset+length of the file with inode inode_id.
+The blocks the file does not have yet are taken as one run when one is free and marked unwritten,
+so they read back as zeros without a disk read and later writes into them allocate nothing.
+Unless keep_size is set the file grows to offset+length, and the blocks between its old end and offset
+are reserved too so it has no gap. Returns 0, or -1 past the last direct pointer, for a compressed file
+(its clusters are reallocated on every write anyway) or when the disk is full.*/
+int allocate_range(int inode_id, long long offset, long long length, int keep_size){
+  I_Node *in = &inode_table[inode_id];
+  if(offset<0 || length<=0 || length > MAX_FILE_SIZE || offset > MAX_FILE_SIZE-length || (in->flags & INODE_COMPRESSED)){
+    return -1;
+  }
+
+  long long start = keep_size || offset < in->size ? offset : in->size;
+  int first_index = start/BLOCK_SIZE;
+  int last_index = (offset+length-1)/BLOCK_SIZE;
+
+  begin_commit();
+  /*An inline file goes back to inline when the disk turns out to be full*/
+  I_Node inline_node = *in;
+  if((in->flags & INODE_INLINE) && convert_inline_file(in) == -1){
+    end_commit();
+    return -1;
+  }
+
+  int missing = 0;
+  for(int i=first_index; i<=last_index; i++){
+    missing += in->block_pointers[i] == -1;
+  }
+  int run = missing ? take_run(missing, file_group(in)) : -1;
+
+  /*File block numbers that got a block from this call*/
+  int reserved[DIRECT_POINTERS];
+  int taken = 0;
+  for(int i=first_index; i<=last_index; i++){
+    if(in->block_pointers[i] != -1){
+      continue;
+    }
+    int block = run != -1 ? run+taken : take_block(file_group(in));
+    if(block == -1){
+      /*Disk full, give back what this call took*/
+      for(int j=0; j<taken; j++){
+        unref_block(in->block_pointers[reserved[j]]);
+        in->block_pointers[reserved[j]] = -1;
+      }
+      if(inline_node.flags & INODE_INLINE){
+        if(in->block_pointers[0] != -1){
+          unref_block(in->block_pointers[0]);
+        }
+        *in = inline_node;
+      }
+      end_commit();
+      return -1;
+    }
+    block_unwritten[block] = 1;
+    in->block_pointers[i] = block;
+    reserved[taken++] = i;
+  }
+
+  if(!keep_size && offset+length > in->size){
+    set_file_size(in, offset+length);
+  }
+  write_inode_table();
+  end_commit();
+  return 0;
+}
+
+/*Check whether file block "index" is a hole. For a compressed file, BLOCK_COMPRESSED slots hold data.*/
+int is_hole(I_Node *in, int index){
+  return !(in->flags & INODE_INLINE) && in->block_pointers[index] == -1;
+}
+
+/*Overwrite length bytes at position of the file with zeros, unless the block (cluster of a compressed file)
+they lie in is a hole already or reserved. The range stays inside one block or cluster.
+Returns -1 if the zeros could not be written.*/
+int zero_range(I_Node *in, long long position, int length){
+  int compressed = in->flags & INODE_COMPRESSED;
+  int unit = compressed ? CLUSTER_BLOCKS : 1;
+  int first = position/BLOCK_SIZE/unit*unit;
+  int stored = 0;
+  for(int i=first; i<first+unit; i++){
+    stored += !is_hole(in, i) && (compressed || !block_unwritten[in->block_pointers[i]]);
+  }
+  if(!stored){
     return 0;
   }
 
-  /*Check that length is not larger than the size of the file being read*/
-  if(length>inode.size){
-    length = inode.size;
+  char * zeros = pool_get_zeroed(length);
+  long long written = compressed ? write_compressed(in, zeros, position, length) : write_file_blocks(in, zeros, position, length);
+  pool_put(zeros);
+  return written == length ? 0 : -1;
+}
+
+/*Turn offset to offset+length of the file with inode inode_id into a hole that reads back as zeros.
+Blocks (clusters of a compressed file) that lie wholly in the range are given back, including their share of a
+block held by a clone or snapshot, and the parts of blocks at the edges of the range are overwritten with zeros.
+The size of the file does not change, bytes past it are left alone.
+Returns 0, or -1 for a bad range or when zeroing an edge fails.*/
+int punch_range(int inode_id, long long offset, long long length){
+  I_Node *in = &inode_table[inode_id];
+  if(offset<0 || length<=0){
+    return -1;
   }
-  
-  if(length==0){
+  long long end = length > in->size-offset ? in->size : offset+length;
+  if(offset >= end){
     return 0;
   }
 
-  /*Find the block in which the read pointer is located*/
-  int block_of_read_pointer = read_pointer/1024;
+  begin_commit();
+  if(in->flags & INODE_INLINE){
+    memset(in->inline_data+offset, 0, end-offset);
+    write_inode_table();
+    end_commit();
+    return 0;
+  }
+
+  /*Units wholly inside the range, the last one may run past the end of the file*/
+  int unit = (in->flags & INODE_COMPRESSED) ? CLUSTER_BLOCKS : 1;
+  int unit_size = unit*BLOCK_SIZE;
+  int first = (offset+unit_size-1)/unit_size;
+  int last = (end == in->size ? end+unit_size-1 : end)/unit_size;
+  for(int u=first; u<last; u++){
+    for(int i=u*unit; i<(u+1)*unit; i++){
+      if(in->block_pointers[i] >= 0){
+        unref_block(in->block_pointers[i]);
+      }
+      in->block_pointers[i] = -1;
+    }
+  }
+
+  int result = 0;
+  long long head_end = (long long)first*unit_size < end ? (long long)first*unit_size : end;
+  if(offset < head_end){
+    result |= zero_range(in, offset, head_end-offset);
+  }
+  long long tail_start = (long long)last*unit_size > head_end ? (long long)last*unit_size : head_end;
+  if(tail_start < end){
+    result |= zero_range(in, tail_start, end-tail_start);
+  }
 
-  /*Find the block which the read pointer will stop reading at*/
-  int block_last_read = (read_pointer+length)/1024;
+  write_inode_table();
+  end_commit();
+  return result;
+}
 
-  /*Check to see if block_of_read_pointer and block_last_read are the same block*/
-  if(block_of_read_pointer==block_last_read){
-    void * only_read_buffer = malloc(1024*sizeof(char));
-    read_blocks(inode.block_pointers[block_of_read_pointer], 1, only_read_buffer);
-    char * only_read_block = (char*)only_read_buffer;
-    free(only_read_buffer);
+/*Reserve space for or punch a hole into an open file, see allocate_range and punch_range.
+mode is 0, SFS_FALLOC_KEEP_SIZE or SFS_FALLOC_PUNCH_HOLE (which never changes the size).*/
+static int fallocate_fd(int fileID, long long offset, long long length, int mode){
+  if(!is_open_fd(fileID)){
+    return -1;
+  }
+  if(mode & SFS_FALLOC_PUNCH_HOLE){
+    return punch_range(get_fd(fileID)->inode_id, offset, length);
+  }
+  return allocate_range(get_fd(fileID)->inode_id, offset, length, mode & SFS_FALLOC_KEEP_SIZE);
+}
 
-    strcpy(buf, only_read_block+(read_pointer%1024));
-    strcpy(buf+(read_pointer%1024)+(length%1024), "");
+/*Find the first offset at or after offset of an open file that holds data (data set) or lies in a hole,
+like lseek with SEEK_DATA and SEEK_HOLE. Holes are whole blocks, reserved blocks count as data
+and the end of the file counts as a hole. Neither file pointer moves.
+Returns the offset, or -1 when offset is not inside the file or, looking for data, only holes follow.*/
+static long long seek_extent(int fileID, long long offset, int data){
+  if(!is_open_fd(fileID)){
+    return -1;
+  }
+  I_Node *in = &inode_table[get_fd(fileID)->inode_id];
+  if(offset<0 || offset>=in->size){
+    return -1;
+  }
+
+  for(int index=offset/BLOCK_SIZE; (long long)index*BLOCK_SIZE < in->size; index++){
+    if(is_hole(in, index) != data){
+      return (long long)index*BLOCK_SIZE > offset ? (long long)index*BLOCK_SIZE : offset;
+    }
+  }
+  return data ? -1 : in->size;
+}
+
+/*Write the contents of buf of size length at position of the file with inode inode_id
+position may lie past the end of the file, the blocks in between are left as holes that read as zeros
+Strategy:
+1. Files that stay within INODE_INLINE_SIZE bytes are written into the inode itself
+2. Compressed files are rewritten one cluster at a time (see store_cluster)
+3. Otherwise, for every block from position to position + length,
+  find (or allocate) the disk block, read it first if only part of it is overwritten,
+  copy the new content in and write it back
+4. Update size, flush inode table and bit map
+Returns the number of bytes written, which is short when the file or disk is full, -1 if nothing was written.
+*/
+long long write_at(int inode_id, char *buf, long long length, long long position){
+  I_Node *in = &inode_table[inode_id];
+
+  /*Nothing fits past the largest file*/
+  if(length > MAX_FILE_SIZE-position){
+    length = MAX_FILE_SIZE-position;
+  }
+  if(length<=0){
+    return -1;
+  }
+
+  /*Small file, keep the data inside the inode*/
+  if((in->flags & INODE_INLINE) && position+length <= INODE_INLINE_SIZE){
+    memcpy(in->inline_data+position, buf, length);
+    if(position+length > in->size){
+      set_file_size(in, position+length);
+    }
+    write_inode_table();
     return length;
   }
 
-  /*Look in indirection pointer*/
-  if(block_of_read_pointer>11){
+  /*File grows past the inline limit, move it to a data block first*/
+  if(in->flags & INODE_INLINE){
+    if(convert_inline_file(in) == -1){
+      return -1;
+    }
+  }
 
+  long long written;
+  if(in->flags & INODE_COMPRESSED){
+    written = write_compressed(in, buf, position, length);
+  }else{
+    written = write_file_blocks(in, buf, position, length);
   }
 
-  /*Look in indirection pointer*/
-  if(block_last_read>11){
+  if(written==0){
+    return -1;
+  }
 
+  if(position+written > in->size){
+    set_file_size(in, position+written);
   }
 
-  /*Read the first block containing the read pointer.
-    Then read every block in between the read pointer and the last read block.
-    Then read the last read block.*/
+  /*Flush changes to inode table and bitmap*/
+  write_inode_table();
 
-  /*Read the first block into inital container*/
-  void * first_read_buffer = malloc(1024*sizeof(char));
-  read_blocks(inode.block_pointers[block_of_read_pointer], 1, first_read_buffer);
-  char * first_read_block = (char*)first_read_buffer;
-  free(first_read_buffer);
+  return written;
+}
 
-  /*Buf will now contain the content of the block containing the read_pointer*/
-  strcpy(buf, first_read_block+(read_pointer%1024));
+/*Read at most length bytes at position of the file with inode inode_id into buf, stopping at the end of the file.
+Returns the number of bytes read.*/
+long long read_at(int inode_id, char *buf, long long length, long long position){
+  I_Node *in = &inode_table[inode_id];
 
-  /*Loop through each block between the read_pointer block and the last read block*/
-  int current = block_of_read_pointer+1;
-  void * read_buffer;
-  char * read_block;
-  while(current<block_last_read){
+  /*Check that length does not go past the end of the file*/
+  if(length > in->size-position){
+    length = in->size-position;
+  }
 
-    read_buffer = malloc(1024*sizeof(char));
-    read_blocks(inode.block_pointers[current], 1, read_buffer);
-    read_block = (char*)first_read_buffer;
-    free(read_buffer);
+  if(length<=0){
+    return 0;
+  }
 
-    strcpy(buf+strlen(buf), read_block);
+  /*Small file, the data is inside the inode*/
+  if(in->flags & INODE_INLINE){
+    memcpy(buf, in->inline_data+position, length);
+    return length;
+  }
+
+  if(in->flags & INODE_COMPRESSED){
+    return read_compressed(in, buf, position, length);
+  }
+  return read_file_blocks(in, buf, position, length);
+}
 
-    current++;
+/*Write the contents of buf of size length to fileID at its write pointer and move the write pointer forward
+Returns the number of bytes written, which is short when the file or disk is full.*/
+static long long write_fd(int fileID, char *buf, long long length){
+  /*Check if file is open*/
+  if(!is_open_fd(fileID) || length<0){
+    return -1;
+  }
+  if(length==0){
+    return 0;
   }
 
-  /*Read the last block up to the specified length*/
-  void * last_read_buffer = malloc(1024*sizeof(char));
-  read_blocks(inode.block_pointers[block_last_read], 1, last_read_buffer);
-  char * last_read_block = (char*)last_read_buffer;
-  free(last_read_buffer);
+  long long written = write_at(get_fd(fileID)->inode_id, buf, length, get_fd(fileID)->write_pointer);
+  if(written != -1){
+    get_fd(fileID)->write_pointer += written;
+  }
+  return written;
+}
 
-  /*Copy the last block portion into the buf*/
-  strcpy(buf+strlen(buf), last_read_block);
+/*Read the content of the of fileID into buf
+Reads at most up to the end of file from the read pointer and moves the read pointer forward*/
+static long long read_fd(int fileID, char *buf, long long length){
+  /*Check if file is open*/
+  if(!is_open_fd(fileID) || length<0){
+    return -1;
+  }
 
-  return length;
+  long long done = read_at(get_fd(fileID)->inode_id, buf, length, get_fd(fileID)->read_pointer);
+  get_fd(fileID)->read_pointer += done;
+  return done;
 }
 
-/*Remove a file completely from the file system*/
-int sfs_remove(char *file){
-  /*Find the file in the root directory, inode table and fd table*/
-  int rt_index = get_rt_index(file);
-  /*No such directory entry exists*/
-  if(rt_index == -1){
+/*Write length bytes of buf at offset of fileID without using or moving its write pointer.
+offset can be anywhere sfs_fwseek allows, past the end of the file leaves a hole.
+Returns the number of bytes written like sfs_fwrite.*/
+static long long pwrite_fd(int fileID, char *buf, long long length, long long offset){
+  if(!is_open_fd(fileID) || length<0 || offset<0 || offset>MAX_FILE_SIZE){
     return -1;
   }
+  if(length==0){
+    return 0;
+  }
+
+  return write_at(get_fd(fileID)->inode_id, buf, length, offset);
+}
 
-  int inode_index = rt[rt_index].inode_id;
-  int fd_index = find_fd_index(file);
-  /*No such file descriptor exists*/
-  if(fd_index==-1){
+/*Read at most length bytes at offset of fileID into buf without using or moving its read pointer.
+Returns the number of bytes read, 0 at or past the end of the file.*/
+static long long pread_fd(int fileID, char *buf, long long length, long long offset){
+  if(!is_open_fd(fileID) || length<0 || offset<0){
     return -1;
   }
 
-  /*Root directory table*/
-  rt[rt_index].inode_id = -1;
-  strcpy(rt[rt_index].filename, "");
-  rt[rt_index].in_use = 0;
-  /*Check the rt_index of the file being removed
-  If it's greater  than the rt_pointer, the rt_pointer is not affected.
-  Else the rt_pointer is decremented*/
-  if(rt_index<=rt_pointer && rt_pointer!=0){
-    rt_pointer--;
+  return read_at(get_fd(fileID)->inode_id, buf, length, offset);
+}
+
+/*Remove a file completely from the file system*/
+static int remove_file(char *file){
+  /*Find the file in the root directory and drop its entry, only the leaf holding it is rewritten*/
+  int inode_index = dir_remove(file);
+  /*No such directory entry exists*/
+  if(inode_index == -1){
+    return -1;
   }
-  refactor_directory();
 
-  /*Bit map*/
-  for(int j=0; j<12; j++){
-    if(inode_table[inode_index].block_pointers[j]!=-1){
-      bm[inode_table[inode_index].block_pointers[j]] = 0;
+  /*Bit map, an inline file has no data blocks*/
+  if(!(inode_table[inode_index].flags & INODE_INLINE)){
+    for(int j=0; j<DIRECT_POINTERS; j++){
+      if(inode_table[inode_index].block_pointers[j]>=0){
+        unref_block(inode_table[inode_index].block_pointers[j]);
+      }
     }
   }
 
   /*Inode table*/
-  inode_table[inode_index].size = 0;
+  set_file_size(&inode_table[inode_index], 0);
   inode_table[inode_index].is_free = 1;
-  for(int i=0; i<12; i++){
+  inode_table[inode_index].flags = 0;
+  for(int i=0; i<DIRECT_POINTERS; i++){
     inode_table[inode_index].block_pointers[i]=-1;
   }
   inode_table[inode_index].indirect_pointer = -1;
+  release_inode(inode_index);
 
-  /*fd table */
-  fd_table[fd_index].inode_id = -1;
-  fd_table[fd_index].read_pointer = 0;
-  fd_table[fd_index].write_pointer = 0;
-  fd_table[fd_index].is_free = 1;
+  /*fd table, every descriptor open on the file is closed as part of the removal*/
+  while(inode_fd[inode_index]!=-1){
+    release_fd_entry(inode_fd[inode_index]);
+  }
 
   
-  /*Flush changes in rt_table, inode_table, and fd_table*/
-  write_blocks(1, 1, &inode_table);
-  write_blocks(2, 1, &bm);
-  write_blocks(3, 1, &rt);
+  /*Flush changes in inode_table and bit map*/
+  write_inode_table();
 
 
   return 0;
 }
 
+/*Add (delta 1) or drop (delta -1) one reference on every data block of the files in image*/
+void ref_snapshot_blocks(Snapshot_Image *image, int delta){
+  for(int i=0; i<image->entry_count; i++){
+    I_Node *in = &image->inodes[image->entries[i].inode_id];
+    if(in->flags & INODE_INLINE){
+      continue;
+    }
+    for(int j=0; j<DIRECT_POINTERS; j++){
+      if(in->block_pointers[j] < 0){
+        continue;
+      }
+      if(delta > 0){
+        bm[in->block_pointers[j]]++;
+      }else{
+        unref_block(in->block_pointers[j]);
+      }
+    }
+  }
+}
+
+/*Take a read only snapshot of the whole volume.
+The directory and inode table are copied into the snapshot, which is a few blocks, and every data block
+gains a reference. From then on the live files copy a block before changing it (see put_data_block
+and store_cluster) and the snapshot keeps seeing the data as it was, without any data being copied now.
+Returns the snapshot id, or -1 if every snapshot slot is in use or the disk is full.*/
+static int take_snapshot(){
+  int id = -1;
+  for(int i=0; i<SNAPSHOT_COUNT; i++){
+    if(snapshot_index[i] == -1){
+      id = i;
+      break;
+    }
+  }
+  if(id == -1){
+    return -1;
+  }
+
+  /*Index block first, then the blocks of the image*/
+  int blocks[SNAPSHOT_BLOCKS+1];
+  for(int i=0; i<=SNAPSHOT_BLOCKS; i++){
+    blocks[i] = take_block(0);
+    if(blocks[i] == -1){
+      for(int j=0; j<i; j++){
+        unref_block(blocks[j]);
+      }
+      return -1;
+    }
+  }
+
+  Snapshot_Image *image = calloc(1, SNAPSHOT_BLOCKS*BLOCK_SIZE);
+  image->entry_count = dir_list(image->entries, INODE_COUNT);
+  memcpy(image->inodes, inode_table, sizeof(inode_table));
+  ref_snapshot_blocks(image, 1);
+
+  void * buffer = calloc(1, BLOCK_SIZE);
+  memcpy(buffer, blocks+1, SNAPSHOT_BLOCKS*sizeof(int));
+  write_meta_block(blocks[0], buffer);
+  free(buffer);
+  for(int i=0; i<SNAPSHOT_BLOCKS; i++){
+    write_meta_block(blocks[i+1], (char*)image+i*BLOCK_SIZE);
+  }
+
+  snapshot_index[id] = blocks[0];
+  snapshot_cache[id] = image;
+
+  /*Flush changes to super block and bitmap*/
+  write_super_node();
+  write_bit_map();
+
+  return id;
+}
+
+/*Return the image of snapshot id, reading it from disk the first time.
+NULL if there is no such snapshot or its blocks fail their checksums.*/
+Snapshot_Image *load_snapshot(int id){
+  if(id<0 || id>=SNAPSHOT_COUNT || snapshot_index[id] == -1){
+    return NULL;
+  }
+  if(snapshot_cache[id]){
+    return snapshot_cache[id];
+  }
+
+  int *blocks = malloc(BLOCK_SIZE);
+  Snapshot_Image *image = malloc(SNAPSHOT_BLOCKS*BLOCK_SIZE);
+  int failed = read_block(snapshot_index[id], blocks);
+  for(int i=0; i<SNAPSHOT_BLOCKS && !failed; i++){
+    failed = read_block(blocks[i], (char*)image+i*BLOCK_SIZE);
+  }
+  free(blocks);
+  if(failed){
+    free(image);
+    return NULL;
+  }
+
+  snapshot_cache[id] = image;
+  return image;
+}
+
+/*Find name in a snapshot, NULL if it was not in the directory when the snapshot was taken*/
+I_Node *find_snapshot_inode(Snapshot_Image *image, char *name){
+  for(int i=0; i<image->entry_count; i++){
+    if(strcmp(image->entries[i].filename, name) == 0){
+      return &image->inodes[image->entries[i].inode_id];
+    }
+  }
+  return NULL;
+}
+
+/*Delete snapshot id and give back the blocks only it was holding on to*/
+static int delete_snapshot(int id){
+  Snapshot_Image *image = load_snapshot(id);
+  if(!image){
+    return -1;
+  }
+
+  ref_snapshot_blocks(image, -1);
+
+  int *blocks = malloc(BLOCK_SIZE);
+  read_block(snapshot_index[id], blocks);
+  for(int i=0; i<SNAPSHOT_BLOCKS; i++){
+    unref_block(blocks[i]);
+  }
+  free(blocks);
+  unref_block(snapshot_index[id]);
+
+  free(image);
+  snapshot_cache[id] = NULL;
+  EVENT_INSTANT(EVENT_EVICT, "snapshot image dropped", id, SNAPSHOT_BLOCKS);
+  snapshot_index[id] = -1;
+
+  /*Flush changes to super block and bitmap*/
+  write_super_node();
+  write_bit_map();
+
+  return 0;
+}
+
+/*Copy the name of file number "index" of snapshot id into fname.
+Returns 1, 0 once index is past the last file, or -1 if there is no such snapshot.*/
+static int snapshot_file_name(int id, int index, char *fname){
+  Snapshot_Image *image = load_snapshot(id);
+  if(!image){
+    return -1;
+  }
+  if(index<0 || index>=image->entry_count){
+    return 0;
+  }
+  strcpy(fname, image->entries[index].filename);
+  return 1;
+}
+
+/*Return the size the file had when snapshot id was taken, -1 if it was not there*/
+static long long snapshot_file_size(int id, char *name){
+  Snapshot_Image *image = load_snapshot(id);
+  if(!image){
+    return -1;
+  }
+  I_Node *in = find_snapshot_inode(image, name);
+  if(!in){
+    return -1;
+  }
+  return in->size;
+}
+
+/*Read length bytes at position of the file as it was when snapshot id was taken.
+Snapshots are read only and keep no read pointer. Returns the number of bytes read, -1 if the file is not there.*/
+static int read_snapshot(int id, char *name, char *buf, int position, int length){
+  Snapshot_Image *image = load_snapshot(id);
+  if(!image || position<0 || length<0){
+    return -1;
+  }
+  I_Node *in = find_snapshot_inode(image, name);
+  if(!in){
+    return -1;
+  }
+
+  if(length > in->size-position){
+    length = in->size-position;
+  }
+  if(length<=0){
+    return 0;
+  }
+
+  if(in->flags & INODE_INLINE){
+    memcpy(buf, in->inline_data+position, length);
+    return length;
+  }
+  if(in->flags & INODE_COMPRESSED){
+    return read_compressed(in, buf, position, length);
+  }
+  return read_file_blocks(in, buf, position, length);
+}
+
+/*Total length of count iovecs, -1 if the total overflows a long long*/
+long long iovec_length(const struct iovec *iov, int count){
+  long long total = 0;
+  for(int i=0; i<count; i++){
+    if(iov[i].iov_len > (size_t)(LLONG_MAX-total)){
+      return -1;
+    }
+    total += iov[i].iov_len;
+  }
+  return total;
+}
+
+/*Copy length bytes between buffer and the iovecs, starting offset bytes into iov[*element].
+Moves *element and *offset past the bytes copied. Gathers into buffer when gather is set, scatters out of it otherwise.*/
+static void copy_iovecs(const struct iovec *iov, int *element, size_t *offset, char *buffer, int length, int gather){
+  int used = 0;
+  while(used<length){
+    size_t amount = iov[*element].iov_len-*offset;
+    if(amount > (size_t)(length-used)){
+      amount = length-used;
+    }
+    if(gather){
+      memcpy(buffer+used, (char*)iov[*element].iov_base+*offset, amount);
+    }else{
+      memcpy((char*)iov[*element].iov_base+*offset, buffer+used, amount);
+    }
+    used += amount;
+    *offset += amount;
+    if(*offset == iov[*element].iov_len){
+      (*element)++;
+      *offset = 0;
+    }
+  }
+}
+
+/*Write count buffers one after the other at the write pointer of fileID.
+The buffers are gathered a pool buffer at a time, each chunk ending on a block boundary of the file, so every
+block is written once, and the tables are flushed once at the end. Returns the number of bytes written like sfs_fwrite.*/
+static long long write_vector(int fileID, const struct iovec *iov, int count){
+  long long length = iovec_length(iov, count);
+  if(!is_open_fd(fileID) || count<0 || length<0){
+    return -1;
+  }
+  if(length==0){
+    return 0;
+  }
+  char * buffer = pool_get(POOL_BUFFER_SIZE);
+  if(!buffer){
+    return -1;
+  }
+
+  begin_commit();
+  long long written = 0;
+  int element = 0;
+  size_t offset = 0;
+  while(written<length){
+    int chunk = POOL_BUFFER_SIZE-get_fd(fileID)->write_pointer%BLOCK_SIZE;
+    if(chunk > length-written){
+      chunk = length-written;
+    }
+    copy_iovecs(iov, &element, &offset, buffer, chunk, 1);
+    long long done = write_fd(fileID, buffer, chunk);
+    if(done == -1){
+      break;
+    }
+    written += done;
+    /*File or disk full*/
+    if(done<chunk){
+      break;
+    }
+  }
+  end_commit();
+  pool_put(buffer);
+  return written>0 ? written : -1;
+}
+
+/*Read into count buffers one after the other from the read pointer of fileID.
+The data is read a pool buffer at a time and scattered. Returns the number of bytes read like sfs_fread.*/
+static long long read_vector(int fileID, const struct iovec *iov, int count){
+  long long length = iovec_length(iov, count);
+  if(!is_open_fd(fileID) || count<0 || length<0){
+    return -1;
+  }
+  char * buffer = pool_get(POOL_BUFFER_SIZE);
+  if(!buffer){
+    return -1;
+  }
+
+  long long done = 0;
+  int element = 0;
+  size_t offset = 0;
+  while(done<length){
+    int chunk = POOL_BUFFER_SIZE-get_fd(fileID)->read_pointer%BLOCK_SIZE;
+    if(chunk > length-done){
+      chunk = length-done;
+    }
+    long long read = read_fd(fileID, buffer, chunk);
+    if(read == -1){
+      done = done>0 ? done : -1;
+      break;
+    }
+    copy_iovecs(iov, &element, &offset, buffer, read, 0);
+    done += read;
+    /*End of the file*/
+    if(read<chunk){
+      break;
+    }
+  }
+  pool_put(buffer);
+  return done;
+}
+
+/*fd an operation of a batch works on: its own fd, or the result of the earlier open it refers to*/
+int batch_fd(Sfs_Op *ops, int i){
+  if(ops[i].ref < 0){
+    return ops[i].fd;
+  }
+  if(ops[i].ref >= i || ops[ops[i].ref].type != SFS_OP_OPEN){
+    return -1;
+  }
+  return (int)ops[ops[i].ref].result;
+}
+
+/*Most operations merged into one vectored read or write, a longer run is split*/
+#define BATCH_IOVECS 64
+
+/*Run count operations in order and commit the metadata once at the end.
+Reads or writes that follow each other on the same fd are merged into one vectored read or write,
+the merged bytes are handed back to the operations in order.
+Each operation gets the result its own call would have returned. Returns the number of operations that failed.*/
+static int run_batch(Sfs_Op *ops, int count){
+  int failed = 0;
+  if(!volume_mounted){
+    for(int i=0; i<count; i++){
+      ops[i].result = -1;
+    }
+    return count > 0 ? count : 0;
+  }
+  begin_commit();
+
+  int i = 0;
+  while(i<count){
+    int fd = batch_fd(ops, i);
+
+    if(ops[i].type == SFS_OP_OPEN){
+      ops[i].result = open_file(ops[i].name);
+      failed += ops[i].result == -1;
+      i++;
+      continue;
+    }
+    if(ops[i].type == SFS_OP_CLOSE){
+      ops[i].result = close_file(fd);
+      failed += ops[i].result == -1;
+      i++;
+      continue;
+    }
+    if(ops[i].type != SFS_OP_READ && ops[i].type != SFS_OP_WRITE){
+      ops[i].result = -1;
+      failed++;
+      i++;
+      continue;
+    }
+
+    /*Run of reads or writes on the same fd*/
+    int end = i+1;
+    while(end<count && end-i<BATCH_IOVECS && ops[end].type == ops[i].type && batch_fd(ops, end) == fd){
+      end++;
+    }
+    struct iovec iov[BATCH_IOVECS];
+    for(int j=i; j<end; j++){
+      iov[j-i].iov_base = ops[j].buf;
+      iov[j-i].iov_len = ops[j].length < 0 ? 0 : ops[j].length;
+    }
+    long long done;
+    if(ops[i].type == SFS_OP_READ){
+      done = read_vector(fd, iov, end-i);
+    }else{
+      done = write_vector(fd, iov, end-i);
+    }
+
+    for(int j=i; j<end; j++){
+      if(ops[j].length < 0 || done == -1){
+        ops[j].result = -1;
+      }else{
+        ops[j].result = done < ops[j].length ? done : ops[j].length;
+        done -= ops[j].result;
+        /*A write that got no bytes in fails like sfs_fwrite, a read at the end of the file returns 0*/
+        if(ops[j].result == 0 && ops[j].length > 0 && ops[j].type == SFS_OP_WRITE){
+          ops[j].result = -1;
+        }
+      }
+      failed += ops[j].result == -1;
+    }
+    i = end;
+  }
+
+  end_commit();
+  return failed;
+}
+
+/*Number of extents of a file: runs of data blocks that follow each other on disk in file order.
+A contiguous file has 1, a file without data blocks 0.*/
+int count_extents(I_Node *in){
+  if(in->flags & INODE_INLINE){
+    return 0;
+  }
+  int extents = 0;
+  int previous = -1;
+  for(int j=0; j<DIRECT_POINTERS; j++){
+    int block = in->block_pointers[j];
+    if(block < 0){
+      continue;
+    }
+    if(previous == -1 || block != previous+1){
+      extents++;
+    }
+    previous = block;
+  }
+  return extents;
+}
+
+/*Move the data blocks of the file with inode inode_id into one run of free blocks.
+The blocks are copied first and the pointers switched over in a single commit of the inode table and
+bit map, so a reader or a crash sees either the old blocks or the new ones. Files sharing a block with a
+clone or a snapshot are left alone, moving the block would split what is shared.
+Returns the number of blocks moved, 0 if there is nothing to do, -1 if no run is free or a block is bad.*/
+int defrag_inode(int inode_id){
+  I_Node *in = &inode_table[inode_id];
+  if(inode_id <= 0 || inode_id >= INODE_COUNT || in->is_free || count_extents(in) <= 1){
+    return 0;
+  }
+
+  int slots[DIRECT_POINTERS];
+  int count = 0;
+  for(int j=0; j<DIRECT_POINTERS; j++){
+    if(in->block_pointers[j] >= 0){
+      if(bm[in->block_pointers[j]] > 1){
+        return 0;
+      }
+      slots[count++] = j;
+    }
+  }
+
+  int first = take_run(count, file_group(in));
+  if(first == -1){
+    return -1;
+  }
+
+  void * buffer = pool_get(BLOCK_SIZE);
+  for(int i=0; i<count; i++){
+    /*A reserved block stays reserved, there is nothing to copy*/
+    if(block_unwritten[in->block_pointers[slots[i]]]){
+      block_unwritten[first+i] = 1;
+      continue;
+    }
+    if(read_block(in->block_pointers[slots[i]], buffer) == -1){
+      for(int b=first; b<first+count; b++){
+        unref_block(b);
+      }
+      pool_put(buffer);
+      return -1;
+    }
+    write_data_block(first+i, buffer);
+  }
+  pool_put(buffer);
+
+  begin_commit();
+  for(int i=0; i<count; i++){
+    int old = in->block_pointers[slots[i]];
+    if(fingerprint_indexed[old]){
+      remember_fingerprint(first+i, fingerprint[old]);
+    }
+    in->block_pointers[slots[i]] = first+i;
+    unref_block(old);
+  }
+  write_inode_table();
+  end_commit();
+  return count;
+}
+
+/*Return the number of extents of file name (see count_extents), -1 if there is no such file*/
+static int file_extents(char *name){
+  int inode_id = get_inode_id(name);
+  if(inode_id <= 0){
+    return -1;
+  }
+  return count_extents(&inode_table[inode_id]);
+}
+
+/*Make file name contiguous now, returns the number of blocks moved or -1 (see defrag_inode)*/
+static int defrag_file(char *name){
+  int inode_id = get_inode_id(name);
+  if(inode_id <= 0){
+    return -1;
+  }
+  return defrag_inode(inode_id);
+}
+
+/*Every public call runs under volume_lock, so the background defragmenter can move blocks while the
+volume is in use. sfs_batch and the vectored calls use the internal calls, a locked path never goes
+back through a public one.*/
+static pthread_mutex_t volume_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void lock_volume(){
+  pthread_mutex_lock(&volume_lock);
+}
+
+static void unlock_volume(){
+  pthread_mutex_unlock(&volume_lock);
+}
+
+/*Background defragmenter. It takes the files one at a time, each move runs under volume_lock,
+and sleeps between moves so it copies at most defrag_rate bytes per second.*/
+static pthread_t defrag_thread;
+static int defrag_running = 0;
+static volatile int defrag_stopping = 0;
+static int defrag_rate = 0;
+static int defrag_moved = 0;
+
+static void *defrag_pass(void *arg){
+  (void)arg;
+  for(int inode_id=1; inode_id<INODE_COUNT && !defrag_stopping; inode_id++){
+    lock_volume();
+    int moved = volume_mounted ? defrag_inode(inode_id) : -1;
+    unlock_volume();
+    if(moved <= 0){
+      continue;
+    }
+    defrag_moved += moved;
+
+    if(defrag_rate > 0){
+      long long ns = (long long)moved*BLOCK_SIZE*1000000000LL/defrag_rate;
+      struct timespec pause = {ns/1000000000LL, ns%1000000000LL};
+      nanosleep(&pause, NULL);
+    }
+  }
+  return NULL;
+}
+
+/*Start one defragmenting pass over every file in the background, copying at most
+bytes_per_second (0 for no limit). Returns -1 if a pass is already running.*/
+static int start_defrag(int bytes_per_second){
+  if(defrag_running){
+    return -1;
+  }
+  defrag_stopping = 0;
+  defrag_rate = bytes_per_second;
+  defrag_moved = 0;
+  if(pthread_create(&defrag_thread, NULL, defrag_pass, NULL) != 0){
+    return -1;
+  }
+  defrag_running = 1;
+  return 0;
+}
+
+/*Wait for the pass to finish, or end it early when cancel is set.
+Returns the number of blocks the pass moved, -1 if none was started.*/
+static int stop_defrag(int cancel){
+  if(!defrag_running){
+    return -1;
+  }
+  defrag_stopping = cancel;
+  pthread_join(defrag_thread, NULL);
+  defrag_running = 0;
+  return defrag_moved;
+}
+
+/*Traced entry points of the snapshot, vectored, batch, sparse file and defragmentation calls and of
+the volume settings, they run and are recorded like the calls below. sfs_defrag_start and sfs_defrag_stop
+take no lock, the background pass takes it for each move and sfs_defrag_stop waits for the pass.*/
+int sfs_set_compression(int fileID, int enable){
+  EVENT_BEGIN(EVENT_CALL, __func__, fileID, 0);
+  long long start = trace_clock();
+  lock_volume();
+  int result = volume_mounted ? set_file_compression(fileID, enable) : -1;
+  unlock_volume();
+  EVENT_END(EVENT_CALL, __func__, fileID, result);
+  trace_record(TRACE_SET_COMPRESSION, start, fileID, enable, 0, result, NULL, NULL);
+  return result;
+}
+
+void sfs_set_volume_compression(int enable){
+  EVENT_BEGIN(EVENT_CALL, __func__, 0, enable);
+  long long start = trace_clock();
+  lock_volume();
+  if(volume_mounted){
+    set_volume_flag(VOLUME_COMPRESSED, enable);
+  }
+  unlock_volume();
+  EVENT_END(EVENT_CALL, __func__, 0, 0);
+  trace_record(TRACE_SET_VOLUME_COMPRESSION, start, 0, enable, 0, 0, NULL, NULL);
+}
+
+void sfs_set_volume_dedup(int enable){
+  EVENT_BEGIN(EVENT_CALL, __func__, 0, enable);
+  long long start = trace_clock();
+  lock_volume();
+  if(volume_mounted){
+    set_volume_flag(VOLUME_DEDUP, enable);
+  }
+  unlock_volume();
+  EVENT_END(EVENT_CALL, __func__, 0, 0);
+  trace_record(TRACE_SET_VOLUME_DEDUP, start, 0, enable, 0, 0, NULL, NULL);
+}
+
+void sfs_set_volume_checksums(int enable){
+  EVENT_BEGIN(EVENT_CALL, __func__, 0, enable);
+  long long start = trace_clock();
+  lock_volume();
+  if(volume_mounted){
+    set_volume_flag(VOLUME_CHECKSUM_DATA, enable);
+  }
+  unlock_volume();
+  EVENT_END(EVENT_CALL, __func__, 0, 0);
+  trace_record(TRACE_SET_VOLUME_CHECKSUMS, start, 0, enable, 0, 0, NULL, NULL);
+}
+
+int sfs_get_used_blocks(){
+  EVENT_BEGIN(EVENT_CALL, __func__, 0, 0);
+  long long start = trace_clock();
+  lock_volume();
+  int result = volume_mounted ? used_blocks() : -1;
+  unlock_volume();
+  EVENT_END(EVENT_CALL, __func__, 0, result);
+  trace_record(TRACE_GET_USED_BLOCKS, start, 0, 0, 0, result, NULL, NULL);
+  return result;
+}
+
+/*Return the number of blocks that failed their checksum since the disk was opened*/
+int sfs_get_checksum_errors(){
+  EVENT_BEGIN(EVENT_CALL, __func__, 0, 0);
+  long long start = trace_clock();
+  lock_volume();
+  int result = volume_mounted ? checksum_errors : -1;
+  unlock_volume();
+  EVENT_END(EVENT_CALL, __func__, 0, result);
+  trace_record(TRACE_GET_CHECKSUM_ERRORS, start, 0, 0, 0, result, NULL, NULL);
+  return result;
+}
+
+int sfs_snapshot(){
+  EVENT_BEGIN(EVENT_CALL, __func__, 0, 0);
+  long long start = trace_clock();
+  lock_volume();
+  int result = volume_mounted ? take_snapshot() : -1;
+  unlock_volume();
+  EVENT_END(EVENT_CALL, __func__, 0, result);
+  trace_record(TRACE_SNAPSHOT, start, 0, 0, 0, result, NULL, NULL);
+  return result;
+}
+
+int sfs_snapshot_delete(int id){
+  EVENT_BEGIN(EVENT_CALL, __func__, 0, 0);
+  long long start = trace_clock();
+  lock_volume();
+  int result = volume_mounted ? delete_snapshot(id) : -1;
+  unlock_volume();
+  EVENT_END(EVENT_CALL, __func__, 0, result);
+  trace_record(TRACE_SNAPSHOT_DELETE, start, id, 0, 0, result, NULL, NULL);
+  return result;
+}
+
+int sfs_snapshot_get_file_name(int id, int index, char *fname){
+  EVENT_BEGIN(EVENT_CALL, __func__, 0, index);
+  long long start = trace_clock();
+  lock_volume();
+  int result = volume_mounted ? snapshot_file_name(id, index, fname) : -1;
+  unlock_volume();
+  EVENT_END(EVENT_CALL, __func__, 0, result);
+  trace_record(TRACE_SNAPSHOT_GET_FILE_NAME, start, id, 0, index, result, NULL, NULL);
+  return result;
+}
+
+int sfs_snapshot_read(int id, char *name, char *buf, int position, int length){
+  EVENT_BEGIN(EVENT_CALL, __func__, 0, length);
+  long long start = trace_clock();
+  lock_volume();
+  int result = volume_mounted ? read_snapshot(id, name, buf, position, length) : -1;
+  unlock_volume();
+  EVENT_END(EVENT_CALL, __func__, 0, result);
+  trace_record(TRACE_SNAPSHOT_READ, start, id, length, position, result, name, NULL);
+  return result;
+}
+
+long long sfs_snapshot_get_file_size64(int id, char *name){
+  EVENT_BEGIN(EVENT_CALL, __func__, 0, id);
+  long long start = trace_clock();
+  lock_volume();
+  long long result = volume_mounted ? snapshot_file_size(id, name) : -1;
+  unlock_volume();
+  EVENT_END(EVENT_CALL, __func__, 0, result);
+  trace_record(TRACE_SNAPSHOT_GET_FILE_SIZE, start, id, 0, 0, result, name, NULL);
+  return result;
+}
+
+/*The vectored calls return an int, a request longer than that fails before anything is moved*/
+int sfs_fwritev(int fileID, const struct iovec *iov, int count){
+  EVENT_BEGIN(EVENT_CALL, __func__, fileID, count);
+  long long start = trace_clock();
+  lock_volume();
+  long long length = iovec_length(iov, count);
+  int result = !volume_mounted || length < 0 || length > INT_MAX ? -1 : (int)write_vector(fileID, iov, count);
+  unlock_volume();
+  EVENT_END(EVENT_CALL, __func__, fileID, result);
+  trace_record(TRACE_FWRITEV, start, fileID, length, count, result, NULL, NULL);
+  return result;
+}
+
+int sfs_freadv(int fileID, const struct iovec *iov, int count){
+  EVENT_BEGIN(EVENT_CALL, __func__, fileID, count);
+  long long start = trace_clock();
+  lock_volume();
+  long long length = iovec_length(iov, count);
+  int result = !volume_mounted || length < 0 || length > INT_MAX ? -1 : (int)read_vector(fileID, iov, count);
+  unlock_volume();
+  EVENT_END(EVENT_CALL, __func__, fileID, result);
+  trace_record(TRACE_FREADV, start, fileID, length, count, result, NULL, NULL);
+  return result;
+}
+
+int sfs_batch(Sfs_Op *ops, int count){
+  EVENT_BEGIN(EVENT_CALL, __func__, 0, count);
+  long long start = trace_clock();
+  lock_volume();
+  int result = run_batch(ops, count);
+  unlock_volume();
+  EVENT_END(EVENT_CALL, __func__, 0, result);
+  trace_record_batch(start, ops, count, result);
+  return result;
+}
+
+long long sfs_seek_data64(int fileID, long long offset){
+  EVENT_BEGIN(EVENT_CALL, __func__, fileID, offset);
+  long long start = trace_clock();
+  lock_volume();
+  long long result = volume_mounted ? seek_extent(fileID, offset, 1) : -1;
+  unlock_volume();
+  EVENT_END(EVENT_CALL, __func__, fileID, result);
+  trace_record(TRACE_SEEK_DATA, start, fileID, 0, offset, result, NULL, NULL);
+  return result;
+}
+
+long long sfs_seek_hole64(int fileID, long long offset){
+  EVENT_BEGIN(EVENT_CALL, __func__, fileID, offset);
+  long long start = trace_clock();
+  lock_volume();
+  long long result = volume_mounted ? seek_extent(fileID, offset, 0) : -1;
+  unlock_volume();
+  EVENT_END(EVENT_CALL, __func__, fileID, result);
+  trace_record(TRACE_SEEK_HOLE, start, fileID, 0, offset, result, NULL, NULL);
+  return result;
+}
+
+int sfs_get_fragments(char *name){
+  EVENT_BEGIN(EVENT_CALL, __func__, 0, 0);
+  long long start = trace_clock();
+  lock_volume();
+  int result = volume_mounted ? file_extents(name) : -1;
+  unlock_volume();
+  EVENT_END(EVENT_CALL, __func__, 0, result);
+  trace_record(TRACE_GET_FRAGMENTS, start, 0, 0, 0, result, name, NULL);
+  return result;
+}
+
+int sfs_defrag(char *name){
+  EVENT_BEGIN(EVENT_CALL, __func__, 0, 0);
+  long long start = trace_clock();
+  lock_volume();
+  int result = volume_mounted ? defrag_file(name) : -1;
+  unlock_volume();
+  EVENT_END(EVENT_CALL, __func__, 0, result);
+  trace_record(TRACE_DEFRAG, start, 0, 0, 0, result, name, NULL);
+  return result;
+}
+
+int sfs_defrag_start(int bytes_per_second){
+  EVENT_BEGIN(EVENT_CALL, __func__, 0, bytes_per_second);
+  long long start = trace_clock();
+  int result = start_defrag(bytes_per_second);
+  EVENT_END(EVENT_CALL, __func__, 0, result);
+  trace_record(TRACE_DEFRAG_START, start, 0, bytes_per_second, 0, result, NULL, NULL);
+  return result;
+}
+
+int sfs_defrag_stop(int cancel){
+  EVENT_BEGIN(EVENT_CALL, __func__, 0, cancel);
+  long long start = trace_clock();
+  int result = stop_defrag(cancel);
+  EVENT_END(EVENT_CALL, __func__, 0, result);
+  trace_record(TRACE_DEFRAG_STOP, start, 0, cancel, 0, result, NULL, NULL);
+  return result;
+}
+
+/*Traced entry points. Each one runs the call under volume_lock and, while a trace is being recorded
+(see sfs_trace.h), logs its arguments, result and timing. sfs_get_file_size64, the FUSE getattr,
+takes no lock (see file_size) so stat heavy workloads do not queue behind each other. sfs_batch and the
+vectored calls run their reads and writes through the internal calls, so each shows up once, as itself.*/
+void mksfs(int fresh){
+  EVENT_BEGIN(EVENT_CALL, __func__, 0, fresh);
+  trace_from_environment();
+  long long start = trace_clock();
+  lock_volume();
+  /*Lockless lookups wait out the swap of every table*/
+  dir_write_begin();
+  mount_sfs(fresh);
+  dir_write_end();
+  unlock_volume();
+  EVENT_END(EVENT_CALL, __func__, 0, 0);
+  trace_record(TRACE_MKSFS, start, 0, fresh, 0, 0, NULL, NULL);
+}
+
+int sfs_get_next_file_name(char *fname){
+  EVENT_BEGIN(EVENT_CALL, __func__, 0, 0);
+  long long start = trace_clock();
+  lock_volume();
+  int result = volume_mounted ? next_file_name(fname) : -1;
+  unlock_volume();
+  EVENT_END(EVENT_CALL, __func__, 0, result);
+  trace_record(TRACE_GET_NEXT_FILE_NAME, start, 0, 0, 0, result, NULL, NULL);
+  return result;
+}
+
+long long sfs_get_file_size64(char* path){
+  EVENT_BEGIN(EVENT_CALL, __func__, 0, 0);
+  long long start = trace_clock();
+  long long result = file_size(path);
+  EVENT_END(EVENT_CALL, __func__, 0, result);
+  trace_record(TRACE_GET_FILE_SIZE, start, 0, 0, 0, result, path, NULL);
+  return result;
+}
+
+int sfs_clone(char *src, char *dst){
+  EVENT_BEGIN(EVENT_CALL, __func__, 0, 0);
+  long long start = trace_clock();
+  lock_volume();
+  int result = volume_mounted ? clone_file(src, dst) : -1;
+  unlock_volume();
+  EVENT_END(EVENT_CALL, __func__, 0, result);
+  trace_record(TRACE_CLONE, start, 0, 0, 0, result, src, dst);
+  return result;
+}
+
+/*The name is looked up before the lock is taken, the lock only covers taking the fd or creating the file.
+A create or remove that ran in between moved the directory sequence and the name is looked up again.*/
+int sfs_fopen(char *name){
+  EVENT_BEGIN(EVENT_CALL, __func__, 0, 0);
+  long long start = trace_clock();
+  unsigned int sequence = dir_read_begin();
+  int index = get_inode_id(name);
+  lock_volume();
+  if(dir_read_retry(sequence)){
+    index = get_inode_id(name);
+  }
+  int result = volume_mounted ? open_inode(name, index) : -1;
+  unlock_volume();
+  EVENT_END(EVENT_CALL, __func__, 0, result);
+  trace_record(TRACE_FOPEN, start, 0, 0, 0, result, name, NULL);
+  return result;
+}
+
+int sfs_fclose(int fileID){
+  EVENT_BEGIN(EVENT_CALL, __func__, fileID, 0);
+  long long start = trace_clock();
+  lock_volume();
+  int result = volume_mounted ? close_file(fileID) : -1;
+  unlock_volume();
+  EVENT_END(EVENT_CALL, __func__, fileID, result);
+  trace_record(TRACE_FCLOSE, start, fileID, 0, 0, result, NULL, NULL);
+  return result;
+}
+
+int sfs_frseek64(int fileID, long long loc){
+  EVENT_BEGIN(EVENT_CALL, __func__, fileID, loc);
+  long long start = trace_clock();
+  lock_volume();
+  int result = volume_mounted ? seek_read(fileID, loc) : -1;
+  unlock_volume();
+  EVENT_END(EVENT_CALL, __func__, fileID, result);
+  trace_record(TRACE_FRSEEK, start, fileID, 0, loc, result, NULL, NULL);
+  return result;
+}
+
+int sfs_fwseek64(int fileID, long long loc){
+  EVENT_BEGIN(EVENT_CALL, __func__, fileID, loc);
+  long long start = trace_clock();
+  lock_volume();
+  int result = volume_mounted ? seek_write(fileID, loc) : -1;
+  unlock_volume();
+  EVENT_END(EVENT_CALL, __func__, fileID, result);
+  trace_record(TRACE_FWSEEK, start, fileID, 0, loc, result, NULL, NULL);
+  return result;
+}
+
+long long sfs_fwrite64(int fileID, char *buf, long long length){
+  EVENT_BEGIN(EVENT_CALL, __func__, fileID, length);
+  long long start = trace_clock();
+  lock_volume();
+  long long result = volume_mounted ? write_fd(fileID, buf, length) : -1;
+  unlock_volume();
+  EVENT_END(EVENT_CALL, __func__, fileID, result);
+  trace_record(TRACE_FWRITE, start, fileID, length, 0, result, NULL, NULL);
+  return result;
+}
+
+long long sfs_fread64(int fileID, char *buf, long long length){
+  EVENT_BEGIN(EVENT_CALL, __func__, fileID, length);
+  long long start = trace_clock();
+  lock_volume();
+  long long result = volume_mounted ? read_fd(fileID, buf, length) : -1;
+  unlock_volume();
+  EVENT_END(EVENT_CALL, __func__, fileID, result);
+  trace_record(TRACE_FREAD, start, fileID, length, 0, result, NULL, NULL);
+  return result;
+}
+
+long long sfs_pwrite64(int fileID, char *buf, long long length, long long offset){
+  EVENT_BEGIN(EVENT_CALL, __func__, fileID, length);
+  long long start = trace_clock();
+  lock_volume();
+  long long result = volume_mounted ? pwrite_fd(fileID, buf, length, offset) : -1;
+  unlock_volume();
+  EVENT_END(EVENT_CALL, __func__, fileID, result);
+  trace_record(TRACE_PWRITE, start, fileID, length, offset, result, NULL, NULL);
+  return result;
+}
+
+long long sfs_pread64(int fileID, char *buf, long long length, long long offset){
+  EVENT_BEGIN(EVENT_CALL, __func__, fileID, length);
+  long long start = trace_clock();
+  lock_volume();
+  long long result = volume_mounted ? pread_fd(fileID, buf, length, offset) : -1;
+  unlock_volume();
+  EVENT_END(EVENT_CALL, __func__, fileID, result);
+  trace_record(TRACE_PREAD, start, fileID, length, offset, result, NULL, NULL);
+  return result;
+}
+
+int sfs_fallocate64(int fileID, long long offset, long long length, int mode){
+  EVENT_BEGIN(EVENT_CALL, __func__, fileID, length);
+  long long start = trace_clock();
+  lock_volume();
+  int result = volume_mounted ? fallocate_fd(fileID, offset, length, mode) : -1;
+  unlock_volume();
+  EVENT_END(EVENT_CALL, __func__, fileID, result);
+  int op = TRACE_FALLOCATE;
+  if(mode & SFS_FALLOC_PUNCH_HOLE){
+    op = TRACE_PUNCH_HOLE;
+  }else if(mode & SFS_FALLOC_KEEP_SIZE){
+    op = TRACE_FALLOCATE_KEEP_SIZE;
+  }
+  trace_record(op, start, fileID, length, offset, result, NULL, NULL);
+  return result;
+}
+
+int sfs_remove(char *file){
+  EVENT_BEGIN(EVENT_CALL, __func__, 0, 0);
+  long long start = trace_clock();
+  lock_volume();
+  int result = volume_mounted ? remove_file(file) : -1;
+  unlock_volume();
+  EVENT_END(EVENT_CALL, __func__, 0, result);
+  trace_record(TRACE_REMOVE, start, 0, 0, 0, result, file, NULL);
+  return result;
+}
+
+/*The int calls, they go through the 64 bit ones above. A size or offset that does not fit in an int is -1.*/
+static int narrow(long long value){
+  return value > INT_MAX ? -1 : (int)value;
+}
+
+int sfs_get_file_size(char* path){
+  return narrow(sfs_get_file_size64(path));
+}
+
+int sfs_frseek(int fileID, int loc){
+  return sfs_frseek64(fileID, loc);
+}
+
+int sfs_fwseek(int fileID, int loc){
+  return sfs_fwseek64(fileID, loc);
+}
+
+int sfs_fwrite(int fileID, char *buf, int length){
+  return (int)sfs_fwrite64(fileID, buf, length);
+}
+
+int sfs_fread(int fileID, char *buf, int length){
+  return (int)sfs_fread64(fileID, buf, length);
+}
+
+int sfs_pwrite(int fileID, char *buf, int length, int offset){
+  return (int)sfs_pwrite64(fileID, buf, length, offset);
+}
+
+int sfs_pread(int fileID, char *buf, int length, int offset){
+  return (int)sfs_pread64(fileID, buf, length, offset);
+}
+
+int sfs_fallocate(int fileID, int offset, int length, int mode){
+  return sfs_fallocate64(fileID, offset, length, mode);
+}
+
+int sfs_seek_data(int fileID, int offset){
+  return narrow(sfs_seek_data64(fileID, offset));
+}
+
+int sfs_seek_hole(int fileID, int offset){
+  return narrow(sfs_seek_hole64(fileID, offset));
+}
+
+int sfs_snapshot_get_file_size(int id, char *name){
+  return narrow(sfs_snapshot_get_file_size64(id, name));
+}
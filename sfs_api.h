@@ -1,5 +1,52 @@
 //Functions you should implement. 
 //Return -1 for error besides mksfs
+#ifndef SFS_API_H
+#define SFS_API_H
+
+#include <sys/uio.h>
+
+/*Operations of sfs_batch*/
+#define SFS_OP_OPEN 0
+#define SFS_OP_READ 1
+#define SFS_OP_WRITE 2
+#define SFS_OP_CLOSE 3
+
+/*One operation of sfs_batch. OPEN uses name, READ and WRITE use buf and length,
+READ, WRITE and CLOSE work on fd, or on the fd returned by the earlier OPEN at index ref when ref is not -1.
+result is set to what the matching sfs_fopen, sfs_fread64, sfs_fwrite64 or sfs_fclose call returns.*/
+typedef struct Sfs_Op{
+  int type;
+  char *name;
+  int fd;
+  int ref;
+  char *buf;
+  long long length;
+  long long result;
+}Sfs_Op;
+
+/*A request for sfs_submit. OPEN uses name, READ and WRITE use fd, buf, length and offset like sfs_pread64
+and sfs_pwrite64, CLOSE uses fd. user_data comes back untouched in the completion.*/
+typedef struct Sfs_Request{
+  int type;
+  char *name;
+  int fd;
+  char *buf;
+  long long length;
+  long long offset;
+  void *user_data;
+}Sfs_Request;
+
+/*A finished request, result is what the matching synchronous call returned (-1 on error)*/
+typedef struct Sfs_Completion{
+  int type;
+  void *user_data;
+  long long result;
+}Sfs_Completion;
+
+/*Modes of sfs_fallocate: reserve the blocks without growing the file,
+or give back the blocks of the range so it reads as zeros*/
+#define SFS_FALLOC_KEEP_SIZE 1
+#define SFS_FALLOC_PUNCH_HOLE 2
 
 void mksfs(int fresh);
 int sfs_get_next_file_name(char *fname);
@@ -10,4 +57,51 @@ int sfs_frseek(int fileID, int loc);
 int sfs_fwseek(int fileID, int loc);
 int sfs_fwrite(int fileID, char *buf, int length);
 int sfs_fread(int fileID, char *buf, int length);
-int sfs_remove(char *file);
\ No newline at end of file
+int sfs_pwrite(int fileID, char *buf, int length, int offset);
+int sfs_pread(int fileID, char *buf, int length, int offset);
+int sfs_fallocate(int fileID, int offset, int length, int mode);
+int sfs_seek_data(int fileID, int offset);
+int sfs_seek_hole(int fileID, int offset);
+
+/*64 bit variants of the calls above, for sizes and offsets past 2 GiB.
+The int calls return -1 where the size or offset they would return does not fit in an int.*/
+long long sfs_get_file_size64(char* path);
+int sfs_frseek64(int fileID, long long loc);
+int sfs_fwseek64(int fileID, long long loc);
+long long sfs_fwrite64(int fileID, char *buf, long long length);
+long long sfs_fread64(int fileID, char *buf, long long length);
+long long sfs_pwrite64(int fileID, char *buf, long long length, long long offset);
+long long sfs_pread64(int fileID, char *buf, long long length, long long offset);
+int sfs_fallocate64(int fileID, long long offset, long long length, int mode);
+long long sfs_seek_data64(int fileID, long long offset);
+long long sfs_seek_hole64(int fileID, long long offset);
+long long sfs_snapshot_get_file_size64(int id, char *name);
+
+int sfs_fwritev(int fileID, const struct iovec *iov, int count);
+int sfs_freadv(int fileID, const struct iovec *iov, int count);
+int sfs_batch(Sfs_Op *ops, int count);
+int sfs_async_start(int workers);
+void sfs_async_stop();
+int sfs_submit(Sfs_Request *request);
+int sfs_reap(Sfs_Completion *completed, int max, int wait);
+int sfs_remove(char *file);
+int sfs_clone(char *src, char *dst);
+int sfs_get_fragments(char *name);
+int sfs_defrag(char *name);
+int sfs_defrag_start(int bytes_per_second);
+int sfs_defrag_stop(int cancel);
+int sfs_snapshot();
+int sfs_snapshot_delete(int id);
+int sfs_snapshot_get_file_name(int id, int index, char *fname);
+int sfs_snapshot_get_file_size(int id, char *name);
+int sfs_snapshot_read(int id, char *name, char *buf, int position, int length);
+int sfs_set_compression(int fileID, int enable);
+void sfs_set_volume_compression(int enable);
+void sfs_set_volume_dedup(int enable);
+int sfs_get_used_blocks();
+void sfs_set_volume_checksums(int enable);
+int sfs_get_checksum_errors();
+int sfs_trace_start(char *path);
+void sfs_trace_stop();
+
+#endif
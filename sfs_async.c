@@ -0,0 +1,245 @@
+#include "sfs_api.h"
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sched.h>
+
+/*Submission and completion queues are bounded rings in which every cell carries a sequence number
+(Vyukov's queue). Producers and consumers claim a position with a compare and swap on tail or head
+and publish the cell by storing its next sequence number, so neither side ever takes a lock.
+Semaphores count the entries ready to be taken so idle workers and sfs_reap(wait) can sleep.
+They are set up once and never destroyed, completions submitted before a stop can still be reaped after it.
+
+Every call into the file system takes the volume lock, so the workers call it directly and their
+requests run one at a time. The caller still never blocks on storage: it only touches the rings.*/
+#define ASYNC_QUEUE_SIZE 256
+#define ASYNC_MAX_WORKERS 16
+
+typedef struct Async_Entry{
+  Sfs_Request request;
+  long long result;
+}Async_Entry;
+
+typedef struct Async_Cell{
+  atomic_size_t sequence;
+  Async_Entry entry;
+}Async_Cell;
+
+typedef struct Async_Ring{
+  Async_Cell cells[ASYNC_QUEUE_SIZE];
+  atomic_size_t head;
+  atomic_size_t tail;
+}Async_Ring;
+
+static Async_Ring submissions;
+static Async_Ring completions;
+static sem_t submission_ready;
+static sem_t completion_ready;
+/*Requests submitted and not reaped yet, bounded by ASYNC_QUEUE_SIZE so the completion ring never fills*/
+static atomic_int in_flight;
+/*Set while no workers run, sfs_submit refuses requests*/
+static atomic_int stopping = 1;
+/*sfs_submit calls between their check of stopping and their push, sfs_async_stop waits them out*/
+static atomic_int submitting;
+static pthread_once_t semaphores_once = PTHREAD_ONCE_INIT;
+
+static pthread_t workers[ASYNC_MAX_WORKERS];
+static int worker_count = 0;
+
+static void ring_init(Async_Ring *ring){
+  for(size_t i=0; i<ASYNC_QUEUE_SIZE; i++){
+    atomic_store_explicit(&ring->cells[i].sequence, i, memory_order_relaxed);
+  }
+  atomic_store(&ring->head, 0);
+  atomic_store(&ring->tail, 0);
+}
+
+/*Append entry, returns -1 if the ring is full*/
+static int ring_push(Async_Ring *ring, Async_Entry *entry){
+  size_t position = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  Async_Cell *cell;
+  while(1){
+    cell = &ring->cells[position%ASYNC_QUEUE_SIZE];
+    size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    intptr_t difference = (intptr_t)sequence-(intptr_t)position;
+    if(difference == 0){
+      if(atomic_compare_exchange_weak_explicit(&ring->tail, &position, position+1,
+          memory_order_relaxed, memory_order_relaxed)){
+        break;
+      }
+    }else if(difference < 0){
+      return -1;
+    }else{
+      position = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    }
+  }
+  cell->entry = *entry;
+  atomic_store_explicit(&cell->sequence, position+1, memory_order_release);
+  return 0;
+}
+
+/*Take the oldest entry, returns -1 if the ring is empty*/
+static int ring_pop(Async_Ring *ring, Async_Entry *entry){
+  size_t position = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  Async_Cell *cell;
+  while(1){
+    cell = &ring->cells[position%ASYNC_QUEUE_SIZE];
+    size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    intptr_t difference = (intptr_t)sequence-(intptr_t)(position+1);
+    if(difference == 0){
+      if(atomic_compare_exchange_weak_explicit(&ring->head, &position, position+1,
+          memory_order_relaxed, memory_order_relaxed)){
+        break;
+      }
+    }else if(difference < 0){
+      return -1;
+    }else{
+      position = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    }
+  }
+  *entry = cell->entry;
+  atomic_store_explicit(&cell->sequence, position+ASYNC_QUEUE_SIZE, memory_order_release);
+  return 0;
+}
+
+/*Run one request the way the matching synchronous call would*/
+static long long run_request(Sfs_Request *request){
+  switch(request->type){
+    case SFS_OP_OPEN:
+      return sfs_fopen(request->name);
+    case SFS_OP_READ:
+      return sfs_pread64(request->fd, request->buf, request->length, request->offset);
+    case SFS_OP_WRITE:
+      return sfs_pwrite64(request->fd, request->buf, request->length, request->offset);
+    case SFS_OP_CLOSE:
+      return sfs_fclose(request->fd);
+  }
+  return -1;
+}
+
+static void *worker_main(void *unused){
+  (void)unused;
+  Async_Entry entry;
+  while(1){
+    sem_wait(&submission_ready);
+    if(ring_pop(&submissions, &entry) == -1){
+      /*Only the wake ups posted by sfs_async_stop find the ring empty*/
+      if(atomic_load(&stopping)){
+        return NULL;
+      }
+      continue;
+    }
+
+    entry.result = run_request(&entry.request);
+
+    /*Cannot fail while in_flight stays within the ring size, yield in case a reaper is mid pop*/
+    while(ring_push(&completions, &entry) == -1){
+      sched_yield();
+    }
+    sem_post(&completion_ready);
+  }
+}
+
+static void init_semaphores(){
+  sem_init(&submission_ready, 0, 0);
+  sem_init(&completion_ready, 0, 0);
+}
+
+/*Start count workers. Returns -1 if they are already running, or while completions of an earlier run
+are still waiting to be reaped.*/
+int sfs_async_start(int count){
+  if(worker_count || count<1 || count>ASYNC_MAX_WORKERS || atomic_load(&in_flight) != 0){
+    return -1;
+  }
+
+  pthread_once(&semaphores_once, init_semaphores);
+  ring_init(&submissions);
+  ring_init(&completions);
+
+  for(int i=0; i<count; i++){
+    if(pthread_create(&workers[i], NULL, worker_main, NULL) != 0){
+      worker_count = i;
+      sfs_async_stop();
+      return -1;
+    }
+  }
+  worker_count = count;
+  /*Open for submissions once every worker is there*/
+  atomic_store(&stopping, 0);
+  return 0;
+}
+
+/*Stop the workers once they have run every request submitted so far. Their completions stay in the
+completion ring for sfs_reap, so a reaper waiting on one is woken as usual.*/
+void sfs_async_stop(){
+  if(worker_count == 0){
+    return;
+  }
+  atomic_store(&stopping, 1);
+  /*A submit that saw stopping clear finishes its push before the workers are told to go*/
+  while(atomic_load(&submitting) != 0){
+    sched_yield();
+  }
+  /*Workers leave only when they find the ring empty, so everything pushed above is run first*/
+  for(int i=0; i<worker_count; i++){
+    sem_post(&submission_ready);
+  }
+  for(int i=0; i<worker_count; i++){
+    pthread_join(workers[i], NULL);
+  }
+  worker_count = 0;
+}
+
+/*Queue request for the workers, -1 if they are stopping or the rings are full*/
+static int submit_request(Sfs_Request *request){
+  if(atomic_load(&stopping)){
+    return -1;
+  }
+  if(atomic_fetch_add(&in_flight, 1) >= ASYNC_QUEUE_SIZE){
+    atomic_fetch_sub(&in_flight, 1);
+    return -1;
+  }
+
+  Async_Entry entry;
+  entry.request = *request;
+  entry.result = -1;
+  if(ring_push(&submissions, &entry) == -1){
+    atomic_fetch_sub(&in_flight, 1);
+    return -1;
+  }
+  sem_post(&submission_ready);
+  return 0;
+}
+
+int sfs_submit(Sfs_Request *request){
+  atomic_fetch_add(&submitting, 1);
+  int result = submit_request(request);
+  atomic_fetch_sub(&submitting, 1);
+  return result;
+}
+
+int sfs_reap(Sfs_Completion *completed, int max, int wait){
+  pthread_once(&semaphores_once, init_semaphores);
+  int count = 0;
+  while(count<max){
+    if(sem_trywait(&completion_ready) != 0){
+      /*Sleep for the first completion only, and only if one is still coming*/
+      if(!wait || count>0 || atomic_load(&in_flight) == 0){
+        break;
+      }
+      sem_wait(&completion_ready);
+    }
+
+    Async_Entry entry;
+    while(ring_pop(&completions, &entry) == -1){
+      sched_yield();
+    }
+    atomic_fetch_sub(&in_flight, 1);
+    completed[count].type = entry.request.type;
+    completed[count].user_data = entry.request.user_data;
+    completed[count].result = entry.result;
+    count++;
+  }
+  return count;
+}
@@ -0,0 +1,414 @@
+/* sfs_bench.c
+ *
+ * Throughput benchmark for the simple file system.
+ * Writes, reads back and removes a set of log style files on a fresh volume
+ * with each volume mode (plain, compressed, deduplicated, data checksums) and prints MB/s
+ * for each, along with the most blocks the files took up on the device and the heap allocations
+ * each read and write made once the first round had warmed up (0 is the goal), and what
+ * turning data checksums on costs against the plain run.
+ * Then appends small records to a log file one call at a time, in batches and into space
+ * reserved up front with sfs_fallocate, reads files written side by side before and after
+ * defragmenting them, looks file sizes up from one and several threads the way FUSE getattr
+ * does, and measures the block codec and the block checksum on their own.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "sfs_api.h"
+#include "sfs_lz.h"
+#include "sfs_crc.h"
+
+#define BENCH_FILES 6
+#define BENCH_FILE_SIZE 8192
+#define BENCH_CHUNK 512
+#define BENCH_ROUNDS 20
+#define BENCH_CRC_ROUNDS 20000
+#define BENCH_RECORD 64
+#define BENCH_RECORDS 128
+#define BENCH_BATCH 16
+#define BENCH_LOOKUPS 200000
+#define BENCH_THREADS 4
+#define BENCH_PAIRS 5
+
+/*Volume modes of a run*/
+#define MODE_COMPRESSED 1
+#define MODE_DEDUP 2
+#define MODE_CHECKSUMS 4
+
+/*The bench is linked with --wrap for the allocator (see the Makefile), so every heap allocation
+made by the library, the bench or the disk emulator comes through here and is counted*/
+static atomic_llong allocations;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__real_aligned_alloc(size_t alignment, size_t size);
+
+void *__wrap_malloc(size_t size){
+  atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size){
+  atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+  return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size){
+  atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+  return __real_realloc(ptr, size);
+}
+
+void *__wrap_aligned_alloc(size_t alignment, size_t size){
+  atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+  return __real_aligned_alloc(alignment, size);
+}
+
+static double now_seconds(){
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec/1e9;
+}
+
+/*Fill buf with length bytes of text that looks like a service log*/
+static void make_log_text(char *buf, int length){
+  static const char *levels[] = {"INFO", "INFO", "INFO", "WARN", "DEBUG"};
+  static const char *paths[] = {"/api/users", "/api/orders", "/health", "/api/items", "/login"};
+  int used = 0;
+  int line = 0;
+  while(used < length){
+    char text[128];
+    int n = snprintf(text, sizeof(text), "2017-03-12 10:%02d:%02d %s GET %s id=%d status=%d bytes=%d\n",
+      (line/60)%60, line%60, levels[rand()%5], paths[rand()%5], rand()%100000, rand()%4 ? 200 : 404, rand()%9000);
+    if(n > length-used){
+      n = length-used;
+    }
+    memcpy(buf+used, text, n);
+    used += n;
+    line++;
+  }
+}
+
+/*Result of BENCH_ROUNDS write / read / remove cycles*/
+typedef struct Cycle_Result{
+  double write_time;
+  double read_time;
+  long long bytes;
+  int errors;
+  int peak_blocks;
+  long long calls;
+  long long allocated;
+}Cycle_Result;
+
+/*Run the write / read / remove cycle for one mode on a fresh volume.
+With copies set every file gets the content of the first one.*/
+static void cycle(int mode, int copies, char **data, Cycle_Result *result){
+  char name[16];
+  char *read_buf = malloc(BENCH_FILE_SIZE);
+  double write_time = 0;
+  double read_time = 0;
+  long long bytes = 0;
+  int errors = 0;
+  int peak_blocks = 0;
+  long long calls = 0;
+  long long allocated = 0;
+
+  mksfs(1);
+  int empty_blocks = sfs_get_used_blocks();
+  sfs_set_volume_compression(mode & MODE_COMPRESSED);
+  sfs_set_volume_dedup(mode & MODE_DEDUP);
+  sfs_set_volume_checksums(mode & MODE_CHECKSUMS);
+
+  for(int round = 0; round < BENCH_ROUNDS; round++){
+    int fds[BENCH_FILES];
+
+    long long allocated_before = atomic_load(&allocations);
+    double start = now_seconds();
+    for(int i = 0; i < BENCH_FILES; i++){
+      sprintf(name, "log%d.txt", i);
+      fds[i] = sfs_fopen(name);
+      char *content = copies ? data[0] : data[i];
+      for(int off = 0; off < BENCH_FILE_SIZE; off += BENCH_CHUNK){
+        if(sfs_fwrite(fds[i], content+off, BENCH_CHUNK) != BENCH_CHUNK){
+          errors++;
+        }
+      }
+    }
+    write_time += now_seconds()-start;
+    if(sfs_get_used_blocks()-empty_blocks > peak_blocks){
+      peak_blocks = sfs_get_used_blocks()-empty_blocks;
+    }
+
+    start = now_seconds();
+    for(int i = 0; i < BENCH_FILES; i++){
+      sfs_frseek(fds[i], 0);
+      char *content = copies ? data[0] : data[i];
+      if(sfs_fread(fds[i], read_buf, BENCH_FILE_SIZE) != BENCH_FILE_SIZE || memcmp(read_buf, content, BENCH_FILE_SIZE) != 0){
+        errors++;
+      }
+    }
+    read_time += now_seconds()-start;
+    /*The first round makes the fds and the fingerprints, count the rounds after it*/
+    if(round > 0){
+      allocated += atomic_load(&allocations)-allocated_before;
+      calls += BENCH_FILES*(BENCH_FILE_SIZE/BENCH_CHUNK+3);
+    }
+
+    for(int i = 0; i < BENCH_FILES; i++){
+      sfs_fclose(fds[i]);
+      sprintf(name, "log%d.txt", i);
+      sfs_remove(name);
+    }
+    bytes += BENCH_FILES*BENCH_FILE_SIZE;
+  }
+
+  result->write_time = write_time;
+  result->read_time = read_time;
+  result->bytes = bytes;
+  result->errors = errors+sfs_get_checksum_errors();
+  result->peak_blocks = peak_blocks;
+  result->calls = calls;
+  result->allocated = allocated;
+  free(read_buf);
+}
+
+/*Run the cycle and print the result for one mode*/
+static int run(char *label, int mode, int copies, char **data){
+  Cycle_Result result;
+  cycle(mode, copies, data, &result);
+  printf("%-18s write %8.2f MB/s   read %8.2f MB/s   blocks %3d   allocs/call %.2f   errors %d\n", label,
+    result.bytes/1e6/result.write_time, result.bytes/1e6/result.read_time, result.peak_blocks,
+    (double)result.allocated/result.calls, result.errors);
+  return result.errors;
+}
+
+/*Cost of data checksums: the raw and the checksummed cycle run in turn BENCH_PAIRS times and the
+fastest time of each is compared, so a slow round of one of them does not count against it.
+Prints how much longer writes, reads and the whole cycle take with checksums on.*/
+static int run_checksum_cost(char **data){
+  Cycle_Result result;
+  double best[2][2] = {{0, 0}, {0, 0}};
+  int errors = 0;
+
+  for(int pair = 0; pair < BENCH_PAIRS; pair++){
+    for(int checksums = 0; checksums < 2; checksums++){
+      cycle(checksums ? MODE_CHECKSUMS : 0, 0, data, &result);
+      errors += result.errors;
+      if(pair == 0 || result.write_time < best[checksums][0]){
+        best[checksums][0] = result.write_time;
+      }
+      if(pair == 0 || result.read_time < best[checksums][1]){
+        best[checksums][1] = result.read_time;
+      }
+    }
+  }
+  printf("checksum cost      write %+7.1f %%     read %+7.1f %%     cycle %+7.1f %%   errors %d\n",
+    100*(best[1][0]/best[0][0]-1), 100*(best[1][1]/best[0][1]-1),
+    100*((best[1][0]+best[1][1])/(best[0][0]+best[0][1])-1), errors);
+  return errors;
+}
+
+/*Append BENCH_RECORDS records to a fresh file, batch records per call, and print the write speed.
+With prealloc set the space for all records is reserved before the first one is written.*/
+static int run_records(char *label, int batch, int prealloc, char *data){
+  double elapsed = 0;
+  int errors = 0;
+  long long calls = 0;
+  long long allocated = 0;
+  Sfs_Op ops[BENCH_BATCH];
+
+  mksfs(1);
+  for(int round = 0; round < BENCH_ROUNDS; round++){
+    int fd = sfs_fopen("records.log");
+    if(prealloc){
+      errors += sfs_fallocate(fd, 0, BENCH_RECORDS*BENCH_RECORD, SFS_FALLOC_KEEP_SIZE) != 0;
+    }
+    long long allocated_before = atomic_load(&allocations);
+    double start = now_seconds();
+    for(int i = 0; i < BENCH_RECORDS; i += batch){
+      if(batch == 1){
+        errors += sfs_fwrite(fd, data+i*BENCH_RECORD, BENCH_RECORD) != BENCH_RECORD;
+        continue;
+      }
+      for(int j = 0; j < batch; j++){
+        ops[j].type = SFS_OP_WRITE;
+        ops[j].fd = fd;
+        ops[j].ref = -1;
+        ops[j].buf = data+(i+j)*BENCH_RECORD;
+        ops[j].length = BENCH_RECORD;
+      }
+      errors += sfs_batch(ops, batch);
+    }
+    elapsed += now_seconds()-start;
+    if(round > 0){
+      allocated += atomic_load(&allocations)-allocated_before;
+      calls += (BENCH_RECORDS+batch-1)/batch;
+    }
+    sfs_fclose(fd);
+    sfs_remove("records.log");
+  }
+
+  printf("%-18s write %8.2f MB/s   allocs/call %.2f   errors %d\n", label,
+    (double)BENCH_ROUNDS*BENCH_RECORDS*BENCH_RECORD/1e6/elapsed, (double)allocated/calls, errors);
+  return errors;
+}
+
+/*Read every file back BENCH_ROUNDS times, returns MB/s and adds the average extents per file to *extents*/
+static double read_speed(char *read_buf, char **data, int *errors, double *extents){
+  char name[16];
+  double start = now_seconds();
+  for(int round = 0; round < BENCH_ROUNDS; round++){
+    for(int i = 0; i < BENCH_FILES; i++){
+      sprintf(name, "log%d.txt", i);
+      int fd = sfs_fopen(name);
+      if(sfs_fread(fd, read_buf, BENCH_FILE_SIZE) != BENCH_FILE_SIZE || memcmp(read_buf, data[i], BENCH_FILE_SIZE) != 0){
+        (*errors)++;
+      }
+      sfs_fclose(fd);
+    }
+  }
+  double elapsed = now_seconds()-start;
+  *extents = 0;
+  for(int i = 0; i < BENCH_FILES; i++){
+    sprintf(name, "log%d.txt", i);
+    *extents += (double)sfs_get_fragments(name)/BENCH_FILES;
+  }
+  return (double)BENCH_ROUNDS*BENCH_FILES*BENCH_FILE_SIZE/1e6/elapsed;
+}
+
+/*Write the files a block at a time in turn, so files that share a group end up interleaved,
+then read them before and after a background defragmenting pass*/
+static int run_aged(char **data){
+  char name[16];
+  char *read_buf = malloc(BENCH_FILE_SIZE);
+  int fds[BENCH_FILES];
+  int errors = 0;
+
+  mksfs(1);
+  for(int i = 0; i < BENCH_FILES; i++){
+    sprintf(name, "log%d.txt", i);
+    fds[i] = sfs_fopen(name);
+  }
+  for(int off = 0; off < BENCH_FILE_SIZE; off += 1024){
+    for(int i = 0; i < BENCH_FILES; i++){
+      errors += sfs_fwrite(fds[i], data[i]+off, 1024) != 1024;
+    }
+  }
+  for(int i = 0; i < BENCH_FILES; i++){
+    sfs_fclose(fds[i]);
+  }
+
+  double aged_extents;
+  double defragged_extents;
+  double aged = read_speed(read_buf, data, &errors, &aged_extents);
+  sfs_defrag_start(0);
+  int moved = sfs_defrag_stop(0);
+  double defragged = read_speed(read_buf, data, &errors, &defragged_extents);
+
+  printf("aged               read %8.2f MB/s   extents %.1f   defragged read %8.2f MB/s   extents %.1f   moved %d   errors %d\n",
+    aged, aged_extents, defragged, defragged_extents, moved, errors);
+  free(read_buf);
+  return errors;
+}
+
+/*Look the size of every file up BENCH_LOOKUPS times in all, returns the number of wrong sizes*/
+static void *stat_files(void *arg){
+  (void)arg;
+  long wrong = 0;
+  char name[16];
+  for(int i = 0; i < BENCH_LOOKUPS; i++){
+    sprintf(name, "log%d.txt", i%BENCH_FILES);
+    wrong += sfs_get_file_size(name) != BENCH_FILE_SIZE;
+  }
+  return (void*)wrong;
+}
+
+/*Look file sizes up from one thread and then from BENCH_THREADS at once*/
+static int run_stat(char **data){
+  char name[16];
+  pthread_t threads[BENCH_THREADS];
+  int errors = 0;
+
+  mksfs(1);
+  for(int i = 0; i < BENCH_FILES; i++){
+    sprintf(name, "log%d.txt", i);
+    int fd = sfs_fopen(name);
+    errors += sfs_fwrite(fd, data[i], BENCH_FILE_SIZE) != BENCH_FILE_SIZE;
+    sfs_fclose(fd);
+  }
+
+  double start = now_seconds();
+  errors += (long)stat_files(NULL);
+  double single = BENCH_LOOKUPS/1e6/(now_seconds()-start);
+
+  start = now_seconds();
+  for(int t = 0; t < BENCH_THREADS; t++){
+    pthread_create(&threads[t], NULL, stat_files, NULL);
+  }
+  for(int t = 0; t < BENCH_THREADS; t++){
+    void *wrong;
+    pthread_join(threads[t], &wrong);
+    errors += (long)wrong;
+  }
+  double parallel = (double)BENCH_THREADS*BENCH_LOOKUPS/1e6/(now_seconds()-start);
+
+  printf("stat               1 thread %8.2f M/s   %d threads %8.2f M/s   errors %d\n",
+    single, BENCH_THREADS, parallel, errors);
+  return errors;
+}
+
+/*Time one checksum function over a block sized buffer*/
+static double crc_speed(unsigned int (*crc)(const void*, int), char *block){
+  unsigned int sum = 0;
+  double start = now_seconds();
+  for(int i = 0; i < BENCH_CRC_ROUNDS; i++){
+    sum += crc(block, 1024);
+    block[i%1024]++;
+  }
+  double elapsed = now_seconds()-start;
+  /*Keep the loop from being optimized away*/
+  if(sum == 1){
+    printf(" ");
+  }
+  return BENCH_CRC_ROUNDS*1024/1e6/elapsed;
+}
+
+int main(){
+  char *data[BENCH_FILES];
+  int errors = 0;
+
+  srand(310);
+  for(int i = 0; i < BENCH_FILES; i++){
+    data[i] = malloc(BENCH_FILE_SIZE);
+    make_log_text(data[i], BENCH_FILE_SIZE);
+  }
+
+  errors += run("raw", 0, 0, data);
+  errors += run("compressed", MODE_COMPRESSED, 0, data);
+  errors += run("dedup", MODE_DEDUP, 0, data);
+  errors += run("raw copies", 0, 1, data);
+  errors += run("dedup copies", MODE_DEDUP, 1, data);
+  errors += run("data checksums", MODE_CHECKSUMS, 0, data);
+  errors += run_checksum_cost(data);
+  errors += run_records("records", 1, 0, data[0]);
+  errors += run_records("records batched", BENCH_BATCH, 0, data[0]);
+  errors += run_records("records prealloc", 1, 1, data[0]);
+  errors += run_aged(data);
+  errors += run_stat(data);
+
+  printf("compression  ratio %.2fx   compress %.2f MB/s   decompress %.2f MB/s\n",
+    lz_stats.compress_out ? (double)lz_stats.compress_in/lz_stats.compress_out : 0,
+    lz_stats.compress_ns ? lz_stats.compress_in/1e6/(lz_stats.compress_ns/1e9) : 0,
+    lz_stats.decompress_ns ? lz_stats.decompress_out/1e6/(lz_stats.decompress_ns/1e9) : 0);
+  printf("crc32c       %s %.2f MB/s   portable %.2f MB/s\n", crc32c_hardware() ? "sse4.2" : "table ",
+    crc_speed(crc32c, data[0]), crc_speed(crc32c_portable, data[0]));
+
+  for(int i = 0; i < BENCH_FILES; i++){
+    free(data[i]);
+  }
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,167 @@
+#include "sfs_crc.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define CRC_X86 1
+#endif
+
+/*Reflected Castagnoli polynomial*/
+#define CRC_POLY 0x82f63b78u
+
+/*crc_table[k][b] is the CRC of byte b followed by k zero bytes*/
+static unsigned int crc_table[8][256];
+/*The hardware version runs three streams of CRC_STRIDE bytes side by side, the crc32 instruction can
+start a new step every cycle but takes three to finish one. shift_table[s] moves a CRC of one stream
+past (s+1)*CRC_STRIDE zero bytes, a byte of it at a time, so the streams can be joined.*/
+#define CRC_STRIDE 336
+static unsigned int shift_table[2][4][256];
+static int crc_ready = 0;
+static int crc_use_hardware = 0;
+
+static void crc_init(){
+  for(int b=0; b<256; b++){
+    unsigned int crc = b;
+    for(int i=0; i<8; i++){
+      crc = crc & 1 ? (crc >> 1)^CRC_POLY : crc >> 1;
+    }
+    crc_table[0][b] = crc;
+  }
+  for(int b=0; b<256; b++){
+    for(int k=1; k<8; k++){
+      crc_table[k][b] = (crc_table[k-1][b] >> 8)^crc_table[0][crc_table[k-1][b] & 0xff];
+    }
+  }
+#ifdef CRC_X86
+  crc_use_hardware = __builtin_cpu_supports("sse4.2") != 0;
+#endif
+  /*A shift is linear in the CRC, so the table entries are XORs of the shifts of single bits*/
+  for(int s=0; s<2; s++){
+    unsigned int bit_shift[32];
+    for(int bit=0; bit<32; bit++){
+      unsigned int crc = 1u << bit;
+      for(int i=0; i<(s+1)*CRC_STRIDE; i++){
+        crc = (crc >> 8)^crc_table[0][crc & 0xff];
+      }
+      bit_shift[bit] = crc;
+    }
+    for(int k=0; k<4; k++){
+      for(int b=0; b<256; b++){
+        unsigned int crc = 0;
+        for(int bit=0; bit<8; bit++){
+          if(b & (1 << bit)){
+            crc ^= bit_shift[8*k+bit];
+          }
+        }
+        shift_table[s][k][b] = crc;
+      }
+    }
+  }
+  crc_ready = 1;
+}
+
+/*CRC of crc followed by (s+1)*CRC_STRIDE zero bytes*/
+static unsigned int crc_shift(unsigned int crc, int s){
+  return shift_table[s][0][crc & 0xff]^shift_table[s][1][(crc >> 8) & 0xff]^
+    shift_table[s][2][(crc >> 16) & 0xff]^shift_table[s][3][crc >> 24];
+}
+
+unsigned int crc32c_portable(const void *data, int length){
+  if(!crc_ready){
+    crc_init();
+  }
+  const unsigned char *p = (const unsigned char*)data;
+  unsigned int crc = 0xffffffffu;
+
+  /*Eight bytes per step, one table lookup per byte with no dependency between them*/
+  while(length >= 8){
+    unsigned int low;
+    unsigned int high;
+    memcpy(&low, p, 4);
+    memcpy(&high, p+4, 4);
+    low ^= crc;
+    crc = crc_table[7][low & 0xff]^crc_table[6][(low >> 8) & 0xff]^
+      crc_table[5][(low >> 16) & 0xff]^crc_table[4][low >> 24]^
+      crc_table[3][high & 0xff]^crc_table[2][(high >> 8) & 0xff]^
+      crc_table[1][(high >> 16) & 0xff]^crc_table[0][high >> 24];
+    p += 8;
+    length -= 8;
+  }
+  while(length > 0){
+    crc = (crc >> 8)^crc_table[0][(crc^*p) & 0xff];
+    p++;
+    length--;
+  }
+  return ~crc;
+}
+
+#ifdef CRC_X86
+__attribute__((target("sse4.2")))
+static unsigned int crc32c_sse42(const void *data, int length){
+  const unsigned char *p = (const unsigned char*)data;
+#ifdef __x86_64__
+  unsigned long long crc = 0xffffffffu;
+  /*Three streams at once, the second and third start from 0 and are joined onto the first*/
+  while(length >= 3*CRC_STRIDE){
+    unsigned long long crc1 = 0;
+    unsigned long long crc2 = 0;
+    for(int i=0; i<CRC_STRIDE; i += 8){
+      unsigned long long word0;
+      unsigned long long word1;
+      unsigned long long word2;
+      memcpy(&word0, p+i, 8);
+      memcpy(&word1, p+CRC_STRIDE+i, 8);
+      memcpy(&word2, p+2*CRC_STRIDE+i, 8);
+      crc = _mm_crc32_u64(crc, word0);
+      crc1 = _mm_crc32_u64(crc1, word1);
+      crc2 = _mm_crc32_u64(crc2, word2);
+    }
+    crc = crc_shift((unsigned int)crc, 1)^crc_shift((unsigned int)crc1, 0)^(unsigned int)crc2;
+    p += 3*CRC_STRIDE;
+    length -= 3*CRC_STRIDE;
+  }
+  while(length >= 8){
+    unsigned long long word;
+    memcpy(&word, p, 8);
+    crc = _mm_crc32_u64(crc, word);
+    p += 8;
+    length -= 8;
+  }
+#else
+  unsigned int crc = 0xffffffffu;
+  while(length >= 4){
+    unsigned int word;
+    memcpy(&word, p, 4);
+    crc = _mm_crc32_u32(crc, word);
+    p += 4;
+    length -= 4;
+  }
+#endif
+  unsigned int crc32 = (unsigned int)crc;
+  while(length > 0){
+    crc32 = _mm_crc32_u8(crc32, *p);
+    p++;
+    length--;
+  }
+  return ~crc32;
+}
+#endif
+
+unsigned int crc32c(const void *data, int length){
+  if(!crc_ready){
+    crc_init();
+  }
+#ifdef CRC_X86
+  if(crc_use_hardware){
+    return crc32c_sse42(data, length);
+  }
+#endif
+  return crc32c_portable(data, length);
+}
+
+int crc32c_hardware(){
+  if(!crc_ready){
+    crc_init();
+  }
+  return crc_use_hardware;
+}
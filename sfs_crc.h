@@ -0,0 +1,13 @@
+/*CRC32C (Castagnoli) block checksums. On x86 CPUs with SSE4.2 the crc32 instruction is used,
+everywhere else a slice by 8 table version computes the same value.*/
+#ifndef SFS_CRC_H
+#define SFS_CRC_H
+
+/*CRC32C of length bytes of data, using the fastest version this CPU supports*/
+unsigned int crc32c(const void *data, int length);
+/*Table only version, always available*/
+unsigned int crc32c_portable(const void *data, int length);
+/*1 if crc32c runs on the SSE4.2 instruction*/
+int crc32c_hardware();
+
+#endif
@@ -0,0 +1,576 @@
+#include "sfs_dir.h"
+#include "disk_emu.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <sched.h>
+
+/*Position of the dir_next walk: the leaf being walked and the index of the next entry in it.
+cursor_leaf is -1 when the next call starts a new walk. The leaf is cached in cursor_node
+and kept in step with every write to it, so inserts and removes do not derail the walk.*/
+static int cursor_leaf = -1;
+static int cursor_index = 0;
+static Dir_Node cursor_node;
+
+/*Every name of the tree is also kept in memory in dir_index, an open addressing table keyed by the
+name hash with linear probing, so a lookup reads no block and takes no lock. An entry with inode id 0
+(the root directory, never a file) is an empty slot. Every file has an inode of its own, so there are
+never more names than INODE_COUNT-1, and dir_index has twice as many slots as there are inodes so probes
+stay short and there is always an empty slot to end them. Should the table fill anyway dir_insert fails.
+
+The table is guarded by a sequence lock. Writers, which the volume lock already serializes, make
+index_sequence odd for the length of a change and even again after it. A reader notes an even
+sequence, reads what it needs and starts again if the sequence has moved meanwhile. A slot is stored
+as words that both sides only touch with atomic loads and stores (index_get, index_set), so a reader
+copying a slot while it changes gets a torn copy that the retry throws away, never a data race.*/
+#define DIR_INDEX_SIZE (2*INODE_COUNT)
+#define DIR_INDEX_WORDS (sizeof(Dir_Entry)/sizeof(unsigned int))
+_Static_assert(DIR_INDEX_SIZE > INODE_COUNT, "dir_index must hold every file name and an empty slot");
+_Static_assert(sizeof(Dir_Entry)%sizeof(unsigned int) == 0, "dir_index slots are copied a word at a time");
+static unsigned int dir_index[DIR_INDEX_SIZE][DIR_INDEX_WORDS];
+/*Names in dir_index, only writers use it*/
+static int index_count = 0;
+static atomic_uint index_sequence;
+static int write_depth = 0;
+
+/*FNV-1a hash of a file name*/
+static unsigned int dir_hash(char *name){
+  unsigned int hash = 2166136261u;
+  for(int i=0; name[i]!='\0'; i++){
+    hash ^= (unsigned char)name[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+void dir_write_begin(){
+  if(write_depth++ == 0){
+    atomic_fetch_add_explicit(&index_sequence, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+  }
+}
+
+void dir_write_end(){
+  if(--write_depth == 0){
+    atomic_fetch_add_explicit(&index_sequence, 1, memory_order_release);
+  }
+}
+
+unsigned int dir_read_begin(){
+  unsigned int sequence;
+  while((sequence = atomic_load_explicit(&index_sequence, memory_order_acquire)) & 1){
+    sched_yield();
+  }
+  return sequence;
+}
+
+int dir_read_retry(unsigned int sequence){
+  atomic_thread_fence(memory_order_acquire);
+  return atomic_load_explicit(&index_sequence, memory_order_relaxed) != sequence;
+}
+
+/*Copy slot of dir_index into entry*/
+static void index_get(int slot, Dir_Entry *entry){
+  unsigned int words[DIR_INDEX_WORDS];
+  for(size_t i=0; i<DIR_INDEX_WORDS; i++){
+    words[i] = __atomic_load_n(&dir_index[slot][i], __ATOMIC_RELAXED);
+  }
+  memcpy(entry, words, sizeof(Dir_Entry));
+}
+
+/*Store entry in slot of dir_index, inside a write section. NULL empties the slot.*/
+static void index_set(int slot, Dir_Entry *entry){
+  unsigned int words[DIR_INDEX_WORDS];
+  if(entry){
+    memcpy(words, entry, sizeof(Dir_Entry));
+  }else{
+    memset(words, 0, sizeof(words));
+  }
+  for(size_t i=0; i<DIR_INDEX_WORDS; i++){
+    __atomic_store_n(&dir_index[slot][i], words[i], __ATOMIC_RELAXED);
+  }
+}
+
+/*Empty every slot of dir_index, inside a write section*/
+static void index_clear(){
+  for(int slot=0; slot<DIR_INDEX_SIZE; slot++){
+    index_set(slot, NULL);
+  }
+  index_count = 0;
+}
+
+/*Slot of name in dir_index with its entry copied into entry, or -1.
+Run by readers, what it returns is only good if the read section holds.*/
+static int index_find(char *name, unsigned int hash, Dir_Entry *entry){
+  int slot = hash%DIR_INDEX_SIZE;
+  for(int probes=0; probes<DIR_INDEX_SIZE; probes++){
+    /*Only a slot with the same hash is copied whole, the others end the probe or are passed*/
+    unsigned int slot_hash = __atomic_load_n(&dir_index[slot][offsetof(Dir_Entry, hash)/sizeof(unsigned int)], __ATOMIC_RELAXED);
+    if(slot_hash == hash){
+      index_get(slot, entry);
+      if(entry->inode_id != 0 && strncmp(entry->filename, name, DIR_NAME_LENGTH) == 0){
+        return slot;
+      }
+    }
+    if(__atomic_load_n(&dir_index[slot][offsetof(Dir_Entry, inode_id)/sizeof(unsigned int)], __ATOMIC_RELAXED) == 0){
+      return -1;
+    }
+    slot = (slot+1)%DIR_INDEX_SIZE;
+  }
+  return -1;
+}
+
+/*Add entry to dir_index, inside a write section. Returns -1 if it is full.*/
+static int index_add(Dir_Entry *entry){
+  if(index_count >= DIR_INDEX_SIZE-1){
+    return -1;
+  }
+  Dir_Entry slot_entry;
+  int slot = entry->hash%DIR_INDEX_SIZE;
+  for(int probes=0; probes<DIR_INDEX_SIZE; probes++){
+    index_get(slot, &slot_entry);
+    if(slot_entry.inode_id == 0){
+      index_set(slot, entry);
+      index_count++;
+      return 0;
+    }
+    slot = (slot+1)%DIR_INDEX_SIZE;
+  }
+  return -1;
+}
+
+/*Empty slot of dir_index, inside a write section. The entries after it in the probe run move back
+into the hole when their home slot allows it, so no tombstones are left to lengthen later probes.*/
+static void index_delete(int slot){
+  Dir_Entry next_entry;
+  int hole = slot;
+  for(int next = (slot+1)%DIR_INDEX_SIZE; next != slot; next = (next+1)%DIR_INDEX_SIZE){
+    index_get(next, &next_entry);
+    if(next_entry.inode_id == 0){
+      break;
+    }
+    int home = next_entry.hash%DIR_INDEX_SIZE;
+    if((next-home+DIR_INDEX_SIZE)%DIR_INDEX_SIZE >= (next-hole+DIR_INDEX_SIZE)%DIR_INDEX_SIZE){
+      index_set(hole, &next_entry);
+      hole = next;
+    }
+  }
+  index_set(hole, NULL);
+  index_count--;
+}
+
+/*A node that fails its checksum is counted by read_block and used as read*/
+static void read_node(int block, Dir_Node *node){
+  read_block(block, node);
+}
+
+static void write_node(int block, Dir_Node *node){
+  write_meta_block(block, node);
+  if(block == cursor_leaf){
+    memcpy(&cursor_node, node, sizeof(Dir_Node));
+  }
+}
+
+/*Index of the child of an internal node to descend into for hash*/
+static int child_index(Dir_Node *node, unsigned int hash){
+  int low = 0;
+  int high = node->key_count;
+  while(low < high){
+    int mid = (low+high)/2;
+    if(hash <= node->keys[mid]){
+      high = mid;
+    }else{
+      low = mid+1;
+    }
+  }
+  return low;
+}
+
+/*Index of the first leaf entry with a hash >= hash, or > hash when after_equal is set*/
+static int entry_index(Dir_Node *node, unsigned int hash, int after_equal){
+  int low = 0;
+  int high = node->key_count;
+  while(low < high){
+    int mid = (low+high)/2;
+    if(node->entries[mid].hash < hash || (after_equal && node->entries[mid].hash == hash)){
+      low = mid+1;
+    }else{
+      high = mid;
+    }
+  }
+  return low;
+}
+
+/*Find name in the tree. Returns the entry index with the leaf read into node and its block
+in *leaf_block, or -1. Entries with an equal hash can run on into the following leaves.*/
+static int find_entry(char *name, Dir_Node *node, int *leaf_block){
+  unsigned int hash = dir_hash(name);
+  int block = DIRECTORY_START;
+
+  read_node(block, node);
+  while(!node->is_leaf){
+    block = node->children[child_index(node, hash)];
+    read_node(block, node);
+  }
+
+  int i = entry_index(node, hash, 0);
+  while(1){
+    for(; i<node->key_count; i++){
+      if(node->entries[i].hash != hash){
+        return -1;
+      }
+      if(strncmp(node->entries[i].filename, name, DIR_NAME_LENGTH)==0){
+        *leaf_block = block;
+        return i;
+      }
+    }
+    if(node->next_leaf == -1){
+      return -1;
+    }
+    block = node->next_leaf;
+    read_node(block, node);
+    i = 0;
+  }
+}
+
+/*Turn the root block into an internal node with a single separator over two children*/
+static void write_root(unsigned int separator, int left_block, int right_block){
+  Dir_Node root;
+  memset(&root, 0, sizeof(Dir_Node));
+  root.is_leaf = 0;
+  root.key_count = 1;
+  root.next_leaf = -1;
+  root.keys[0] = separator;
+  root.children[0] = left_block;
+  root.children[1] = right_block;
+  write_node(DIRECTORY_START, &root);
+}
+
+void dir_format(){
+  Dir_Node root;
+  memset(&root, 0, sizeof(Dir_Node));
+  root.is_leaf = 1;
+  root.key_count = 0;
+  root.next_leaf = -1;
+
+  cursor_leaf = -1;
+  cursor_index = 0;
+  write_node(DIRECTORY_START, &root);
+
+  dir_write_begin();
+  index_clear();
+  dir_write_end();
+}
+
+/*Fill dir_index from the leaves of the tree. A tree never holds more names than there are inodes,
+so every name fits; a damaged one with more is reported, the names past the limit are left for fsck.*/
+void dir_mount(){
+  cursor_leaf = -1;
+  cursor_index = 0;
+
+  Dir_Entry *entries = malloc(DIR_INDEX_SIZE*sizeof(Dir_Entry));
+  int count = dir_list(entries, DIR_INDEX_SIZE);
+  dir_write_begin();
+  index_clear();
+  for(int i=0; i<count; i++){
+    if(index_add(&entries[i]) == -1){
+      printf("Directory holds more names than the volume has inodes, some are left out\n");
+      break;
+    }
+  }
+  dir_write_end();
+  free(entries);
+}
+
+int dir_lookup(char *name){
+  unsigned int hash = dir_hash(name);
+  unsigned int sequence;
+  int inode_id;
+  do{
+    sequence = dir_read_begin();
+    Dir_Entry entry;
+    int slot = index_find(name, hash, &entry);
+    inode_id = slot == -1 ? -1 : entry.inode_id;
+  }while(dir_read_retry(sequence));
+  return inode_id;
+}
+
+/*Insert touches one node per level. A full node is split in half and its separator is pushed
+into the parent. When the split reaches the root both halves move to new blocks and the root
+block is rewritten as their parent, so the root never leaves DIRECTORY_START.*/
+static int tree_insert(Dir_Entry entry){
+  /*Descend to the leaf, remembering the path and which nodes on it are full*/
+  int path[DIR_MAX_DEPTH];
+  int slots[DIR_MAX_DEPTH];
+  int full[DIR_MAX_DEPTH];
+  int depth = 0;
+  Dir_Node node;
+  int block = DIRECTORY_START;
+
+  read_node(block, &node);
+  while(!node.is_leaf){
+    if(depth == DIR_MAX_DEPTH){
+      return -1;
+    }
+    path[depth] = block;
+    slots[depth] = child_index(&node, entry.hash);
+    full[depth] = node.key_count == DIR_INTERNAL_CAPACITY;
+    block = node.children[slots[depth]];
+    depth++;
+    read_node(block, &node);
+  }
+
+  /*Take every block the splits will need up front so a full disk leaves the tree untouched*/
+  int needed = 0;
+  if(node.key_count == DIR_LEAF_CAPACITY){
+    needed = 1;
+    int d = depth-1;
+    while(d>=0 && full[d]){
+      needed++;
+      d--;
+    }
+    /*The split reaches the root, which needs a second new block*/
+    if(d<0){
+      needed++;
+    }
+  }
+
+  int spare[DIR_MAX_DEPTH+2];
+  int spare_used = 0;
+  for(int i=0; i<needed; i++){
+    spare[i] = allocate_block();
+    if(spare[i] == -1){
+      for(int j=0; j<i; j++){
+        release_block(spare[j]);
+      }
+      return -1;
+    }
+  }
+
+  int pos = entry_index(&node, entry.hash, 1);
+
+  /*Room in the leaf*/
+  if(node.key_count < DIR_LEAF_CAPACITY){
+    memmove(&node.entries[pos+1], &node.entries[pos], (node.key_count-pos)*sizeof(Dir_Entry));
+    node.entries[pos] = entry;
+    node.key_count++;
+    if(block == cursor_leaf && pos < cursor_index){
+      cursor_index++;
+    }
+    write_node(block, &node);
+    return 0;
+  }
+
+  /*Leaf is full, split it in two around the middle*/
+  Dir_Entry all[DIR_LEAF_CAPACITY+1];
+  memcpy(all, node.entries, pos*sizeof(Dir_Entry));
+  all[pos] = entry;
+  memcpy(all+pos+1, node.entries+pos, (DIR_LEAF_CAPACITY-pos)*sizeof(Dir_Entry));
+
+  int left_count = (DIR_LEAF_CAPACITY+1)/2;
+  int right_count = DIR_LEAF_CAPACITY+1-left_count;
+  int left_block = block;
+  if(depth == 0){
+    left_block = spare[spare_used++];
+  }
+  int right_block = spare[spare_used++];
+
+  Dir_Node right;
+  memset(&right, 0, sizeof(Dir_Node));
+  right.is_leaf = 1;
+  right.key_count = right_count;
+  right.next_leaf = node.next_leaf;
+  memcpy(right.entries, all+left_count, right_count*sizeof(Dir_Entry));
+
+  memset(node.entries, 0, sizeof(node.entries));
+  memcpy(node.entries, all, left_count*sizeof(Dir_Entry));
+  node.key_count = left_count;
+  node.next_leaf = right_block;
+
+  /*Keep the walk on the entry it was about to return*/
+  if(block == cursor_leaf){
+    int index = cursor_index + (pos < cursor_index);
+    if(index >= left_count){
+      cursor_leaf = right_block;
+      cursor_index = index-left_count;
+    }else{
+      cursor_leaf = left_block;
+      cursor_index = index;
+    }
+  }
+
+  write_node(right_block, &right);
+  write_node(left_block, &node);
+
+  unsigned int separator = right.entries[0].hash;
+  int new_child = right_block;
+
+  if(depth == 0){
+    write_root(separator, left_block, right_block);
+    return 0;
+  }
+
+  /*Push the separator up until a node has room for it*/
+  for(int d=depth-1; d>=0; d--){
+    read_node(path[d], &node);
+    int i = slots[d];
+
+    if(node.key_count < DIR_INTERNAL_CAPACITY){
+      memmove(&node.keys[i+1], &node.keys[i], (node.key_count-i)*sizeof(unsigned int));
+      memmove(&node.children[i+2], &node.children[i+1], (node.key_count-i)*sizeof(int));
+      node.keys[i] = separator;
+      node.children[i+1] = new_child;
+      node.key_count++;
+      write_node(path[d], &node);
+      return 0;
+    }
+
+    unsigned int keys[DIR_INTERNAL_CAPACITY+1];
+    int children[DIR_INTERNAL_CAPACITY+2];
+    memcpy(keys, node.keys, i*sizeof(unsigned int));
+    keys[i] = separator;
+    memcpy(keys+i+1, node.keys+i, (DIR_INTERNAL_CAPACITY-i)*sizeof(unsigned int));
+    memcpy(children, node.children, (i+1)*sizeof(int));
+    children[i+1] = new_child;
+    memcpy(children+i+2, node.children+i+1, (DIR_INTERNAL_CAPACITY-i)*sizeof(int));
+
+    /*keys[mid] moves up, the keys on either side of it stay in the two halves*/
+    int mid = (DIR_INTERNAL_CAPACITY+1)/2;
+    left_block = path[d];
+    if(d == 0){
+      left_block = spare[spare_used++];
+    }
+    right_block = spare[spare_used++];
+
+    memset(&right, 0, sizeof(Dir_Node));
+    right.is_leaf = 0;
+    right.next_leaf = -1;
+    right.key_count = DIR_INTERNAL_CAPACITY-mid;
+    memcpy(right.keys, keys+mid+1, right.key_count*sizeof(unsigned int));
+    memcpy(right.children, children+mid+1, (right.key_count+1)*sizeof(int));
+
+    memset(&node, 0, sizeof(Dir_Node));
+    node.is_leaf = 0;
+    node.next_leaf = -1;
+    node.key_count = mid;
+    memcpy(node.keys, keys, mid*sizeof(unsigned int));
+    memcpy(node.children, children, (mid+1)*sizeof(int));
+
+    write_node(right_block, &right);
+    write_node(left_block, &node);
+
+    separator = keys[mid];
+    new_child = right_block;
+
+    if(d == 0){
+      write_root(separator, left_block, right_block);
+    }
+  }
+
+  return 0;
+}
+
+int dir_insert(char *name, int inode_id){
+  if(strlen(name) >= DIR_NAME_LENGTH){
+    return -1;
+  }
+
+  Dir_Entry entry;
+  memset(&entry, 0, sizeof(Dir_Entry));
+  entry.hash = dir_hash(name);
+  entry.inode_id = inode_id;
+  strcpy(entry.filename, name);
+
+  /*Only writers change index_count, so the room checked here is still there below*/
+  if(index_count >= DIR_INDEX_SIZE-1 || tree_insert(entry) == -1){
+    return -1;
+  }
+  /*The name is visible to lookups once it is on disk*/
+  dir_write_begin();
+  index_add(&entry);
+  dir_write_end();
+  return 0;
+}
+
+/*Remove only rewrites the leaf holding the entry. Leaves are not merged, an emptied leaf
+stays in the chain and takes later inserts that hash into its range.*/
+int dir_remove(char *name){
+  Dir_Node node;
+  int block;
+  int i = find_entry(name, &node, &block);
+  if(i == -1){
+    return -1;
+  }
+
+  int inode_id = node.entries[i].inode_id;
+  memmove(&node.entries[i], &node.entries[i+1], (node.key_count-i-1)*sizeof(Dir_Entry));
+  node.key_count--;
+  memset(&node.entries[node.key_count], 0, sizeof(Dir_Entry));
+
+  if(block == cursor_leaf && i < cursor_index){
+    cursor_index--;
+  }
+  write_node(block, &node);
+
+  dir_write_begin();
+  Dir_Entry entry;
+  int slot = index_find(name, dir_hash(name), &entry);
+  if(slot != -1){
+    index_delete(slot);
+  }
+  dir_write_end();
+
+  return inode_id;
+}
+
+int dir_list(Dir_Entry *entries, int max){
+  Dir_Node node;
+  int block = DIRECTORY_START;
+  read_node(block, &node);
+  while(!node.is_leaf){
+    block = node.children[0];
+    read_node(block, &node);
+  }
+
+  int count = 0;
+  while(1){
+    for(int i=0; i<node.key_count && count<max; i++){
+      entries[count++] = node.entries[i];
+    }
+    if(node.next_leaf == -1 || count >= max){
+      return count;
+    }
+    read_node(node.next_leaf, &node);
+  }
+}
+
+int dir_next(char *fname){
+  if(cursor_leaf == -1){
+    /*Start a new walk at the leftmost leaf*/
+    int block = DIRECTORY_START;
+    read_node(block, &cursor_node);
+    while(!cursor_node.is_leaf){
+      block = cursor_node.children[0];
+      read_node(block, &cursor_node);
+    }
+    cursor_leaf = block;
+    cursor_index = 0;
+  }
+
+  while(cursor_index >= cursor_node.key_count){
+    if(cursor_node.next_leaf == -1){
+      cursor_leaf = -1;
+      cursor_index = 0;
+      return 0;
+    }
+    cursor_leaf = cursor_node.next_leaf;
+    cursor_index = 0;
+    read_node(cursor_leaf, &cursor_node);
+  }
+
+  strcpy(fname, cursor_node.entries[cursor_index].filename);
+  cursor_index++;
+  return 1;
+}
@@ -0,0 +1,70 @@
+/*Root directory stored as a B+tree of directory blocks keyed by the hash of the file name.
+
+Every node is one block. Leaves hold the directory entries sorted by hash and are chained
+left to right so the directory can be walked in order. Internal nodes hold separator hashes
+and child block numbers. The root node always stays in DIRECTORY_START, the other nodes
+are taken from the bit map as the tree grows.*/
+#ifndef SFS_DIR_H
+#define SFS_DIR_H
+
+#include "sfs_layout.h"
+
+#define DIR_MAX_DEPTH 16
+
+#define DIR_HEADER_SIZE (4*sizeof(int))
+#define DIR_LEAF_CAPACITY ((int)((BLOCK_SIZE-DIR_HEADER_SIZE)/sizeof(Dir_Entry)))
+#define DIR_INTERNAL_CAPACITY ((int)((BLOCK_SIZE-DIR_HEADER_SIZE-sizeof(int))/(2*sizeof(int))))
+
+/*DIRECTORY NODE STRUCT
+Leaf: key_count entries, next_leaf is the block of the next leaf or -1.
+Internal: key_count keys and key_count+1 children. Child i holds hashes between keys[i-1]
+and keys[i] inclusive, equal hashes may sit on both sides of a separator.*/
+typedef struct Dir_Node{
+  int is_leaf;
+  int key_count;
+  int next_leaf;
+  int unused;
+  union{
+    Dir_Entry entries[DIR_LEAF_CAPACITY];
+    struct{
+      unsigned int keys[DIR_INTERNAL_CAPACITY];
+      int children[DIR_INTERNAL_CAPACITY+1];
+    };
+    /*Pads the node to exactly one block*/
+    char raw[BLOCK_SIZE-DIR_HEADER_SIZE];
+  };
+}Dir_Node;
+
+/*Block allocation and checksummed block I/O provided by sfs_api.c*/
+int allocate_block();
+void release_block(int block);
+int read_block(int block, void *buffer);
+void write_meta_block(int block, void *buffer);
+
+/*Write an empty directory to the root node block*/
+void dir_format();
+/*Reset in memory directory state after the disk is (re)opened*/
+void dir_mount();
+/*Return the inode id of file name, -1 if it is not in the directory.
+It takes no lock and reads no block, any number of threads can look names up while a writer works.*/
+int dir_lookup(char *name);
+/*Add name -> inode_id, returns 0 or -1 if there is no block left to grow the tree*/
+int dir_insert(char *name, int inode_id);
+/*Remove name from the directory, returns its inode id or -1 if it was not found*/
+int dir_remove(char *name);
+/*Sequence lock over the names. Writers (sfs_create, sfs_remove and the mount, all under the volume lock)
+bracket a change with dir_write_begin and dir_write_end, which nest. A reader that needs more than one
+lookup to agree, or a lookup and what it found, takes dir_read_begin before and repeats everything while
+dir_read_retry says a writer ran meanwhile. A writer must not read inside its own write section.*/
+void dir_write_begin();
+void dir_write_end();
+unsigned int dir_read_begin();
+int dir_read_retry(unsigned int sequence);
+/*Copy at most max entries into entries in hash order without touching the dir_next walk,
+returns the number copied*/
+int dir_list(Dir_Entry *entries, int max);
+/*Copy the next file name of the in order walk into fname and return 1,
+return 0 and restart the walk once every name has been returned*/
+int dir_next(char *fname);
+
+#endif
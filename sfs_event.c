@@ -0,0 +1,293 @@
+#include "sfs_event.h"
+
+#ifndef SFS_EVENTS
+
+int sfs_events_dump(char *path, int format){
+  (void)path;
+  (void)format;
+  return -1;
+}
+
+#else
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/*Every thread gets a ring the first time it records. A thread only ever writes its own ring: it fills
+the slot at head, then publishes it by storing the slot's sequence number (its position plus one),
+having cleared it first, so a dump that copies a slot while it is being overwritten sees the sequence
+change and leaves the slot out. When a thread ends its ring goes back to a free list and the next new
+thread carries on in it under the same tid, which keeps the per request threads of a striped disk from
+piling up rings and gives Chrome one lane per ring.
+
+Binary format: the 8 byte magic and a version byte, then
+  names     a varint count, then a length byte and the characters of each name
+  events    a varint count, then for each event, oldest first
+              phase, category   1 byte each
+              name, tid         varints, name is an index in the names
+              time, a, b        zigzag varints, time is the distance in nanoseconds from the previous event
+Varints are 7 bits per byte low bits first, the top bit continues, as in the workload trace.*/
+#define EVENT_RING_SIZE 8192
+#define EVENT_MAGIC "SFSEVENT"
+#define EVENT_VERSION 1
+
+typedef struct Event{
+  atomic_ullong sequence;
+  long long time;
+  const char *name;
+  long long a;
+  long long b;
+  char phase;
+  char category;
+}Event;
+
+typedef struct Event_Ring{
+  Event events[EVENT_RING_SIZE];
+  /*Events ever recorded in this ring, only its thread writes it*/
+  atomic_ullong head;
+  int tid;
+  int in_use;
+  struct Event_Ring *next;
+}Event_Ring;
+
+/*An event copied out of a ring by a dump*/
+typedef struct Event_Copy{
+  long long time;
+  const char *name;
+  long long a;
+  long long b;
+  int tid;
+  char phase;
+  char category;
+}Event_Copy;
+
+/*Argument names of each category, for begin and instant events and then for end events*/
+static const char *event_arg_names[EVENT_CATEGORY_COUNT][2][2] = {
+  {{"fd", "arg"}, {"fd", "result"}},
+  {{"block", "blocks"}, {"block", "result"}},
+  {{"block", "blocks"}, {"block", "blocks"}},
+  {{"id", "blocks"}, {"id", "blocks"}}};
+static const char *event_category_names[EVENT_CATEGORY_COUNT] = {"call", "io", "flush", "evict"};
+
+static _Thread_local Event_Ring *thread_ring = NULL;
+/*Every ring ever made, rings are never freed so a dump can walk the list while threads come and go*/
+static Event_Ring *rings = NULL;
+static int ring_count = 0;
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ring_key;
+static pthread_once_t event_once = PTHREAD_ONCE_INIT;
+
+static long long now_ns(){
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (long long)t.tv_sec*1000000000LL + t.tv_nsec;
+}
+
+static void dump_from_environment(){
+  sfs_events_dump(getenv("SFS_EVENTS"), SFS_EVENTS_CHROME);
+}
+
+/*Called when a thread that recorded ends, its ring is free for the next thread*/
+static void release_ring(void *ring){
+  pthread_mutex_lock(&ring_lock);
+  ((Event_Ring*)ring)->in_use = 0;
+  pthread_mutex_unlock(&ring_lock);
+}
+
+static void init_events(){
+  pthread_key_create(&ring_key, release_ring);
+  if(getenv("SFS_EVENTS")){
+    atexit(dump_from_environment);
+  }
+}
+
+/*Ring of the calling thread, taken from the free ones or made on its first event*/
+static Event_Ring *get_ring(){
+  pthread_once(&event_once, init_events);
+  pthread_mutex_lock(&ring_lock);
+  Event_Ring *ring = rings;
+  while(ring && ring->in_use){
+    ring = ring->next;
+  }
+  if(!ring){
+    ring = calloc(1, sizeof(Event_Ring));
+    if(!ring){
+      pthread_mutex_unlock(&ring_lock);
+      return NULL;
+    }
+    ring->tid = ++ring_count;
+    ring->next = rings;
+    rings = ring;
+  }
+  ring->in_use = 1;
+  pthread_mutex_unlock(&ring_lock);
+  pthread_setspecific(ring_key, ring);
+  return ring;
+}
+
+void event_record(int phase, int category, const char *name, long long a, long long b){
+  Event_Ring *ring = thread_ring;
+  if(!ring){
+    ring = thread_ring = get_ring();
+    if(!ring){
+      return;
+    }
+  }
+  unsigned long long position = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  Event *event = &ring->events[position%EVENT_RING_SIZE];
+  atomic_store_explicit(&event->sequence, 0, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  event->time = now_ns();
+  event->name = name;
+  event->a = a;
+  event->b = b;
+  event->phase = phase;
+  event->category = category;
+  atomic_store_explicit(&event->sequence, position+1, memory_order_release);
+  atomic_store_explicit(&ring->head, position+1, memory_order_release);
+}
+
+static int compare_time(const void *x, const void *y){
+  long long a = ((const Event_Copy*)x)->time;
+  long long b = ((const Event_Copy*)y)->time;
+  return (a > b) - (a < b);
+}
+
+/*Copy the events of every ring, sorted by time. Returns the count, or -1 if out of memory.*/
+static int collect_events(Event_Copy **events){
+  pthread_mutex_lock(&ring_lock);
+  Event_Ring *first = rings;
+  int capacity = ring_count*EVENT_RING_SIZE;
+  pthread_mutex_unlock(&ring_lock);
+
+  *events = malloc((capacity > 0 ? capacity : 1)*sizeof(Event_Copy));
+  if(!*events){
+    return -1;
+  }
+  int count = 0;
+  /*Rings are pushed at the front, the ones made after the count above are left out*/
+  for(Event_Ring *ring = first; ring; ring = ring->next){
+    unsigned long long head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    unsigned long long position = head > EVENT_RING_SIZE ? head-EVENT_RING_SIZE : 0;
+    for(; position < head; position++){
+      Event *event = &ring->events[position%EVENT_RING_SIZE];
+      Event_Copy *copy = &(*events)[count];
+      if(atomic_load_explicit(&event->sequence, memory_order_acquire) != position+1){
+        continue;
+      }
+      copy->time = event->time;
+      copy->name = event->name;
+      copy->a = event->a;
+      copy->b = event->b;
+      copy->phase = event->phase;
+      copy->category = event->category;
+      copy->tid = ring->tid;
+      atomic_thread_fence(memory_order_acquire);
+      if(atomic_load_explicit(&event->sequence, memory_order_relaxed) == position+1){
+        count++;
+      }
+    }
+  }
+  qsort(*events, count, sizeof(Event_Copy), compare_time);
+  return count;
+}
+
+static void put_varint(FILE *file, unsigned long long value){
+  while(value >= 0x80){
+    putc((int)(value & 0x7f) | 0x80, file);
+    value >>= 7;
+  }
+  putc((int)value, file);
+}
+
+static void put_zigzag(FILE *file, long long value){
+  put_varint(file, ((unsigned long long)value << 1) ^ (unsigned long long)(value >> 63));
+}
+
+static void write_chrome(FILE *file, Event_Copy *events, int count){
+  fprintf(file, "{\"traceEvents\":[\n");
+  pthread_mutex_lock(&ring_lock);
+  int threads = ring_count;
+  pthread_mutex_unlock(&ring_lock);
+  for(int tid=1; tid<=threads; tid++){
+    fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"sfs thread %d\"}}%s\n",
+      tid, tid, tid < threads || count > 0 ? "," : "");
+  }
+  long long origin = count > 0 ? events[0].time : 0;
+  for(int i=0; i<count; i++){
+    Event_Copy *event = &events[i];
+    const char **args = event_arg_names[(int)event->category][event->phase == EVENT_PHASE_END];
+    fprintf(file, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,%s\"args\":{\"%s\":%lld,\"%s\":%lld}}%s\n",
+      event->name, event_category_names[(int)event->category], event->phase, (event->time-origin)/1e3, event->tid,
+      event->phase == EVENT_PHASE_INSTANT ? "\"s\":\"t\"," : "", args[0], event->a, args[1], event->b, i+1 < count ? "," : "");
+  }
+  fprintf(file, "],\"displayTimeUnit\":\"ns\"}\n");
+}
+
+static void write_binary(FILE *file, Event_Copy *events, int count){
+  fwrite(EVENT_MAGIC, 1, 8, file);
+  putc(EVENT_VERSION, file);
+
+  /*The names are a handful of literals, a linear search finds their index*/
+  const char **names = malloc((count > 0 ? count : 1)*sizeof(char*));
+  int *index = malloc((count > 0 ? count : 1)*sizeof(int));
+  int name_count = 0;
+  for(int i=0; i<count; i++){
+    int n = 0;
+    while(n < name_count && names[n] != events[i].name && strcmp(names[n], events[i].name) != 0){
+      n++;
+    }
+    if(n == name_count){
+      names[name_count++] = events[i].name;
+    }
+    index[i] = n;
+  }
+  put_varint(file, name_count);
+  for(int n=0; n<name_count; n++){
+    int length = strnlen(names[n], 255);
+    putc(length, file);
+    fwrite(names[n], 1, length, file);
+  }
+
+  put_varint(file, count);
+  long long last = count > 0 ? events[0].time : 0;
+  for(int i=0; i<count; i++){
+    putc(events[i].phase, file);
+    putc(events[i].category, file);
+    put_varint(file, index[i]);
+    put_varint(file, events[i].tid);
+    put_zigzag(file, events[i].time-last);
+    put_zigzag(file, events[i].a);
+    put_zigzag(file, events[i].b);
+    last = events[i].time;
+  }
+  free(index);
+  free(names);
+}
+
+int sfs_events_dump(char *path, int format){
+  FILE *file = fopen(path, "wb");
+  if(!file){
+    return -1;
+  }
+  Event_Copy *events;
+  int count = collect_events(&events);
+  if(count == -1){
+    fclose(file);
+    return -1;
+  }
+  if(format == SFS_EVENTS_BINARY){
+    write_binary(file, events, count);
+  }else{
+    write_chrome(file, events, count);
+  }
+  free(events);
+  fclose(file);
+  return count;
+}
+
+#endif
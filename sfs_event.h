@@ -0,0 +1,48 @@
+/*Event tracer. Where the workload trace (sfs_trace.h) keeps one record per call, this keeps what
+happens inside the calls: the start and end of every sfs_* call, of every block transfer the disk
+is asked for and of every device run it turns into, the metadata flushes and the drops from the
+in memory caches, each with a nanosecond timestamp, so the time of one slow call can be taken apart.
+
+It is compiled in only when SFS_EVENTS is defined (make <target> EVENTS=1), otherwise the EVENT_*
+macros are empty and their arguments are not even evaluated. Each thread writes to a ring of its own
+without taking a lock, and once the ring is full the oldest events are overwritten. sfs_events_dump
+writes what the rings hold as Chrome trace JSON (chrome://tracing or Perfetto) or in a compact binary
+form, and the SFS_EVENTS environment variable names a JSON file that is written when the program exits.*/
+#ifndef SFS_EVENT_H
+#define SFS_EVENT_H
+
+/*Formats of sfs_events_dump*/
+#define SFS_EVENTS_CHROME 0
+#define SFS_EVENTS_BINARY 1
+
+/*Kinds of events, they name the two arguments of an event. A call begins with its fd and the length of
+a read or write (the offset of a seek) and ends with its result, a transfer with its first block and
+block count, a flush with the blocks it wrote and an eviction with what was dropped.*/
+#define EVENT_CALL 0
+#define EVENT_IO 1
+#define EVENT_FLUSH 2
+#define EVENT_EVICT 3
+#define EVENT_CATEGORY_COUNT 4
+
+#define EVENT_PHASE_BEGIN 'B'
+#define EVENT_PHASE_END 'E'
+#define EVENT_PHASE_INSTANT 'i'
+
+/*Write the events held by every thread's ring to path, oldest first.
+Returns the number of events written, or -1 if the file can not be created or the tracer is not compiled in.*/
+int sfs_events_dump(char *path, int format);
+
+#ifdef SFS_EVENTS
+/*Append an event to the ring of the calling thread. name must stay valid until the dump, a literal or __func__.*/
+void event_record(int phase, int category, const char *name, long long a, long long b);
+
+#define EVENT_BEGIN(category, name, a, b) event_record(EVENT_PHASE_BEGIN, category, name, a, b)
+#define EVENT_END(category, name, a, b) event_record(EVENT_PHASE_END, category, name, a, b)
+#define EVENT_INSTANT(category, name, a, b) event_record(EVENT_PHASE_INSTANT, category, name, a, b)
+#else
+#define EVENT_BEGIN(category, name, a, b) ((void)0)
+#define EVENT_END(category, name, a, b) ((void)0)
+#define EVENT_INSTANT(category, name, a, b) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,652 @@
+/* sfs_fsck.c
+ *
+ * Offline consistency checker for a simple file system image.
+ *   sfs_fsck [-r] [-j threads] [image]
+ * The image (file_system by default) is read into memory with large sequential reads split over
+ * the threads, then the threads check the block checksums of their share in parallel. Only after that,
+ * so no repair changes a block under its checksum, they check the inode table and the snapshots of
+ * their share while one of them walks the directory tree. The results are cross checked:
+ *   dangling entries   directory entries naming a free or impossible inode
+ *   orphan inodes      inodes in use that no directory entry names
+ *   leaked blocks      blocks counted in the bit map that nothing references
+ *   double allocations blocks referenced more often than the bit map counts, or by metadata and a file
+ * as well as a bad super block, bad block pointers and sizes, a broken directory tree and blocks
+ * that fail their checksum. With -r what can be fixed is written back to the image: dangling entries
+ * are dropped, orphan inodes and bad pointers are cleared, the leaf chain is relinked and the bit map
+ * counts are set to the references found. Blocks failing their checksum and a broken tree are only
+ * reported. A striped disk can not be checked, a mirrored one is checked one copy at a time.
+ * Images of an older format version are refused, mounting them once upgrades them.
+ * Exits with 0 for a clean image, 1 when every problem was repaired and 4 when problems are left.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "sfs_layout.h"
+#include "sfs_dir.h"
+#include "sfs_crc.h"
+
+#define FSCK_MAX_THREADS 64
+
+/*Kinds of problems*/
+#define PROBLEM_SUPER 0
+#define PROBLEM_CHECKSUM 1
+#define PROBLEM_DIRECTORY 2
+#define PROBLEM_DANGLING 3
+#define PROBLEM_ORPHAN 4
+#define PROBLEM_INODE 5
+#define PROBLEM_LEAKED 6
+#define PROBLEM_DOUBLE 7
+#define PROBLEM_KINDS 8
+
+static const char *problem_names[PROBLEM_KINDS] = {"super block", "checksum", "directory tree",
+  "dangling entry", "orphan inode", "bad inode", "leaked block", "double allocation"};
+
+/*A directory entry found by the walk, with the leaf it sits in*/
+typedef struct Fsck_Entry{
+  int block;
+  int index;
+  int inode_id;
+  int drop;
+}Fsck_Entry;
+
+/*What one thread found. Metadata and file data references are counted apart
+so a block used as both can be told from a shared data block.*/
+typedef struct Fsck_Scan{
+  int id;
+  int meta_refs[MAX_BLOCK];
+  int data_refs[MAX_BLOCK];
+}Fsck_Scan;
+
+static char *image;
+static long long image_size;
+static int image_fd;
+static int thread_count;
+static int repair = 0;
+
+static Super_Node *super_node;
+static Bit_Map_Block *bit_map;
+static I_Node *inodes;
+static int bit_map_valid;
+
+/*Merged references of every block, and the blocks the repair changed*/
+static int meta_refs[MAX_BLOCK];
+static int data_refs[MAX_BLOCK];
+static int dirty[MAX_BLOCK];
+static int bad_checksum[MAX_BLOCK];
+
+/*Directory walk results*/
+static Fsck_Entry entries[MAX_BLOCK*DIR_LEAF_CAPACITY];
+static int entry_count = 0;
+static int leaves[MAX_BLOCK];
+static int leaf_count = 0;
+static int tree_valid = 1;
+
+static int found[PROBLEM_KINDS];
+static int repaired[PROBLEM_KINDS];
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double now_seconds(){
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec/1e9;
+}
+
+/*Print a problem, fixed tells whether the repair took care of it*/
+static void report(int kind, int fixed, const char *format, ...){
+  va_list args;
+  pthread_mutex_lock(&report_lock);
+  found[kind]++;
+  repaired[kind] += fixed;
+  printf("%-18s ", problem_names[kind]);
+  va_start(args, format);
+  vprintf(format, args);
+  va_end(args);
+  printf("%s\n", fixed ? " (repaired)" : "");
+  pthread_mutex_unlock(&report_lock);
+}
+
+/*Note that block has to be written back by the repair*/
+static void mark_dirty(int block){
+  pthread_mutex_lock(&report_lock);
+  dirty[block] = 1;
+  pthread_mutex_unlock(&report_lock);
+}
+
+/*Note that inode inode_id has to be written back, it may straddle two table blocks*/
+static void mark_inode_dirty(int inode_id){
+  mark_dirty(INODE_TABLE_START+(int)(inode_id*sizeof(I_Node)/BLOCK_SIZE));
+  mark_dirty(INODE_TABLE_START+(int)(((inode_id+1)*sizeof(I_Node)-1)/BLOCK_SIZE));
+}
+
+static char *block_at(int block){
+  return image+(long long)block*BLOCK_SIZE;
+}
+
+/*Same FNV-1a hash the directory is keyed by (sfs_dir.c)*/
+static unsigned int name_hash(char *name){
+  unsigned int hash = 2166136261u;
+  for(int i=0; name[i]!='\0'; i++){
+    hash ^= (unsigned char)name[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+/*A block that may hold file data or tree nodes, the fixed blocks never do*/
+static int is_pool_block(int block){
+  return block > BIT_MAP_START && block < MAX_BLOCK;
+}
+
+/*Run scan once per thread, each with its own Fsck_Scan, and add up the references they found*/
+static void run_parallel(void *(*scan)(void*)){
+  pthread_t threads[FSCK_MAX_THREADS];
+  Fsck_Scan *scans = calloc(thread_count, sizeof(Fsck_Scan));
+  for(int t=0; t<thread_count; t++){
+    scans[t].id = t;
+    pthread_create(&threads[t], NULL, scan, &scans[t]);
+  }
+  for(int t=0; t<thread_count; t++){
+    pthread_join(threads[t], NULL);
+    for(int b=0; b<MAX_BLOCK; b++){
+      meta_refs[b] += scans[t].meta_refs[b];
+      data_refs[b] += scans[t].data_refs[b];
+    }
+  }
+  free(scans);
+}
+
+/*Every thread reads one chunk of the image, its share rounded up to whole blocks*/
+static void *read_chunks(void *arg){
+  Fsck_Scan *scan = (Fsck_Scan*) arg;
+  long long blocks = image_size/BLOCK_SIZE;
+  long long chunk = (blocks+thread_count-1)/thread_count*BLOCK_SIZE;
+  long long offset = scan->id*chunk;
+  long long length = image_size-offset < chunk ? image_size-offset : chunk;
+  if(length > 0 && pread(image_fd, image+offset, length, offset) != length){
+    report(PROBLEM_SUPER, 0, "short read at byte %lld", offset);
+  }
+  return NULL;
+}
+
+static int load_image(char *path){
+  struct stat info;
+  image_fd = open(path, repair ? O_RDWR : O_RDONLY);
+  if(image_fd == -1 || fstat(image_fd, &info) == -1){
+    fprintf(stderr, "can not open %s\n", path);
+    return -1;
+  }
+  if(info.st_size < (long long)MAX_BLOCK*BLOCK_SIZE){
+    fprintf(stderr, "%s holds %lld bytes, a volume needs %d\n", path, (long long)info.st_size, MAX_BLOCK*BLOCK_SIZE);
+    return -1;
+  }
+  image_size = (long long)MAX_BLOCK*BLOCK_SIZE;
+  image = malloc(image_size);
+  run_parallel(read_chunks);
+
+  super_node = (Super_Node*) block_at(SUPER_BLOCK);
+  inodes = (I_Node*) block_at(INODE_TABLE_START);
+  bit_map = (Bit_Map_Block*) block_at(BIT_MAP_START);
+  bit_map_valid = crc32c(bit_map, offsetof(Bit_Map_Block, self_crc)) == bit_map->self_crc;
+
+  /*Older volumes have their metadata elsewhere, the library upgrades them on mount*/
+  int version = super_node->version == 0 ? 1 : super_node->version;
+  if(super_node->magic_number == 666 && version != SFS_VERSION){
+    fprintf(stderr, "%s is in format version %d, mount it once to upgrade it to version %d\n", path, version, SFS_VERSION);
+    return -1;
+  }
+  return 0;
+}
+
+/*Geometry in the super block and the checksum of the bit map block, which holds every other checksum*/
+static void check_super_node(){
+  if(super_node->magic_number != 666 || super_node->block_size != BLOCK_SIZE ||
+    super_node->block_amount != MAX_BLOCK || super_node->i_node_block_length != INODE_COUNT){
+    report(PROBLEM_SUPER, 0, "magic %d, %d blocks of %d bytes, %d inodes", super_node->magic_number,
+      super_node->block_amount, super_node->block_size, super_node->i_node_block_length);
+  }
+  for(int i=0; i<SNAPSHOT_COUNT; i++){
+    if(super_node->snapshots[i] != -1 && !is_pool_block(super_node->snapshots[i])){
+      report(PROBLEM_SUPER, repair, "snapshot %d has index block %d", i, super_node->snapshots[i]);
+      if(repair){
+        super_node->snapshots[i] = -1;
+        dirty[SUPER_BLOCK] = 1;
+      }
+    }
+  }
+
+  if(!bit_map_valid){
+    /*The repair rebuilds the checksum table from the blocks as they are*/
+    report(PROBLEM_CHECKSUM, repair, "bit map block fails its checksum, no other block can be verified");
+    if(repair){
+      memset(&bit_map->checksums, 0, sizeof(Checksum_Table));
+      dirty[BIT_MAP_START] = 1;
+    }
+  }
+}
+
+/*Count the data blocks of inode in, clearing pointers that can not be right when fix is set.
+Returns the number of bad pointers.*/
+static int count_inode_blocks(Fsck_Scan *scan, I_Node *in, int fix){
+  if(in->flags & INODE_INLINE){
+    return 0;
+  }
+  int bad = 0;
+  for(int j=0; j<DIRECT_POINTERS; j++){
+    int block = in->block_pointers[j];
+    if(block == -1 || (block == BLOCK_COMPRESSED && (in->flags & INODE_COMPRESSED))){
+      continue;
+    }
+    if(!is_pool_block(block)){
+      bad++;
+      if(fix){
+        in->block_pointers[j] = -1;
+      }
+      continue;
+    }
+    scan->data_refs[block]++;
+  }
+  return bad;
+}
+
+/*The stored inodes of this thread's share*/
+static void scan_inodes(Fsck_Scan *scan){
+  for(int i=1+scan->id; i<INODE_COUNT; i+=thread_count){
+    I_Node *in = &inodes[i];
+    if(in->is_free == 1){
+      continue;
+    }
+    /*Nothing of an inode like this can be trusted, the repair frees it*/
+    if(in->is_free != 0 || (in->flags & ~(INODE_INLINE|INODE_COMPRESSED))){
+      report(PROBLEM_INODE, repair, "inode %d has free flag %d and flags %d", i, in->is_free, in->flags);
+      if(repair){
+        memset(in, 0, sizeof(I_Node));
+        in->is_free = 1;
+        memset(in->block_pointers, 0xff, sizeof(in->block_pointers));
+        in->indirect_pointer = -1;
+        mark_inode_dirty(i);
+      }
+      continue;
+    }
+
+    long long limit = (in->flags & INODE_INLINE) ? INODE_INLINE_SIZE : MAX_FILE_SIZE;
+    if(in->size < 0 || in->size > limit){
+      report(PROBLEM_INODE, repair, "inode %d has size %lld, at most %lld fits", i, in->size, limit);
+      if(repair){
+        in->size = in->size < 0 ? 0 : limit;
+        mark_inode_dirty(i);
+      }
+    }
+    int bad = count_inode_blocks(scan, in, repair);
+    if(bad){
+      report(PROBLEM_INODE, repair, "inode %d has %d block pointers outside the data area", i, bad);
+    }
+    if(repair && bad){
+      mark_inode_dirty(i);
+    }
+  }
+}
+
+/*Check the stored checksum of every covered block of this thread's share.
+It runs as a pass of its own before check_super_node and scan_image, whose repairs change blocks in place.*/
+static void *scan_checksums(void *arg){
+  Fsck_Scan *scan = (Fsck_Scan*) arg;
+  if(!bit_map_valid){
+    return NULL;
+  }
+  for(int b=scan->id; b<MAX_BLOCK; b+=thread_count){
+    bad_checksum[b] = b != BIT_MAP_START && bit_map->checksums.covered[b] &&
+      crc32c(block_at(b), BLOCK_SIZE) != bit_map->checksums.crc[b];
+  }
+  return NULL;
+}
+
+/*The index and image blocks of this thread's snapshots and the data blocks their files hold on to*/
+static void scan_snapshots(Fsck_Scan *scan){
+  for(int s=scan->id; s<SNAPSHOT_COUNT; s+=thread_count){
+    int index = super_node->snapshots[s];
+    if(!is_pool_block(index)){
+      continue;
+    }
+    scan->meta_refs[index]++;
+
+    int *blocks = (int*) block_at(index);
+    Snapshot_Image *snapshot = malloc(SNAPSHOT_BLOCKS*BLOCK_SIZE);
+    int valid = 1;
+    for(int i=0; i<SNAPSHOT_BLOCKS; i++){
+      if(!is_pool_block(blocks[i])){
+        report(PROBLEM_DIRECTORY, 0, "snapshot %d lists image block %d", s, blocks[i]);
+        valid = 0;
+        break;
+      }
+      scan->meta_refs[blocks[i]]++;
+      memcpy((char*)snapshot+i*BLOCK_SIZE, block_at(blocks[i]), BLOCK_SIZE);
+    }
+    if(valid && (snapshot->entry_count < 0 || snapshot->entry_count > INODE_COUNT)){
+      report(PROBLEM_DIRECTORY, 0, "snapshot %d holds %d entries", s, snapshot->entry_count);
+      valid = 0;
+    }
+    for(int i=0; valid && i<snapshot->entry_count; i++){
+      int inode_id = snapshot->entries[i].inode_id;
+      if(inode_id <= 0 || inode_id >= INODE_COUNT){
+        report(PROBLEM_DIRECTORY, 0, "snapshot %d names inode %d", s, inode_id);
+        continue;
+      }
+      if(count_inode_blocks(scan, &snapshot->inodes[inode_id], 0)){
+        report(PROBLEM_INODE, 0, "inode %d of snapshot %d has block pointers outside the data area", inode_id, s);
+      }
+    }
+    free(snapshot);
+  }
+}
+
+/*Walk the subtree at block, whose hashes must lie between low and high.
+Leaves are collected left to right and their entries added to entries.*/
+static void walk_node(Fsck_Scan *scan, int block, unsigned int low, unsigned int high, int depth){
+  if(!is_pool_block(block) || depth > DIR_MAX_DEPTH){
+    report(PROBLEM_DIRECTORY, 0, "tree points to block %d at depth %d", block, depth);
+    tree_valid = 0;
+    return;
+  }
+  if(scan->meta_refs[block]){
+    report(PROBLEM_DIRECTORY, 0, "tree reaches block %d twice", block);
+    tree_valid = 0;
+    return;
+  }
+  scan->meta_refs[block]++;
+
+  Dir_Node *node = (Dir_Node*) block_at(block);
+  int capacity = node->is_leaf ? DIR_LEAF_CAPACITY : DIR_INTERNAL_CAPACITY;
+  if((node->is_leaf != 0 && node->is_leaf != 1) || node->key_count < 0 || node->key_count > capacity){
+    report(PROBLEM_DIRECTORY, 0, "block %d is not a tree node", block);
+    tree_valid = 0;
+    return;
+  }
+
+  if(!node->is_leaf){
+    for(int i=0; i<=node->key_count; i++){
+      unsigned int child_low = i == 0 ? low : node->keys[i-1];
+      unsigned int child_high = i == node->key_count ? high : node->keys[i];
+      if(child_low > child_high){
+        report(PROBLEM_DIRECTORY, 0, "keys of block %d are out of order", block);
+        tree_valid = 0;
+        return;
+      }
+      walk_node(scan, node->children[i], child_low, child_high, depth+1);
+    }
+    return;
+  }
+
+  leaves[leaf_count++] = block;
+  unsigned int previous = low;
+  for(int i=0; i<node->key_count; i++){
+    Dir_Entry *entry = &node->entries[i];
+    Fsck_Entry *found_entry = &entries[entry_count++];
+    found_entry->block = block;
+    found_entry->index = i;
+    found_entry->inode_id = entry->inode_id;
+    found_entry->drop = 0;
+
+    if(memchr(entry->filename, '\0', DIR_NAME_LENGTH) == NULL || entry->hash != name_hash(entry->filename)){
+      report(PROBLEM_DANGLING, repair, "entry %d of block %d has a bad name or hash", i, block);
+      found_entry->drop = 1;
+    }else if(entry->hash < previous || entry->hash > high){
+      report(PROBLEM_DANGLING, repair, "%s in block %d is out of hash order", entry->filename, block);
+      found_entry->drop = 1;
+    }else{
+      previous = entry->hash;
+    }
+  }
+}
+
+/*The whole tree from its root, then the chain through the leaves against the order the walk found them in*/
+static void scan_directory(Fsck_Scan *scan){
+  if(inodes[0].is_free != 0 || inodes[0].block_pointers[0] != DIRECTORY_START){
+    report(PROBLEM_INODE, 0, "inode 0 does not hold the root directory");
+  }
+  walk_node(scan, DIRECTORY_START, 0, 0xffffffffu, 0);
+  if(!tree_valid){
+    return;
+  }
+  for(int i=0; i<leaf_count; i++){
+    Dir_Node *leaf = (Dir_Node*) block_at(leaves[i]);
+    int next = i+1 < leaf_count ? leaves[i+1] : -1;
+    if(leaf->next_leaf != next){
+      report(PROBLEM_DIRECTORY, repair, "leaf %d links to %d instead of %d", leaves[i], leaf->next_leaf, next);
+      if(repair){
+        leaf->next_leaf = next;
+        mark_dirty(leaves[i]);
+      }
+    }
+  }
+}
+
+/*Each thread takes its share of the inodes and snapshots, the last one walks the directory*/
+static void *scan_image(void *arg){
+  Fsck_Scan *scan = (Fsck_Scan*) arg;
+  scan_inodes(scan);
+  scan_snapshots(scan);
+  if(scan->id == thread_count-1){
+    scan_directory(scan);
+  }
+  return NULL;
+}
+
+/*Clear an inode that is no longer used and let go of its blocks*/
+static void clear_inode(int inode_id){
+  I_Node *in = &inodes[inode_id];
+  if(!(in->flags & INODE_INLINE)){
+    for(int j=0; j<DIRECT_POINTERS; j++){
+      if(is_pool_block(in->block_pointers[j])){
+        data_refs[in->block_pointers[j]]--;
+      }
+    }
+  }
+  memset(in, 0, sizeof(I_Node));
+  in->is_free = 1;
+  for(int j=0; j<DIRECT_POINTERS; j++){
+    in->block_pointers[j] = -1;
+  }
+  in->indirect_pointer = -1;
+  mark_inode_dirty(inode_id);
+}
+
+/*Directory entries against the inodes they name*/
+static void check_names(){
+  int named[INODE_COUNT] = {0};
+
+  for(int i=0; i<entry_count; i++){
+    Fsck_Entry *entry = &entries[i];
+    if(entry->drop){
+      continue;
+    }
+    int inode_id = entry->inode_id;
+    if(inode_id <= 0 || inode_id >= INODE_COUNT){
+      report(PROBLEM_DANGLING, repair, "entry %d of block %d names inode %d", entry->index, entry->block, inode_id);
+      entry->drop = 1;
+    }else if(named[inode_id]){
+      report(PROBLEM_DANGLING, repair, "entry %d of block %d names inode %d a second time", entry->index, entry->block, inode_id);
+      entry->drop = 1;
+    }else if(inodes[inode_id].is_free){
+      report(PROBLEM_DANGLING, repair, "entry %d of block %d names free inode %d", entry->index, entry->block, inode_id);
+      entry->drop = 1;
+    }else{
+      named[inode_id] = 1;
+    }
+  }
+
+  /*Orphans can only be found while the tree could be walked to the end*/
+  for(int i=1; tree_valid && i<INODE_COUNT; i++){
+    if(inodes[i].is_free == 0 && !named[i]){
+      report(PROBLEM_ORPHAN, repair, "inode %d is in use but has no name", i);
+      if(repair){
+        clear_inode(i);
+      }
+    }
+  }
+}
+
+/*Reference counts in the bit map against the references found*/
+static void check_blocks(){
+  int *bm = bit_map->bm;
+  for(int b=0; b<=BIT_MAP_START; b++){
+    meta_refs[b]++;
+  }
+
+  for(int b=0; b<MAX_BLOCK; b++){
+    /*Metadata that failed its checksum has just passed the structure checks, the repair takes it as it is.
+    File data can not be checked any other way.*/
+    if(bad_checksum[b]){
+      int fixable = repair && meta_refs[b] && !data_refs[b];
+      report(PROBLEM_CHECKSUM, fixable, "block %d does not match its checksum", b);
+      if(fixable){
+        dirty[b] = 1;
+      }
+    }
+
+    /*Metadata is never shared, a file pointing into it loses that pointer*/
+    if(meta_refs[b] && data_refs[b]){
+      report(PROBLEM_DOUBLE, repair, "block %d is metadata and also data of %d files", b, data_refs[b]);
+      if(repair){
+        for(int i=1; i<INODE_COUNT; i++){
+          for(int j=0; !inodes[i].is_free && !(inodes[i].flags & INODE_INLINE) && j<DIRECT_POINTERS; j++){
+            if(inodes[i].block_pointers[j] == b){
+              inodes[i].block_pointers[j] = -1;
+              mark_inode_dirty(i);
+            }
+          }
+        }
+        data_refs[b] = 0;
+      }
+    }
+    if(meta_refs[b] > 1){
+      report(PROBLEM_DOUBLE, 0, "block %d is used %d times as metadata", b, meta_refs[b]);
+    }
+
+    int refs = meta_refs[b]+data_refs[b];
+    if(bm[b] < refs){
+      report(PROBLEM_DOUBLE, repair, "block %d has %d references but a count of %d", b, refs, bm[b]);
+    }else if(bm[b] > refs){
+      report(PROBLEM_LEAKED, repair, "block %d has a count of %d but %d references", b, bm[b], refs);
+    }else{
+      continue;
+    }
+    if(repair){
+      bm[b] = refs;
+      dirty[BIT_MAP_START] = 1;
+    }
+  }
+}
+
+/*Drop the entries marked for it, rewriting each leaf that held one*/
+static void drop_entries(){
+  for(int i=entry_count-1; i>=0; i--){
+    if(!entries[i].drop){
+      continue;
+    }
+    Dir_Node *leaf = (Dir_Node*) block_at(entries[i].block);
+    int index = entries[i].index;
+    memmove(&leaf->entries[index], &leaf->entries[index+1], (leaf->key_count-index-1)*sizeof(Dir_Entry));
+    leaf->key_count--;
+    memset(&leaf->entries[leaf->key_count], 0, sizeof(Dir_Entry));
+    dirty[entries[i].block] = 1;
+  }
+}
+
+/*Write the changed blocks back with fresh checksums, the bit map block that holds them goes last*/
+static int write_repairs(){
+  int written = 0;
+  if(!bit_map_valid){
+    /*Rebuild the checksums of the metadata, data blocks go unchecked until they are written again*/
+    for(int b=0; b<MAX_BLOCK; b++){
+      if(meta_refs[b] && b != BIT_MAP_START){
+        dirty[b] = 1;
+      }
+    }
+  }
+  for(int b=0; b<MAX_BLOCK; b++){
+    if(!dirty[b] || b == BIT_MAP_START){
+      continue;
+    }
+    bit_map->checksums.crc[b] = crc32c(block_at(b), BLOCK_SIZE);
+    bit_map->checksums.covered[b] = 1;
+    dirty[BIT_MAP_START] = 1;
+    written += pwrite(image_fd, block_at(b), BLOCK_SIZE, (long long)b*BLOCK_SIZE) == BLOCK_SIZE;
+  }
+  if(dirty[BIT_MAP_START]){
+    bit_map->self_crc = crc32c(bit_map, offsetof(Bit_Map_Block, self_crc));
+    written += pwrite(image_fd, bit_map, BLOCK_SIZE, (long long)BIT_MAP_START*BLOCK_SIZE) == BLOCK_SIZE;
+  }
+  fsync(image_fd);
+  return written;
+}
+
+int main(int argc, char **argv){
+  char *path = "file_system";
+  thread_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+  for(int i=1; i<argc; i++){
+    if(strcmp(argv[i], "-r") == 0){
+      repair = 1;
+    }else if(strcmp(argv[i], "-j") == 0 && i+1 < argc){
+      thread_count = atoi(argv[++i]);
+    }else if(argv[i][0] == '-'){
+      fprintf(stderr, "usage: %s [-r] [-j threads] [image]\n", argv[0]);
+      return 8;
+    }else{
+      path = argv[i];
+    }
+  }
+  if(thread_count < 1){
+    thread_count = 1;
+  }
+  if(thread_count > FSCK_MAX_THREADS){
+    thread_count = FSCK_MAX_THREADS;
+  }
+
+  double start = now_seconds();
+  if(load_image(path) == -1){
+    return 8;
+  }
+  double read_time = now_seconds()-start;
+
+  run_parallel(scan_checksums);
+  check_super_node();
+  run_parallel(scan_image);
+  check_names();
+  check_blocks();
+
+  int written = 0;
+  if(repair){
+    drop_entries();
+    written = write_repairs();
+  }
+  double elapsed = now_seconds()-start;
+
+  int total = 0;
+  int fixed = 0;
+  for(int k=0; k<PROBLEM_KINDS; k++){
+    total += found[k];
+    fixed += repaired[k];
+  }
+  printf("%s: %d files, %d tree leaves, %d problems", path, entry_count, leaf_count, total);
+  if(repair){
+    printf(", %d repaired in %d block writes", fixed, written);
+  }
+  printf("\n");
+  printf("%d threads, read %.2f MB/s, checked in %.3f s\n", thread_count, image_size/1e6/read_time, elapsed);
+
+  free(image);
+  close(image_fd);
+  if(total == 0){
+    return 0;
+  }
+  return fixed == total ? 1 : 4;
+}
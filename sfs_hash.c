@@ -0,0 +1,90 @@
+#include "sfs_hash.h"
+#include <string.h>
+
+#define PRIME1 11400714785074694791ULL
+#define PRIME2 14029467366897019727ULL
+#define PRIME3 1609587929392839161ULL
+#define PRIME4 9650029242287828579ULL
+#define PRIME5 2870177450012600261ULL
+
+static unsigned long long rotl(unsigned long long x, int r){
+  return (x << r) | (x >> (64-r));
+}
+
+static unsigned long long read64(const unsigned char *p){
+  unsigned long long value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+static unsigned int read32(const unsigned char *p){
+  unsigned int value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+static unsigned long long round64(unsigned long long acc, unsigned long long input){
+  acc += input*PRIME2;
+  acc = rotl(acc, 31);
+  return acc*PRIME1;
+}
+
+static unsigned long long merge64(unsigned long long acc, unsigned long long lane){
+  acc ^= round64(0, lane);
+  return acc*PRIME1+PRIME4;
+}
+
+unsigned long long hash64(const void *data, int length, unsigned long long seed){
+  const unsigned char *p = (const unsigned char*)data;
+  const unsigned char *end = p+length;
+  unsigned long long hash;
+
+  if(length >= 32){
+    /*Four lanes, each takes every fourth 8 byte word*/
+    unsigned long long v1 = seed+PRIME1+PRIME2;
+    unsigned long long v2 = seed+PRIME2;
+    unsigned long long v3 = seed;
+    unsigned long long v4 = seed-PRIME1;
+    const unsigned char *limit = end-32;
+    do{
+      v1 = round64(v1, read64(p));
+      v2 = round64(v2, read64(p+8));
+      v3 = round64(v3, read64(p+16));
+      v4 = round64(v4, read64(p+24));
+      p += 32;
+    }while(p <= limit);
+
+    hash = rotl(v1, 1)+rotl(v2, 7)+rotl(v3, 12)+rotl(v4, 18);
+    hash = merge64(hash, v1);
+    hash = merge64(hash, v2);
+    hash = merge64(hash, v3);
+    hash = merge64(hash, v4);
+  }else{
+    hash = seed+PRIME5;
+  }
+
+  hash += (unsigned long long)length;
+
+  while(p+8 <= end){
+    hash ^= round64(0, read64(p));
+    hash = rotl(hash, 27)*PRIME1+PRIME4;
+    p += 8;
+  }
+  if(p+4 <= end){
+    hash ^= (unsigned long long)read32(p)*PRIME1;
+    hash = rotl(hash, 23)*PRIME2+PRIME3;
+    p += 4;
+  }
+  while(p < end){
+    hash ^= (*p)*PRIME5;
+    hash = rotl(hash, 11)*PRIME1;
+    p++;
+  }
+
+  hash ^= hash >> 33;
+  hash *= PRIME2;
+  hash ^= hash >> 29;
+  hash *= PRIME3;
+  hash ^= hash >> 32;
+  return hash;
+}
@@ -0,0 +1,8 @@
+/*64 bit block fingerprint (XXH64). The bulk loop runs four independent 64 bit lanes,
+which the compiler keeps in registers and overlaps, so hashing runs close to memory speed.*/
+#ifndef SFS_HASH_H
+#define SFS_HASH_H
+
+unsigned long long hash64(const void *data, int length, unsigned long long seed);
+
+#endif
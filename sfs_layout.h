@@ -0,0 +1,158 @@
+/*On disk layout of the simple file system, shared by sfs_api.c and the modules it is built from*/
+#ifndef SFS_LAYOUT_H
+#define SFS_LAYOUT_H
+
+#define BLOCK_SIZE 1024
+#define MAX_BLOCK 100
+#define INODE_COUNT 40
+
+/*Format version written to the super block. A volume of an older version is upgraded when it is mounted.
+Version 1 had 112 byte inodes with an int size, the blocks after SUPER_BLOCK are laid out again.*/
+#define SFS_VERSION 2
+
+/*Fixed blocks at the start of the disk, the inode table takes INODE_TABLE_BLOCKS blocks*/
+#define SUPER_BLOCK 0
+#define INODE_TABLE_START 1
+#define INODE_TABLE_BLOCKS ((int)((INODE_COUNT*sizeof(I_Node)+BLOCK_SIZE-1)/BLOCK_SIZE))
+#define BIT_MAP_START (INODE_TABLE_START+INODE_TABLE_BLOCKS)
+/*Root node of the directory tree, the rest of the tree lives in blocks taken from the bit map*/
+#define DIRECTORY_START (BIT_MAP_START+1)
+
+/*The disk is split into BLOCK_GROUPS allocation groups of GROUP_BLOCKS consecutive blocks.
+Group g also owns inodes g*GROUP_INODES to (g+1)*GROUP_INODES-1 and the data of those files
+is placed in group g first, so a file's blocks stay close together. New files go to the group
+with the most free blocks. The first group starts with the fixed blocks above.
+Only the inode free lists and the free block and free inode counters are kept per group. The bit map
+is the one block at BIT_MAP_START and each group searches its own slice of it. The groups have no
+locks either: every call, allocation included, holds the volume lock (see lock_volume) for its whole
+run, so calls on files of different groups still run one at a time.*/
+#define BLOCK_GROUPS 4
+#define GROUP_BLOCKS (MAX_BLOCK/BLOCK_GROUPS)
+#define GROUP_INODES (INODE_COUNT/BLOCK_GROUPS)
+
+/*Number of block_pointers used to address data blocks*/
+#define DIRECT_POINTERS 12
+/*Largest file, sizes and offsets are 64 bit so only the pointers limit it*/
+#define MAX_FILE_SIZE ((long long)DIRECT_POINTERS*BLOCK_SIZE)
+
+/*Files of at most INODE_INLINE_SIZE bytes keep their data in the pointer area of the inode
+and have no data block. They move to a data block as soon as they grow past it.*/
+#define INODE_INLINE_SIZE ((int)(DIRECT_POINTERS*sizeof(int)))
+
+/*I_Node flags*/
+#define INODE_INLINE 1
+#define INODE_COMPRESSED 2
+
+/*Compressed files are stored in clusters of CLUSTER_BLOCKS consecutive file blocks.
+A cluster that compresses into fewer blocks keeps a Cluster_Header followed by the compressed bytes
+in its first block pointers and sets the pointers it no longer needs to BLOCK_COMPRESSED.
+A cluster that does not shrink is stored raw, exactly like an uncompressed file.*/
+#define CLUSTER_BLOCKS 4
+#define CLUSTER_SIZE (CLUSTER_BLOCKS*BLOCK_SIZE)
+#define BLOCK_COMPRESSED -2
+
+typedef struct Cluster_Header{
+  int compressed_length;
+  int raw_length;
+}Cluster_Header;
+
+/*Super_Node flags*/
+#define VOLUME_COMPRESSED 1
+#define VOLUME_DEDUP 2
+#define VOLUME_CHECKSUM_DATA 4
+
+/*CHECKSUM TABLE STRUCT
+crc[b] is the CRC32C of block b and is checked on every read of the block while covered[b] is set.
+Metadata blocks are always covered, file data blocks only while the volume has VOLUME_CHECKSUM_DATA.*/
+typedef struct Checksum_Table{
+  unsigned int crc[MAX_BLOCK];
+  unsigned char covered[MAX_BLOCK];
+}Checksum_Table;
+
+/*BIT MAP BLOCK STRUCT
+Block BIT_MAP_START holds the bit map followed by the checksum table, so the checksums of the blocks
+a write touched reach the disk in the same block write as the bit map. unwritten[b] is set for a block
+reserved by sfs_fallocate that was never written, it reads back as zeros. self_crc covers the bytes before it.*/
+typedef struct Bit_Map_Block{
+  int bm[MAX_BLOCK];
+  Checksum_Table checksums;
+  unsigned char unwritten[MAX_BLOCK];
+  unsigned int self_crc;
+}Bit_Map_Block;
+_Static_assert(sizeof(Bit_Map_Block) <= BLOCK_SIZE, "the bit map block must fit in one block, MAX_BLOCK is too large");
+
+/*Number of volume snapshots that can exist at the same time*/
+#define SNAPSHOT_COUNT 4
+
+/*I_NODE STRUCT
+64 bytes, so 16 inodes share a block and an inode never straddles a cache line.
+The inode table in memory is the same bytes as on disk.*/
+typedef struct I_Node{
+  long long size;
+  unsigned char is_free;
+  unsigned char flags;
+  unsigned short reserved;
+  union{
+    int block_pointers[DIRECT_POINTERS];
+    char inline_data[INODE_INLINE_SIZE];
+  };
+  int indirect_pointer;
+}I_Node;
+
+/*Longest file name is DIR_NAME_LENGTH-1 characters*/
+#define DIR_NAME_LENGTH 24
+
+/*DIRECTORY ENTRY STRUCT*/
+typedef struct Dir_Entry{
+  unsigned int hash;
+  int inode_id;
+  char filename[DIR_NAME_LENGTH];
+}Dir_Entry;
+
+/*SNAPSHOT IMAGE STRUCT
+A read only copy of the directory and the inode table taken by sfs_snapshot.
+It is written over SNAPSHOT_BLOCKS blocks whose numbers are listed in the snapshot's index block.
+The data blocks are not copied, the snapshot holds a reference on each of them instead.*/
+typedef struct Snapshot_Image{
+  int entry_count;
+  Dir_Entry entries[INODE_COUNT];
+  I_Node inodes[INODE_COUNT];
+}Snapshot_Image;
+#define SNAPSHOT_BLOCKS ((int)((sizeof(Snapshot_Image)+BLOCK_SIZE-1)/BLOCK_SIZE))
+
+/*SUPER NODE STRUCT
+version is SFS_VERSION, version 1 volumes have 0 there.*/
+typedef struct Super_Node{
+  int magic_number : 32;
+  int block_size : 32;
+  int block_amount : 32;
+  int i_node_block_length : 32;
+  int flags : 32;
+  /*Index block of each snapshot, -1 for an unused slot*/
+  int snapshots[SNAPSHOT_COUNT];
+  int version;
+}Super_Node;
+
+/*Version 1 of the format, read once by the upgrade on mount*/
+typedef struct I_Node_V1{
+  int size;
+  int is_free;
+  int flags;
+  union{
+    int block_pointers[24];
+    char inline_data[24*sizeof(int)];
+  };
+  int indirect_pointer;
+}I_Node_V1;
+#define INODE_TABLE_BLOCKS_V1 ((int)((INODE_COUNT*sizeof(I_Node_V1)+BLOCK_SIZE-1)/BLOCK_SIZE))
+#define BIT_MAP_START_V1 (INODE_TABLE_START+INODE_TABLE_BLOCKS_V1)
+#define DIRECTORY_START_V1 (BIT_MAP_START_V1+1)
+
+typedef struct Snapshot_Image_V1{
+  int entry_count;
+  Dir_Entry entries[INODE_COUNT];
+  I_Node_V1 inodes[INODE_COUNT];
+}Snapshot_Image_V1;
+#define SNAPSHOT_BLOCKS_V1 ((int)((sizeof(Snapshot_Image_V1)+BLOCK_SIZE-1)/BLOCK_SIZE))
+
+#endif
@@ -0,0 +1,207 @@
+#include "sfs_lz.h"
+#include <string.h>
+#include <time.h>
+
+/*Format: a run of sequences. Each sequence is
+  token    high nibble literal count, low nibble match length - LZ_MIN_MATCH
+  [extra]  a nibble of 15 is followed by bytes adding to it, each 255 continues, a smaller byte ends it
+  literals
+  offset   2 bytes little endian, distance back to the start of the match
+The last sequence has literals only and ends the input.*/
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+
+Lz_Stats lz_stats;
+
+static long long now_ns(){
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (long long)t.tv_sec*1000000000LL + t.tv_nsec;
+}
+
+static unsigned int read32(const unsigned char *p){
+  unsigned int value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+/*Append the extra length bytes for a nibble of 15, returns the new output position or -1*/
+static int put_length(unsigned char *out, int op, int capacity, int length){
+  while(length >= 255){
+    if(op >= capacity){
+      return -1;
+    }
+    out[op++] = 255;
+    length -= 255;
+  }
+  if(op >= capacity){
+    return -1;
+  }
+  out[op++] = (unsigned char)length;
+  return op;
+}
+
+/*Append one sequence. A match_length of 0 writes the final literals only sequence.*/
+static int put_sequence(unsigned char *out, int op, int capacity, const unsigned char *literals,
+  int literal_length, int offset, int match_length){
+  if(op >= capacity){
+    return -1;
+  }
+
+  int token_position = op++;
+  int literal_nibble = literal_length < 15 ? literal_length : 15;
+  int match_nibble = 0;
+  if(match_length){
+    match_nibble = match_length-LZ_MIN_MATCH < 15 ? match_length-LZ_MIN_MATCH : 15;
+  }
+  out[token_position] = (unsigned char)((literal_nibble<<4) | match_nibble);
+
+  if(literal_nibble == 15){
+    op = put_length(out, op, capacity, literal_length-15);
+    if(op == -1){
+      return -1;
+    }
+  }
+
+  if(op+literal_length > capacity){
+    return -1;
+  }
+  memcpy(out+op, literals, literal_length);
+  op += literal_length;
+
+  if(match_length){
+    if(op+2 > capacity){
+      return -1;
+    }
+    out[op++] = (unsigned char)(offset & 0xff);
+    out[op++] = (unsigned char)(offset >> 8);
+    if(match_nibble == 15){
+      op = put_length(out, op, capacity, match_length-LZ_MIN_MATCH-15);
+    }
+  }
+
+  return op;
+}
+
+int lz_compress(const char *src, int src_length, char *dst, int dst_capacity){
+  long long start = now_ns();
+  const unsigned char *in = (const unsigned char*)src;
+  unsigned char *out = (unsigned char*)dst;
+  int table[1<<LZ_HASH_BITS];
+  int ip = 0;
+  int anchor = 0;
+  int op = 0;
+
+  for(int i=0; i<(1<<LZ_HASH_BITS); i++){
+    table[i] = -1;
+  }
+
+  /*Matches need LZ_MIN_MATCH readable bytes, the tail always goes out as literals*/
+  while(ip+LZ_MIN_MATCH <= src_length){
+    unsigned int sequence = read32(in+ip);
+    int hash = (int)((sequence*2654435761u) >> (32-LZ_HASH_BITS));
+    int ref = table[hash];
+    table[hash] = ip;
+
+    if(ref < 0 || ip-ref > LZ_MAX_OFFSET || read32(in+ref) != sequence){
+      ip++;
+      continue;
+    }
+
+    int match_length = LZ_MIN_MATCH;
+    while(ip+match_length < src_length && in[ref+match_length] == in[ip+match_length]){
+      match_length++;
+    }
+
+    op = put_sequence(out, op, dst_capacity, in+anchor, ip-anchor, ip-ref, match_length);
+    if(op == -1){
+      return -1;
+    }
+    ip += match_length;
+    anchor = ip;
+  }
+
+  op = put_sequence(out, op, dst_capacity, in+anchor, src_length-anchor, 0, 0);
+  if(op == -1){
+    return -1;
+  }
+
+  lz_stats.compress_in += src_length;
+  lz_stats.compress_out += op;
+  lz_stats.compress_ns += now_ns()-start;
+  return op;
+}
+
+/*Read the extra length bytes after a nibble of 15, returns the new input position or -1*/
+static int get_length(const unsigned char *in, int ip, int src_length, int *length){
+  int byte;
+  do{
+    if(ip >= src_length){
+      return -1;
+    }
+    byte = in[ip++];
+    *length += byte;
+  }while(byte == 255);
+  return ip;
+}
+
+int lz_decompress(const char *src, int src_length, char *dst, int dst_capacity){
+  long long start = now_ns();
+  const unsigned char *in = (const unsigned char*)src;
+  unsigned char *out = (unsigned char*)dst;
+  int ip = 0;
+  int op = 0;
+
+  while(ip < src_length){
+    int token = in[ip++];
+
+    int literal_length = token >> 4;
+    if(literal_length == 15){
+      ip = get_length(in, ip, src_length, &literal_length);
+      if(ip == -1){
+        return -1;
+      }
+    }
+    if(ip+literal_length > src_length || op+literal_length > dst_capacity){
+      return -1;
+    }
+    memcpy(out+op, in+ip, literal_length);
+    ip += literal_length;
+    op += literal_length;
+
+    /*Final sequence*/
+    if(ip == src_length){
+      break;
+    }
+
+    if(ip+2 > src_length){
+      return -1;
+    }
+    int offset = in[ip] | (in[ip+1] << 8);
+    ip += 2;
+
+    int match_length = token & 0xf;
+    if(match_length == 15){
+      ip = get_length(in, ip, src_length, &match_length);
+      if(ip == -1){
+        return -1;
+      }
+    }
+    match_length += LZ_MIN_MATCH;
+
+    if(offset == 0 || offset > op || op+match_length > dst_capacity){
+      return -1;
+    }
+    /*Byte by byte since the match may overlap the bytes it produces*/
+    for(int i=0; i<match_length; i++){
+      out[op+i] = out[op-offset+i];
+    }
+    op += match_length;
+  }
+
+  lz_stats.decompress_in += src_length;
+  lz_stats.decompress_out += op;
+  lz_stats.decompress_ns += now_ns()-start;
+  return op;
+}
@@ -0,0 +1,25 @@
+/*Small LZ77 codec used to compress file clusters (LZ4 style byte format, no external library)*/
+#ifndef SFS_LZ_H
+#define SFS_LZ_H
+
+/*Running totals of everything that went through the codec, used by the benchmark*/
+typedef struct Lz_Stats{
+  long long compress_in;
+  long long compress_out;
+  long long compress_ns;
+  long long decompress_in;
+  long long decompress_out;
+  long long decompress_ns;
+}Lz_Stats;
+
+extern Lz_Stats lz_stats;
+
+/*Compress src_length bytes of src into dst.
+Returns the compressed length, or -1 if it does not fit in dst_capacity bytes.*/
+int lz_compress(const char *src, int src_length, char *dst, int dst_capacity);
+
+/*Decompress src_length bytes of src into dst.
+Returns the decompressed length, or -1 if the input is corrupt or does not fit in dst_capacity bytes.*/
+int lz_decompress(const char *src, int src_length, char *dst, int dst_capacity);
+
+#endif
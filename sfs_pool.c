@@ -0,0 +1,36 @@
+#include "sfs_pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/*Bit i of pool_taken is set while buffer i is handed out*/
+static _Alignas(64) char pool_memory[POOL_BUFFERS][(POOL_BUFFER_SIZE+63)/64*64];
+static unsigned int pool_taken = 0;
+
+void *pool_get(size_t size){
+  unsigned int free_buffers = ~pool_taken & (unsigned int)((1ULL << POOL_BUFFERS)-1);
+  if(size > POOL_BUFFER_SIZE || !free_buffers){
+    return malloc(size ? size : 1);
+  }
+  int i = __builtin_ctz(free_buffers);
+  pool_taken |= 1u << i;
+  return pool_memory[i];
+}
+
+void *pool_get_zeroed(size_t size){
+  void *buffer = pool_get(size);
+  if(buffer){
+    memset(buffer, 0, size);
+  }
+  return buffer;
+}
+
+void pool_put(void *buffer){
+  uintptr_t address = (uintptr_t)buffer;
+  uintptr_t start = (uintptr_t)pool_memory;
+  if(address >= start && address < start+sizeof(pool_memory)){
+    pool_taken &= ~(1u << ((address-start)/sizeof(pool_memory[0])));
+    return;
+  }
+  free(buffer);
+}
@@ -0,0 +1,24 @@
+/*Buffer pool for the block buffers of the read and write paths.
+POOL_BUFFERS buffers, each big enough for a cluster or the whole inode table and aligned to a cache line,
+are set aside once. pool_get hands a free one out and pool_put takes it back, so reading and writing files
+makes no heap allocation once the volume is mounted. A request larger than a buffer, or one made while
+every buffer is out, falls back to malloc, and pool_put tells the two apart by address.
+Like the other in memory tables the pool is only used under the volume lock, it takes no lock of its own.*/
+#ifndef SFS_POOL_H
+#define SFS_POOL_H
+
+#include <stddef.h>
+#include "sfs_layout.h"
+
+/*At most 32, a call holds a handful of buffers at once (a write, the block it patches and the flushes)*/
+#define POOL_BUFFERS 16
+#define POOL_BUFFER_SIZE (CLUSTER_SIZE > INODE_TABLE_BLOCKS*BLOCK_SIZE ? CLUSTER_SIZE : INODE_TABLE_BLOCKS*BLOCK_SIZE)
+
+/*A buffer of at least size bytes, its content is left as it was*/
+void *pool_get(size_t size);
+/*A buffer of at least size bytes, the first size of them zero*/
+void *pool_get_zeroed(size_t size);
+/*Give back a buffer from pool_get or pool_get_zeroed*/
+void pool_put(void *buffer);
+
+#endif
@@ -0,0 +1,349 @@
+/* sfs_replay.c
+ *
+ * Runs a trace recorded with SFS_TRACE or sfs_trace_start against the file system again.
+ *   sfs_replay trace          issues the calls back to back, as fast as they go
+ *   sfs_replay trace --timing waits so every call starts as far into the run as it did when recorded
+ * File descriptors are mapped from the recorded sfs_fopen results to the ones the replay gets, snapshot ids
+ * from the recorded sfs_snapshot results. Writes use filler data of the recorded size, the vectored calls
+ * split it over as many iovecs as were recorded and sfs_batch runs the operations recorded after it.
+ * Prints the throughput, the latency of each kind of call, and how many calls returned something other
+ * than what they returned when recorded. The filler data compresses and deduplicates unlike the real
+ * data, so with those on sfs_get_used_blocks can differ.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sfs_api.h"
+#include "sfs_trace.h"
+
+static long long now_ns(){
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (long long)t.tv_sec*1000000000LL + t.tv_nsec;
+}
+
+static int compare_latency(const void *a, const void *b){
+  long long x = *(const long long*)a;
+  long long y = *(const long long*)b;
+  return (x > y) - (x < y);
+}
+
+/*Read the whole trace, returns the number of calls or -1*/
+static int load_trace(char *path, Trace_Record **records){
+  FILE *file = fopen(path, "rb");
+  if(!file || trace_read_header(file) == -1){
+    fprintf(stderr, "%s is not a trace\n", path);
+    return -1;
+  }
+  int count = 0;
+  int capacity = 1024;
+  *records = malloc(capacity*sizeof(Trace_Record));
+  int status;
+  while((status = trace_read(file, &(*records)[count])) == 1){
+    if(++count == capacity){
+      capacity *= 2;
+      *records = realloc(*records, capacity*sizeof(Trace_Record));
+    }
+  }
+  fclose(file);
+  if(status == -1){
+    fprintf(stderr, "%s is cut short after %d calls, replaying those\n", path, count);
+  }
+  return count;
+}
+
+/*The replay fd or snapshot id for a recorded one*/
+static int map_id(int *ids, int id_count, int id){
+  return id >= 0 && id < id_count && ids[id] != -1 ? ids[id] : id;
+}
+
+/*Split length bytes of buf over count iovecs*/
+static void fill_iovecs(struct iovec *iov, int count, char *buf, long long length){
+  for(int i = 0; i < count; i++){
+    iov[i].iov_base = buf;
+    iov[i].iov_len = length/count + (i < length%count);
+  }
+}
+
+/*sfs_batch type of each recorded operation*/
+static int batch_type(int op){
+  switch(op){
+    case TRACE_FOPEN:
+      return SFS_OP_OPEN;
+    case TRACE_FREAD:
+      return SFS_OP_READ;
+    case TRACE_FWRITE:
+      return SFS_OP_WRITE;
+    case TRACE_FCLOSE:
+      return SFS_OP_CLOSE;
+  }
+  return -1;
+}
+
+int main(int argc, char **argv){
+  if(argc < 2){
+    fprintf(stderr, "usage: %s trace [--timing]\n", argv[0]);
+    return 1;
+  }
+  int timing = argc > 2 && strcmp(argv[2], "--timing") == 0;
+  /*Do not record the replay itself*/
+  unsetenv("SFS_TRACE");
+
+  Trace_Record *records;
+  int count = load_trace(argv[1], &records);
+  if(count == -1){
+    return 1;
+  }
+
+  long long max_length = 1;
+  int fd_count = 1;
+  int snapshot_count = 1;
+  long long max_iovecs = 1;
+  for(int i = 0; i < count; i++){
+    int op = records[i].op;
+    if(records[i].length > max_length && op != TRACE_DEFRAG_START){
+      max_length = records[i].length;
+    }
+    if(op == TRACE_FOPEN && records[i].result >= fd_count){
+      fd_count = records[i].result+1;
+    }
+    if(op == TRACE_SNAPSHOT && records[i].result >= snapshot_count){
+      snapshot_count = records[i].result+1;
+    }
+    if((op == TRACE_FWRITEV || op == TRACE_FREADV) && records[i].offset > max_iovecs){
+      max_iovecs = records[i].offset;
+    }
+    if(op == TRACE_BATCH && records[i].length > max_iovecs){
+      max_iovecs = records[i].length;
+    }
+  }
+  char *buf = malloc(max_length);
+  for(long long i = 0; i < max_length; i++){
+    buf[i] = 'a'+i%26;
+  }
+  int *fds = malloc(fd_count*sizeof(int));
+  for(int i = 0; i < fd_count; i++){
+    fds[i] = -1;
+  }
+  int *snapshots = malloc(snapshot_count*sizeof(int));
+  for(int i = 0; i < snapshot_count; i++){
+    snapshots[i] = -1;
+  }
+  struct iovec *iov = malloc(max_iovecs*sizeof(struct iovec));
+  Sfs_Op *ops = malloc(max_iovecs*sizeof(Sfs_Op));
+  long long *latency[TRACE_OP_COUNT];
+  int op_count[TRACE_OP_COUNT] = {0};
+  for(int op = 0; op < TRACE_OP_COUNT; op++){
+    latency[op] = malloc(count*sizeof(long long));
+  }
+
+  /*A trace started on a mounted volume has no mksfs, begin it on an empty one*/
+  if(count == 0 || records[0].op != TRACE_MKSFS){
+    mksfs(1);
+  }
+
+  long long bytes = 0;
+  int mismatches = 0;
+  char name[TRACE_NAME_LENGTH];
+  long long begin = now_ns();
+  for(int i = 0; i < count; i++){
+    Trace_Record *r = &records[i];
+    if(timing){
+      long long wait = r->start-(now_ns()-begin);
+      if(wait > 0){
+        struct timespec t = {wait/1000000000LL, wait%1000000000LL};
+        nanosleep(&t, NULL);
+      }
+    }
+
+    int fd = map_id(fds, fd_count, r->fd);
+    int id = map_id(snapshots, snapshot_count, r->fd);
+    int vectors = (int)r->offset;
+    int batched = 0;
+    long long result = 0;
+    long long start = now_ns();
+    switch(r->op){
+      case TRACE_MKSFS:
+        mksfs(r->length);
+        break;
+      case TRACE_GET_NEXT_FILE_NAME:
+        result = sfs_get_next_file_name(name);
+        break;
+      case TRACE_GET_FILE_SIZE:
+        result = sfs_get_file_size64(r->name);
+        break;
+      case TRACE_FOPEN:
+        result = sfs_fopen(r->name);
+        break;
+      case TRACE_FCLOSE:
+        result = sfs_fclose(fd);
+        break;
+      case TRACE_FRSEEK:
+        result = sfs_frseek64(fd, r->offset);
+        break;
+      case TRACE_FWSEEK:
+        result = sfs_fwseek64(fd, r->offset);
+        break;
+      case TRACE_FWRITE:
+        result = sfs_fwrite64(fd, buf, r->length);
+        break;
+      case TRACE_FREAD:
+        result = sfs_fread64(fd, buf, r->length);
+        break;
+      case TRACE_PWRITE:
+        result = sfs_pwrite64(fd, buf, r->length, r->offset);
+        break;
+      case TRACE_PREAD:
+        result = sfs_pread64(fd, buf, r->length, r->offset);
+        break;
+      case TRACE_REMOVE:
+        result = sfs_remove(r->name);
+        break;
+      case TRACE_CLONE:
+        result = sfs_clone(r->name, r->name2);
+        break;
+      case TRACE_FALLOCATE:
+        result = sfs_fallocate64(fd, r->offset, r->length, 0);
+        break;
+      case TRACE_PUNCH_HOLE:
+        result = sfs_fallocate64(fd, r->offset, r->length, SFS_FALLOC_PUNCH_HOLE);
+        break;
+      case TRACE_FALLOCATE_KEEP_SIZE:
+        result = sfs_fallocate64(fd, r->offset, r->length, SFS_FALLOC_KEEP_SIZE);
+        break;
+      case TRACE_FWRITEV:
+        fill_iovecs(iov, vectors, buf, r->length);
+        result = sfs_fwritev(fd, iov, vectors);
+        break;
+      case TRACE_FREADV:
+        fill_iovecs(iov, vectors, buf, r->length);
+        result = sfs_freadv(fd, iov, vectors);
+        break;
+      case TRACE_BATCH:
+        /*The operations are the records that follow, they are run here and not on their own*/
+        batched = i+r->length < count ? (int)r->length : count-i-1;
+        for(int j = 0; j < batched; j++){
+          Trace_Record *o = &records[i+1+j];
+          ops[j].type = batch_type(o->op);
+          ops[j].name = o->name;
+          ops[j].fd = map_id(fds, fd_count, o->fd);
+          ops[j].ref = (int)o->offset;
+          ops[j].buf = buf;
+          ops[j].length = o->length;
+        }
+        result = sfs_batch(ops, batched);
+        break;
+      case TRACE_SEEK_DATA:
+        result = sfs_seek_data64(fd, r->offset);
+        break;
+      case TRACE_SEEK_HOLE:
+        result = sfs_seek_hole64(fd, r->offset);
+        break;
+      case TRACE_SNAPSHOT:
+        result = sfs_snapshot();
+        break;
+      case TRACE_SNAPSHOT_DELETE:
+        result = sfs_snapshot_delete(id);
+        break;
+      case TRACE_SNAPSHOT_GET_FILE_NAME:
+        result = sfs_snapshot_get_file_name(id, r->offset, name);
+        break;
+      case TRACE_SNAPSHOT_GET_FILE_SIZE:
+        result = sfs_snapshot_get_file_size64(id, r->name);
+        break;
+      case TRACE_SNAPSHOT_READ:
+        result = sfs_snapshot_read(id, r->name, buf, r->offset, r->length);
+        break;
+      case TRACE_SET_COMPRESSION:
+        result = sfs_set_compression(fd, r->length);
+        break;
+      case TRACE_SET_VOLUME_COMPRESSION:
+        sfs_set_volume_compression(r->length);
+        break;
+      case TRACE_SET_VOLUME_DEDUP:
+        sfs_set_volume_dedup(r->length);
+        break;
+      case TRACE_SET_VOLUME_CHECKSUMS:
+        sfs_set_volume_checksums(r->length);
+        break;
+      case TRACE_GET_USED_BLOCKS:
+        result = sfs_get_used_blocks();
+        break;
+      case TRACE_GET_CHECKSUM_ERRORS:
+        result = sfs_get_checksum_errors();
+        break;
+      case TRACE_GET_FRAGMENTS:
+        result = sfs_get_fragments(r->name);
+        break;
+      case TRACE_DEFRAG:
+        result = sfs_defrag(r->name);
+        break;
+      case TRACE_DEFRAG_START:
+        result = sfs_defrag_start(r->length);
+        break;
+      case TRACE_DEFRAG_STOP:
+        result = sfs_defrag_stop(r->length);
+        break;
+    }
+    latency[r->op][op_count[r->op]++] = now_ns()-start;
+
+    if(r->op == TRACE_FOPEN && r->result >= 0){
+      fds[r->result] = result;
+    }
+    if(r->op == TRACE_SNAPSHOT && r->result >= 0){
+      snapshots[r->result] = result;
+    }
+    if(((r->op >= TRACE_FWRITE && r->op <= TRACE_PREAD) || r->op == TRACE_FWRITEV || r->op == TRACE_FREADV) && result > 0){
+      bytes += result;
+    }
+    /*Which fd an open or a snapshot gets may differ, its success may not. How many blocks a background
+    defragmenting pass moved depends on how far it got while the other calls ran.*/
+    int success_only = r->op == TRACE_FOPEN || r->op == TRACE_SNAPSHOT || r->op == TRACE_DEFRAG_STOP;
+    if(success_only ? (result < 0) != (r->result < 0) : result != r->result){
+      mismatches++;
+    }
+
+    for(int j = 0; j < batched; j++){
+      Trace_Record *o = &records[i+1+j];
+      if(o->op == TRACE_FOPEN && o->result >= 0){
+        fds[o->result] = ops[j].result;
+      }
+      if((o->op == TRACE_FREAD || o->op == TRACE_FWRITE) && ops[j].result > 0){
+        bytes += ops[j].result;
+      }
+      if(o->op == TRACE_FOPEN ? (ops[j].result < 0) != (o->result < 0) : ops[j].result != o->result){
+        mismatches++;
+      }
+    }
+    i += batched;
+  }
+  double elapsed = (now_ns()-begin)/1e9;
+
+  printf("%d calls in %.3f s   %.0f calls/s   %.2f MB/s   mismatches %d\n",
+    count, elapsed, count/elapsed, bytes/1e6/elapsed, mismatches);
+  printf("%-24s %8s %10s %10s %10s %10s\n", "call", "count", "avg us", "p50 us", "p99 us", "max us");
+  for(int op = 0; op < TRACE_OP_COUNT; op++){
+    int n = op_count[op];
+    if(n == 0){
+      continue;
+    }
+    long long total = 0;
+    for(int i = 0; i < n; i++){
+      total += latency[op][i];
+    }
+    qsort(latency[op], n, sizeof(long long), compare_latency);
+    printf("%-24s %8d %10.2f %10.2f %10.2f %10.2f\n", trace_op_names[op], n, total/1e3/n,
+      latency[op][n/2]/1e3, latency[op][n*99/100]/1e3, latency[op][n-1]/1e3);
+    free(latency[op]);
+  }
+
+  free(buf);
+  free(fds);
+  free(snapshots);
+  free(iov);
+  free(ops);
+  free(records);
+  return 0;
+}
@@ -65,8 +65,33 @@ int simple_test(){
   return 0;
 }
 
+/*
+Tests the features added on top of the basic calls on a fresh file system. 
+*/
+int feature_test(){
+  printf("\n-------------------------------\nInitializing Feature test.\n--------------------------------\n\n");
+  int err_no = 0;
+
+  mksfs(1);
+  test_compression(&err_no);
+  test_dedup(&err_no);
+  test_clone_copy_on_write(&err_no);
+  test_snapshot(&err_no);
+  test_mirror_failover(&err_no);
+  test_defrag(&err_no);
+  test_fallocate(&err_no);
+  test_holes(&err_no);
+  test_upgrade(&err_no);
+  test_multiple_fds(&err_no);
+  test_fsck(&err_no);
+
+  printf("\n-------------------------------\nFeature test Finished.\nCurrent Error Num: %d\n--------------------------------\n\n", err_no);
+  return 0;
+}
+
 /* The main testing program
  */
 int main(int argc, char **argv){
   simple_test();
+  feature_test();
 }
\ No newline at end of file
@@ -0,0 +1,269 @@
+#include "sfs_trace.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+/*Format: the 8 byte magic and a version byte, then one entry per call
+  op        1 byte
+  fd, length, offset, result, start, duration
+            zigzag varints, 7 bits per byte low bits first, the top bit continues.
+            start is the distance from the start of the previous entry, both times in nanoseconds.
+  names     a length byte and the characters, one name for TRACE_GET_FILE_SIZE, TRACE_FOPEN,
+            TRACE_REMOVE, TRACE_SNAPSHOT_GET_FILE_SIZE, TRACE_SNAPSHOT_READ, TRACE_GET_FRAGMENTS
+            and TRACE_DEFRAG, two for TRACE_CLONE, none for the others
+A read or write of a few KB takes around 12 bytes.*/
+#define TRACE_MAGIC "SFSTRACE"
+#define TRACE_VERSION 1
+#define TRACE_BUFFER_SIZE (1<<16)
+/*Longest entry: the op, six varints of at most 10 bytes and two names with their length bytes*/
+#define TRACE_ENTRY_SIZE (1+6*10+2*TRACE_NAME_LENGTH)
+
+const char *trace_op_names[TRACE_OP_COUNT] = {"mksfs", "get_next_file_name", "get_file_size", "fopen",
+  "fclose", "frseek", "fwseek", "fwrite", "fread", "pwrite", "pread", "remove", "clone", "fallocate",
+  "punch_hole", "fallocate_keep_size", "fwritev", "freadv", "batch", "seek_data", "seek_hole", "snapshot",
+  "snapshot_delete", "snapshot_get_file_name", "snapshot_get_file_size", "snapshot_read", "set_compression",
+  "set_volume_compression", "set_volume_dedup", "set_volume_checksums", "get_used_blocks",
+  "get_checksum_errors", "get_fragments", "defrag", "defrag_start", "defrag_stop"};
+
+/*Set and cleared under trace_lock, the calls check it with an atomic load before taking the lock*/
+static FILE *trace_file = NULL;
+static int trace_tried_environment = 0;
+static long long trace_origin;
+static long long trace_last_start;
+/*Start of the last call read back by trace_read*/
+static long long read_last_start;
+/*The async workers call into the library from their own threads*/
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static long long now_ns(){
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (long long)t.tv_sec*1000000000LL + t.tv_nsec;
+}
+
+static int name_count(int op){
+  if(op == TRACE_CLONE){
+    return 2;
+  }
+  return op == TRACE_GET_FILE_SIZE || op == TRACE_FOPEN || op == TRACE_REMOVE || op == TRACE_SNAPSHOT_GET_FILE_SIZE ||
+    op == TRACE_SNAPSHOT_READ || op == TRACE_GET_FRAGMENTS || op == TRACE_DEFRAG;
+}
+
+/*Append value to entry, returns the number of bytes it took*/
+static int put_varint(unsigned char *entry, long long value){
+  unsigned long long zigzag = ((unsigned long long)value << 1) ^ (unsigned long long)(value >> 63);
+  int size = 0;
+  while(zigzag >= 0x80){
+    entry[size++] = (unsigned char)((zigzag & 0x7f) | 0x80);
+    zigzag >>= 7;
+  }
+  entry[size++] = (unsigned char)zigzag;
+  return size;
+}
+
+static int put_name(unsigned char *entry, char *name){
+  int length = name ? strnlen(name, TRACE_NAME_LENGTH-1) : 0;
+  entry[0] = (unsigned char)length;
+  memcpy(entry+1, name, length);
+  return length+1;
+}
+
+/*Encode one entry into entry, start is the distance from the entry before. Returns its size.*/
+static int put_entry(unsigned char *entry, int op, int fd, long long length, long long offset, long long result,
+  long long start, long long duration, char *name, char *name2){
+  int size = 0;
+  entry[size++] = (unsigned char)op;
+  size += put_varint(entry+size, fd);
+  size += put_varint(entry+size, length);
+  size += put_varint(entry+size, offset);
+  size += put_varint(entry+size, result);
+  size += put_varint(entry+size, start);
+  size += put_varint(entry+size, duration);
+  if(name_count(op) > 0){
+    size += put_name(entry+size, name);
+  }
+  if(name_count(op) > 1){
+    size += put_name(entry+size, name2);
+  }
+  return size;
+}
+
+static FILE *current_trace(){
+  return __atomic_load_n(&trace_file, __ATOMIC_ACQUIRE);
+}
+
+static void close_trace(){
+  FILE *file = trace_file;
+  if(file){
+    __atomic_store_n(&trace_file, NULL, __ATOMIC_RELEASE);
+    fclose(file);
+  }
+}
+
+int sfs_trace_start(char *path){
+  pthread_mutex_lock(&trace_lock);
+  close_trace();
+  FILE *file = fopen(path, "wb");
+  if(file){
+    setvbuf(file, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+    fwrite(TRACE_MAGIC, 1, 8, file);
+    putc(TRACE_VERSION, file);
+    trace_origin = now_ns();
+    trace_last_start = 0;
+    __atomic_store_n(&trace_file, file, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&trace_lock);
+  return file ? 0 : -1;
+}
+
+void sfs_trace_stop(){
+  pthread_mutex_lock(&trace_lock);
+  close_trace();
+  pthread_mutex_unlock(&trace_lock);
+}
+
+void trace_from_environment(){
+  if(__atomic_exchange_n(&trace_tried_environment, 1, __ATOMIC_ACQ_REL)){
+    return;
+  }
+  char *path = getenv("SFS_TRACE");
+  if(path && !current_trace() && sfs_trace_start(path) == 0){
+    /*Programs end without calling anything, flush the buffered tail on exit*/
+    atexit(sfs_trace_stop);
+  }
+}
+
+long long trace_clock(){
+  return current_trace() ? now_ns() : 0;
+}
+
+/*Each entry is put together in a buffer of its own and written with one fwrite under trace_lock,
+so entries of calls ending at the same time never mix and sfs_trace_stop can not close the file
+under a write. The start is relative to the entry before, so the entry is encoded under the lock too.*/
+void trace_record(int op, long long start, int fd, long long length, long long offset, long long result, char *name, char *name2){
+  if(!current_trace() || start == 0){
+    return;
+  }
+  long long end = now_ns();
+  unsigned char entry[TRACE_ENTRY_SIZE];
+
+  pthread_mutex_lock(&trace_lock);
+  /*Skip calls that began before recording did*/
+  if(trace_file && start >= trace_origin){
+    start -= trace_origin;
+    int size = put_entry(entry, op, fd, length, offset, result, start-trace_last_start, end-trace_origin-start, name, name2);
+    fwrite(entry, 1, size, trace_file);
+    trace_last_start = start;
+  }
+  pthread_mutex_unlock(&trace_lock);
+}
+
+/*Trace op of each type of sfs_batch operation*/
+static int batch_op(int type){
+  switch(type){
+    case SFS_OP_OPEN:
+      return TRACE_FOPEN;
+    case SFS_OP_READ:
+      return TRACE_FREAD;
+    case SFS_OP_WRITE:
+      return TRACE_FWRITE;
+    case SFS_OP_CLOSE:
+      return TRACE_FCLOSE;
+  }
+  return TRACE_BATCH;
+}
+
+/*The batch and its operations go out in one fwrite, the operations share the start of the batch*/
+void trace_record_batch(long long start, Sfs_Op *ops, int count, long long result){
+  if(!current_trace() || start == 0){
+    return;
+  }
+  long long end = now_ns();
+  if(count < 0){
+    count = 0;
+  }
+  unsigned char *entries = malloc((size_t)(count+1)*TRACE_ENTRY_SIZE);
+
+  pthread_mutex_lock(&trace_lock);
+  if(trace_file && start >= trace_origin){
+    start -= trace_origin;
+    int size = put_entry(entries, TRACE_BATCH, 0, count, 0, result, start-trace_last_start, end-trace_origin-start, NULL, NULL);
+    for(int i=0; i<count; i++){
+      size += put_entry(entries+size, batch_op(ops[i].type), ops[i].fd, ops[i].length, ops[i].ref, ops[i].result, 0, 0,
+        ops[i].type == SFS_OP_OPEN ? ops[i].name : NULL, NULL);
+    }
+    fwrite(entries, 1, size, trace_file);
+    trace_last_start = start;
+  }
+  pthread_mutex_unlock(&trace_lock);
+  free(entries);
+}
+
+int trace_read_header(FILE *file){
+  char magic[8];
+  if(fread(magic, 1, 8, file) != 8 || memcmp(magic, TRACE_MAGIC, 8) != 0 || getc(file) != TRACE_VERSION){
+    return -1;
+  }
+  read_last_start = 0;
+  return 0;
+}
+
+static int get_varint(FILE *file, long long *value){
+  unsigned long long zigzag = 0;
+  for(int shift = 0; shift < 64; shift += 7){
+    int byte = getc(file);
+    if(byte == EOF){
+      return -1;
+    }
+    zigzag |= (unsigned long long)(byte & 0x7f) << shift;
+    if(!(byte & 0x80)){
+      *value = (long long)(zigzag >> 1) ^ -(long long)(zigzag & 1);
+      return 0;
+    }
+  }
+  return -1;
+}
+
+static int get_name(FILE *file, char *name){
+  int length = getc(file);
+  if(length == EOF || length >= TRACE_NAME_LENGTH || fread(name, 1, length, file) != (size_t)length){
+    return -1;
+  }
+  name[length] = '\0';
+  return 0;
+}
+
+int trace_read(FILE *file, Trace_Record *record){
+  long long fields[6];
+
+  int op = getc(file);
+  if(op == EOF){
+    return 0;
+  }
+  if(op >= TRACE_OP_COUNT){
+    return -1;
+  }
+  for(int i=0; i<6; i++){
+    if(get_varint(file, &fields[i]) == -1){
+      return -1;
+    }
+  }
+  record->op = op;
+  record->fd = (int)fields[0];
+  record->length = fields[1];
+  record->offset = fields[2];
+  record->result = fields[3];
+  record->start = read_last_start+fields[4];
+  record->duration = fields[5];
+  record->name[0] = '\0';
+  record->name2[0] = '\0';
+  if(name_count(op) > 0 && get_name(file, record->name) == -1){
+    return -1;
+  }
+  if(name_count(op) > 1 && get_name(file, record->name2) == -1){
+    return -1;
+  }
+  read_last_start = record->start;
+  return 1;
+}
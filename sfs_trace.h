@@ -0,0 +1,101 @@
+/*Workload traces. While recording, every call of the sfs_* file API is appended to a compact binary
+file with its arguments, result, start time and duration. Data is not recorded, only sizes, so a trace
+can be taken from a volume holding real files. Recording starts with sfs_trace_start, or by itself on the
+first mksfs when the SFS_TRACE environment variable names the file to write, which captures the FUSE
+binary and the test programs without changing them. sfs_replay runs a trace again.
+The requests of sfs_submit show up as the sfs_fopen, sfs_pread64, sfs_pwrite64 and sfs_fclose calls
+the async workers make for them.*/
+#ifndef SFS_TRACE_H
+#define SFS_TRACE_H
+
+#include <stdio.h>
+
+#include "sfs_api.h"
+
+/*Calls of a trace*/
+#define TRACE_MKSFS 0
+#define TRACE_GET_NEXT_FILE_NAME 1
+#define TRACE_GET_FILE_SIZE 2
+#define TRACE_FOPEN 3
+#define TRACE_FCLOSE 4
+#define TRACE_FRSEEK 5
+#define TRACE_FWSEEK 6
+#define TRACE_FWRITE 7
+#define TRACE_FREAD 8
+#define TRACE_PWRITE 9
+#define TRACE_PREAD 10
+#define TRACE_REMOVE 11
+#define TRACE_CLONE 12
+#define TRACE_FALLOCATE 13
+#define TRACE_PUNCH_HOLE 14
+#define TRACE_FALLOCATE_KEEP_SIZE 15
+#define TRACE_FWRITEV 16
+#define TRACE_FREADV 17
+#define TRACE_BATCH 18
+#define TRACE_SEEK_DATA 19
+#define TRACE_SEEK_HOLE 20
+#define TRACE_SNAPSHOT 21
+#define TRACE_SNAPSHOT_DELETE 22
+#define TRACE_SNAPSHOT_GET_FILE_NAME 23
+#define TRACE_SNAPSHOT_GET_FILE_SIZE 24
+#define TRACE_SNAPSHOT_READ 25
+#define TRACE_SET_COMPRESSION 26
+#define TRACE_SET_VOLUME_COMPRESSION 27
+#define TRACE_SET_VOLUME_DEDUP 28
+#define TRACE_SET_VOLUME_CHECKSUMS 29
+#define TRACE_GET_USED_BLOCKS 30
+#define TRACE_GET_CHECKSUM_ERRORS 31
+#define TRACE_GET_FRAGMENTS 32
+#define TRACE_DEFRAG 33
+#define TRACE_DEFRAG_START 34
+#define TRACE_DEFRAG_STOP 35
+#define TRACE_OP_COUNT 36
+
+/*Longer names are cut to TRACE_NAME_LENGTH-1 characters*/
+#define TRACE_NAME_LENGTH 64
+
+/*One recorded call. length is the fresh flag for mksfs, the flag of the calls that turn something on
+or off, the rate of sfs_defrag_start and the cancel flag of sfs_defrag_stop, offset the location for the
+seeks, the position of sfs_snapshot_read and the index of sfs_snapshot_get_file_name.
+fd is the snapshot id for the snapshot calls that take one.
+sfs_fallocate is recorded as TRACE_PUNCH_HOLE when it punches a hole and as TRACE_FALLOCATE_KEEP_SIZE
+when it reserves without growing the file, so the replay passes the same mode.
+The vectored calls keep the total length in length and the number of iovecs in offset.
+sfs_batch is a TRACE_BATCH with the number of operations in length, followed by one record for each
+operation: TRACE_FOPEN, TRACE_FREAD, TRACE_FWRITE or TRACE_FCLOSE with the fd, length and result of the
+operation and its ref in offset, or TRACE_BATCH for an operation of an unknown type.
+start is in nanoseconds since the trace began.*/
+typedef struct Trace_Record{
+  int op;
+  int fd;
+  long long length;
+  long long offset;
+  long long result;
+  long long start;
+  long long duration;
+  char name[TRACE_NAME_LENGTH];
+  char name2[TRACE_NAME_LENGTH];
+}Trace_Record;
+
+extern const char *trace_op_names[TRACE_OP_COUNT];
+
+/*Start recording to path, replacing a trace already running. Returns -1 if the file can not be created.*/
+int sfs_trace_start(char *path);
+/*Flush and close the trace*/
+void sfs_trace_stop();
+
+/*Start recording to $SFS_TRACE if it is set and nothing was started yet*/
+void trace_from_environment();
+/*Current time in nanoseconds, or 0 when not recording so untraced calls skip the clock*/
+long long trace_clock();
+/*Append a call that began at start (from trace_clock). Does nothing when not recording.*/
+void trace_record(int op, long long start, int fd, long long length, long long offset, long long result, char *name, char *name2);
+/*Append an sfs_batch call of count operations and then its operations, see Trace_Record*/
+void trace_record_batch(long long start, Sfs_Op *ops, int count, long long result);
+
+/*Check the header of a trace opened for reading, returns -1 if it is not a trace*/
+int trace_read_header(FILE *file);
+/*Read the next call, returns 0 at the end of the trace and -1 if it is cut short*/
+int trace_read(FILE *file, Trace_Record *record);
+
+#endif
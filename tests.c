@@ -1,4 +1,14 @@
 #include "tests.h"
+#include "disk_emu.h"
+#include "sfs_layout.h"
+#include "sfs_crc.h"
+#include <stddef.h>
+#include <sys/wait.h>
+
+//The consistency checker test_fsck runs, make test1 builds it and passes its path
+#ifndef FSCK_PATH
+#define FSCK_PATH "./sfs_fsck"
+#endif
 
 /* rand_name() - return a randomly-generated, but legal, file name.
  *
@@ -700,4 +710,849 @@ int free_name_element(char **name_list, int num_file){
   for(int i = 0; i < num_file; i++)
     free(name_list[i]);
   return 0;
+}
+
+/*
+Writes a file that compresses well on a volume that compresses new files, overwrites a range across
+the boundary between its first two clusters with text that does not and reads it all back.
+Then turns compression on for one file of a volume that does not compress, which is only allowed
+while the file has no data block.
+*/
+int test_compression(int *err_no){
+  int length = 8 * 1024;
+  char *text = calloc(length + 1, sizeof(char));
+  char *patch = rand_text(500);
+  char *buf = calloc(length + 1, sizeof(char));
+  for(int i = 0; i < length; i++)
+    text[i] = test_str[i % strlen(test_str)];
+
+  sfs_set_volume_compression(1);
+  int fd = sfs_fopen("COMPRESSED.txt");
+  if(sfs_fwrite(fd, text, length) != length){
+    fprintf(stderr, "ERROR: Could not write a compressed file\n");
+    *err_no += 1;
+  }
+  sfs_fwseek(fd, 4000);
+  sfs_fwrite(fd, patch, 500);
+  memcpy(text + 4000, patch, 500);
+  if(sfs_get_file_size("COMPRESSED.txt") != length){
+    fprintf(stderr, "ERROR: Invalid file size for a compressed file.\nGiven: %d, Actual: %d\n", sfs_get_file_size("COMPRESSED.txt"), length);
+    *err_no += 1;
+  }
+  if(sfs_fread(fd, buf, length) != length || memcmp(buf, text, length) != 0){
+    fprintf(stderr, "Error: \nThe compressed file does not read back after an overwrite\n");
+    *err_no += 1;
+  }
+  sfs_fclose(fd);
+  sfs_set_volume_compression(0);
+
+  fd = sfs_fopen("COMPRESSED2.txt");
+  if(sfs_set_compression(fd, 1) < 0){
+    fprintf(stderr, "ERROR: sfs_set_compression failed on an empty file\n");
+    *err_no += 1;
+  }
+  sfs_fwrite(fd, text, length);
+  if(sfs_set_compression(fd, 0) != -1){
+    fprintf(stderr, "ERROR: sfs_set_compression changed a file that has data blocks\n");
+    *err_no += 1;
+  }
+  memset(buf, 0, length);
+  if(sfs_fread(fd, buf, length) != length || memcmp(buf, text, length) != 0){
+    fprintf(stderr, "Error: \nA file compressed through sfs_set_compression does not read back\n");
+    *err_no += 1;
+  }
+  sfs_fclose(fd);
+  sfs_remove("COMPRESSED.txt");
+  sfs_remove("COMPRESSED2.txt");
+
+  free(text);
+  free(patch);
+  free(buf);
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+/*
+Writes the same text to two files while deduplication is on. The second file should share every block
+of the first, a write to one block of it should give it its own copy of just that block, and removing
+both files should give every block back.
+*/
+int test_dedup(int *err_no){
+  int length = 3 * 1024;
+  char *text = rand_text(length);
+  char *expected = calloc(length + 1, sizeof(char));
+  char *buf = calloc(length + 1, sizeof(char));
+  sfs_set_volume_dedup(1);
+  int used_blocks = sfs_get_used_blocks();
+
+  int fd = sfs_fopen("DEDUP.txt");
+  sfs_fwrite(fd, text, length);
+  int first_blocks = sfs_get_used_blocks();
+  int copy = sfs_fopen("DEDUP_COPY.txt");
+  sfs_fwrite(copy, text, length);
+  if(sfs_get_used_blocks() != first_blocks){
+    fprintf(stderr, "ERROR: A copy of a file took %d new blocks instead of sharing them\n", sfs_get_used_blocks() - first_blocks);
+    *err_no += 1;
+  }
+  if(sfs_fread(copy, buf, length) != length || memcmp(buf, text, length) != 0){
+    fprintf(stderr, "Error: \nA file with shared blocks does not read back\n");
+    *err_no += 1;
+  }
+
+  //Only the block written to stops being shared
+  sfs_fwseek(copy, 0);
+  sfs_fwrite(copy, test_str, strlen(test_str));
+  memcpy(expected, text, length);
+  memcpy(expected, test_str, strlen(test_str));
+  if(sfs_get_used_blocks() != first_blocks + 1){
+    fprintf(stderr, "ERROR: A write to a shared block took %d new blocks, should be 1\n", sfs_get_used_blocks() - first_blocks);
+    *err_no += 1;
+  }
+  sfs_frseek(copy, 0);
+  if(sfs_fread(fd, buf, length) != length || memcmp(buf, text, length) != 0 ||
+    sfs_fread(copy, buf, length) != length || memcmp(buf, expected, length) != 0){
+    fprintf(stderr, "Error: \nA write to a shared block changed the other file or was lost\n");
+    *err_no += 1;
+  }
+  sfs_fclose(fd);
+  sfs_fclose(copy);
+  sfs_remove("DEDUP.txt");
+  sfs_remove("DEDUP_COPY.txt");
+  if(sfs_get_used_blocks() != used_blocks){
+    fprintf(stderr, "ERROR: Removing files with shared blocks left %d blocks in use\n", sfs_get_used_blocks() - used_blocks);
+    *err_no += 1;
+  }
+  sfs_set_volume_dedup(0);
+
+  free(text);
+  free(expected);
+  free(buf);
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+/*
+Clones a file and writes into the middle of the clone. 
+The clone shares the blocks of the source until it is written, so the source should read back 
+as it was and the clone with the new text in it. 
+*/
+int test_clone_copy_on_write(int *err_no){
+  int length = 3000;
+  char *text = rand_text(length);
+  char *buf = calloc(length + 1, sizeof(char));
+  int src = sfs_fopen("CLONE_SRC.txt");
+  sfs_fwrite(src, text, length);
+  if(sfs_clone("CLONE_SRC.txt", "CLONE_DST.txt") < 0){
+    fprintf(stderr, "ERROR: sfs_clone failed\n");
+    *err_no += 1;
+  }
+  int dst = sfs_fopen("CLONE_DST.txt");
+  //Write over the middle of the clone, across a block boundary
+  sfs_fwseek(dst, 1000);
+  if(sfs_fwrite(dst, test_str, strlen(test_str)) != strlen(test_str))
+    fprintf(stderr, "Warning: sfs_fwrite should return number of bytes written. Potential write fail?\n");
+
+  sfs_frseek(src, 0);
+  if(sfs_fread(src, buf, length) != length || memcmp(buf, text, length) != 0){
+    fprintf(stderr, "Error: \nThe source changed when its clone was written\n");
+    *err_no += 1;
+  }
+  memcpy(text + 1000, test_str, strlen(test_str));
+  sfs_frseek(dst, 0);
+  if(sfs_fread(dst, buf, length) != length || memcmp(buf, text, length) != 0){
+    fprintf(stderr, "Error: \nThe clone does not read back what was written to it\n");
+    *err_no += 1;
+  }
+  if(sfs_get_file_size("CLONE_SRC.txt") != length || sfs_get_file_size("CLONE_DST.txt") != length){
+    fprintf(stderr, "ERROR: Invalid file size for the clone or its source\n");
+    *err_no += 1;
+  }
+
+  sfs_fclose(src);
+  sfs_fclose(dst);
+  sfs_remove("CLONE_SRC.txt");
+  sfs_remove("CLONE_DST.txt");
+  free(text);
+  free(buf);
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+/*
+Takes a snapshot, then overwrites the file it holds. 
+The snapshot should still read the old text and the file the new one. Deleting the snapshot 
+should give back the blocks only it still held, so the volume uses as many blocks as before it was taken. 
+*/
+int test_snapshot(int *err_no){
+  int length = 3000;
+  char *old_text = rand_text(length);
+  char *new_text = rand_text(length);
+  char *buf = calloc(length + 1, sizeof(char));
+  int fd = sfs_fopen("SNAPSHOT.txt");
+  sfs_fwrite(fd, old_text, length);
+  int used_blocks = sfs_get_used_blocks();
+
+  int id = sfs_snapshot();
+  if(id < 0){
+    fprintf(stderr, "ERROR: sfs_snapshot failed\n");
+    *err_no += 1;
+  }
+  sfs_fwseek(fd, 0);
+  sfs_fwrite(fd, new_text, length);
+
+  if(sfs_snapshot_read(id, "SNAPSHOT.txt", buf, 0, length) != length || memcmp(buf, old_text, length) != 0){
+    fprintf(stderr, "Error: \nThe snapshot does not read back the file as it was\n");
+    *err_no += 1;
+  }
+  if(sfs_snapshot_get_file_size(id, "SNAPSHOT.txt") != length){
+    fprintf(stderr, "ERROR: Invalid file size in the snapshot\n");
+    *err_no += 1;
+  }
+  sfs_frseek(fd, 0);
+  if(sfs_fread(fd, buf, length) != length || memcmp(buf, new_text, length) != 0){
+    fprintf(stderr, "Error: \nThe file does not read back what was written over it\n");
+    *err_no += 1;
+  }
+
+  if(sfs_snapshot_delete(id) < 0){
+    fprintf(stderr, "ERROR: sfs_snapshot_delete failed\n");
+    *err_no += 1;
+  }
+  if(sfs_get_used_blocks() != used_blocks){
+    fprintf(stderr, "Error: \n%d blocks used after the snapshot was deleted, %d before it was taken\n", sfs_get_used_blocks(), used_blocks);
+    *err_no += 1;
+  }
+  if(sfs_snapshot_read(id, "SNAPSHOT.txt", buf, 0, length) >= 0){
+    fprintf(stderr, "Error: \nA deleted snapshot can still be read\n");
+    *err_no += 1;
+  }
+
+  sfs_fclose(fd);
+  sfs_remove("SNAPSHOT.txt");
+  free(old_text);
+  free(new_text);
+  free(buf);
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+/*
+Finds the blocks of one copy of a mirrored disk that hold the whole blocks of text, in the order of text.
+Returns how many were found, blocks gets their numbers.
+*/
+int find_copy_blocks(int copy, char *text, int length, int *blocks){
+  int found = 0;
+  char *block = malloc(1024);
+  for(int i = 0; i + 1024 <= length; i += 1024){
+    for(int b = 0; read_blocks_copy(b, 1, block, copy) > 0; b++){
+      if(memcmp(block, text + i, 1024) == 0){
+        blocks[found++] = b;
+        break;
+      }
+    }
+  }
+  free(block);
+  return found;
+}
+
+/*
+Mirrors the disk over two image files and corrupts a file's blocks in one of them, then in the other.
+With data checksums on, the file should read back right each time, and a copy that was read and
+found bad should be repaired from the good one. The disk goes back to one image file at the end.
+*/
+int test_mirror_failover(int *err_no){
+  char *mirrors[] = {"MIRROR_A.img", "MIRROR_B.img"};
+  static char *single_disk[] = {"file_system"};
+  int length = 3 * 1024;
+  int blocks[3];
+  char *text = rand_text(length);
+  char *buf = calloc(length + 1, sizeof(char));
+  set_disk_mirrors(mirrors, 2);
+  mksfs(1);
+  sfs_set_volume_checksums(1);
+
+  for(int copy = 0; copy < 2; copy++){
+    int fd = sfs_fopen("MIRRORED.txt");
+    sfs_fwrite(fd, text, length);
+    //Write over the blocks in the image file itself, behind the back of the disk
+    FILE *image = fopen(mirrors[copy], "r+b");
+    int found = image ? find_copy_blocks(copy, text, length, blocks) : 0;
+    if(found != 3){
+      fprintf(stderr, "Error: \nThe blocks of the file were not found in %s\n", mirrors[copy]);
+      *err_no += 1;
+    }
+    for(int i = 0; i < found; i++){
+      fseek(image, (long)blocks[i] * 1024, SEEK_SET);
+      fwrite("Corrupted block!", 1, 16, image);
+    }
+    if(image)
+      fclose(image);
+    int checksum_errors = sfs_get_checksum_errors();
+    memset(buf, 0, length);
+    if(sfs_fread(fd, buf, length) != length || memcmp(buf, text, length) != 0){
+      fprintf(stderr, "Error: \nThe file does not read back with its blocks corrupted in %s\n", mirrors[copy]);
+      *err_no += 1;
+    }
+    //Reads balance over the copies, only the bad blocks that were read count as errors and get repaired
+    if(find_copy_blocks(copy, text, length, blocks) < sfs_get_checksum_errors() - checksum_errors){
+      fprintf(stderr, "Error: \nThe corrupted blocks of %s were not repaired after a read\n", mirrors[copy]);
+      *err_no += 1;
+    }
+    sfs_fclose(fd);
+    sfs_remove("MIRRORED.txt");
+  }
+
+  set_disk_mirrors(single_disk, 1);
+  mksfs(1);
+  remove(mirrors[0]);
+  remove(mirrors[1]);
+  free(text);
+  free(buf);
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+/*
+Breaks a file into several extents: a write to a block it shares with a clone moves that block away
+from the others. The clone is removed again so the blocks can be moved.
+*/
+int fragment_file(char *name, char *text, int length){
+  int fd = sfs_fopen(name);
+  char *patch = rand_text(1024);
+  sfs_clone(name, "FRAGMENT_CLONE.txt");
+  sfs_fwseek(fd, 1024);
+  sfs_fwrite(fd, patch, 1024);
+  memcpy(text + 1024, patch, 1024);
+  sfs_fclose(fd);
+  sfs_remove("FRAGMENT_CLONE.txt");
+  free(patch);
+  return sfs_get_fragments(name);
+}
+
+/*
+Defragments a broken up file with sfs_defrag, then once more with a background pass.
+Each time the file should end up in one extent with its contents unchanged.
+*/
+int test_defrag(int *err_no){
+  int length = 4 * 1024;
+  char *text = rand_text(length);
+  char *buf = calloc(length + 1, sizeof(char));
+  int fd = sfs_fopen("FRAGMENTED.txt");
+  sfs_fwrite(fd, text, length);
+  sfs_fclose(fd);
+
+  for(int background = 0; background < 2; background++){
+    if(fragment_file("FRAGMENTED.txt", text, length) < 2){
+      fprintf(stderr, "Error: \nThe test could not break the file into several extents\n");
+      *err_no += 1;
+    }
+    int moved;
+    if(background){
+      sfs_defrag_start(0);
+      moved = sfs_defrag_stop(0);
+    }else{
+      moved = sfs_defrag("FRAGMENTED.txt");
+    }
+    if(moved <= 0 || sfs_get_fragments("FRAGMENTED.txt") != 1){
+      fprintf(stderr, "ERROR: Defragmenting moved %d blocks and left %d extents\n", moved, sfs_get_fragments("FRAGMENTED.txt"));
+      *err_no += 1;
+    }
+    fd = sfs_fopen("FRAGMENTED.txt");
+    memset(buf, 0, length);
+    if(sfs_fread(fd, buf, length) != length || memcmp(buf, text, length) != 0){
+      fprintf(stderr, "Error: \nThe file does not read back after it was defragmented\n");
+      *err_no += 1;
+    }
+    sfs_fclose(fd);
+  }
+  sfs_remove("FRAGMENTED.txt");
+
+  free(text);
+  free(buf);
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+/*
+Counts the bytes of buf that are not zero. 
+*/
+int count_nonzero(char *buf, int length){
+  int count = 0;
+  for(int i = 0; i < length; i++)
+    if(buf[i] != 0)
+      count++;
+  return count;
+}
+
+/*
+Reserves space for a file with and without SFS_FALLOC_KEEP_SIZE. The reserved range should read as
+zeros, growing the file only without the flag, and a write into it should take no new block.
+Then fills the disk with reservations of the largest file until one fails, which should leave
+neither blocks nor size behind.
+*/
+int test_fallocate(int *err_no){
+  int length = 3000;
+  int kept = 2000;
+  int max_file = 12 * 1024;
+  char *text = rand_text(kept);
+  char *buf = calloc(length + kept + 1, sizeof(char));
+  int fd = sfs_fopen("PREALLOC.txt");
+  sfs_fwrite(fd, test_str, strlen(test_str));
+  int used_blocks = sfs_get_used_blocks();
+
+  //Blocks 1 and 2, the data is in block 0 already
+  if(sfs_fallocate(fd, 0, length, 0) < 0 || sfs_get_file_size("PREALLOC.txt") != length || sfs_get_used_blocks() != used_blocks + 2){
+    fprintf(stderr, "ERROR: sfs_fallocate gave size %d and took %d blocks, should be %d and 2\n",
+      sfs_get_file_size("PREALLOC.txt"), sfs_get_used_blocks() - used_blocks, length);
+    *err_no += 1;
+  }
+  if(sfs_fread(fd, buf, length) != length || memcmp(buf, test_str, strlen(test_str)) != 0 ||
+    count_nonzero(buf + strlen(test_str), length - strlen(test_str)) != 0){
+    fprintf(stderr, "Error: \nThe reserved range does not read as zeros after the data\n");
+    *err_no += 1;
+  }
+
+  //Blocks 3 and 4, the file keeps its size
+  if(sfs_fallocate(fd, length, kept, SFS_FALLOC_KEEP_SIZE) < 0 || sfs_get_file_size("PREALLOC.txt") != length ||
+    sfs_get_used_blocks() != used_blocks + 4){
+    fprintf(stderr, "ERROR: sfs_fallocate with SFS_FALLOC_KEEP_SIZE gave size %d and took %d blocks, should be %d and 2\n",
+      sfs_get_file_size("PREALLOC.txt"), sfs_get_used_blocks() - used_blocks - 2, length);
+    *err_no += 1;
+  }
+  sfs_fwseek(fd, length);
+  sfs_fwrite(fd, text, kept);
+  sfs_frseek(fd, length);
+  if(sfs_get_used_blocks() != used_blocks + 4 || sfs_fread(fd, buf, kept) != kept || memcmp(buf, text, kept) != 0){
+    fprintf(stderr, "Error: \nA write into reserved blocks took %d new blocks or does not read back\n", sfs_get_used_blocks() - used_blocks - 4);
+    *err_no += 1;
+  }
+  sfs_fclose(fd);
+  sfs_remove("PREALLOC.txt");
+
+  //Disk full
+  char name[20];
+  int files = 0;
+  int failed = 0;
+  while(!failed && files < 40){
+    sprintf(name, "FULL%d.txt", files++);
+    fd = sfs_fopen(name);
+    used_blocks = sfs_get_used_blocks();
+    if(sfs_fallocate(fd, 0, max_file, 0) < 0){
+      failed = 1;
+      if(sfs_get_used_blocks() != used_blocks || sfs_get_file_size(name) != 0){
+        fprintf(stderr, "ERROR: A failed sfs_fallocate kept %d blocks and size %d\n", sfs_get_used_blocks() - used_blocks, sfs_get_file_size(name));
+        *err_no += 1;
+      }
+    }
+    sfs_fclose(fd);
+  }
+  if(!failed){
+    fprintf(stderr, "ERROR: sfs_fallocate did not fail on a full disk\n");
+    *err_no += 1;
+  }
+  for(int i = 0; i < files; i++){
+    sprintf(name, "FULL%d.txt", i);
+    sfs_remove(name);
+  }
+
+  free(text);
+  free(buf);
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+/*
+Writes past the end of a new file, leaving a hole, then punches a hole into a full file. 
+Holes should read back as zeros, punching should not change the size, and sfs_seek_data and 
+sfs_seek_hole should find the block boundaries around them. 
+*/
+int test_holes(int *err_no){
+  int length = 4 * 1024;
+  int hole_end = 5000;
+  int size = hole_end + strlen(test_str);
+  char *text = rand_text(length);
+  char *buf = calloc(length + hole_end, sizeof(char));
+
+  //Sparse file, the first four blocks are never written
+  int fd = sfs_fopen("SPARSE.txt");
+  if(sfs_fwseek(fd, hole_end) < 0)
+    fprintf(stderr, "Warning: sfs_fwseek returned negative. Potential fwseek fail?\n");
+  sfs_fwrite(fd, test_str, strlen(test_str));
+  if(sfs_get_file_size("SPARSE.txt") != size){
+    fprintf(stderr, "ERROR: Invalid file size for a sparse file.\nGiven: %d, Actual: %d\n", sfs_get_file_size("SPARSE.txt"), size);
+    *err_no += 1;
+  }
+  sfs_frseek(fd, 0);
+  if(sfs_fread(fd, buf, size) != size || count_nonzero(buf, hole_end) != 0 || memcmp(buf + hole_end, test_str, strlen(test_str)) != 0){
+    fprintf(stderr, "Error: \nThe hole does not read back as zeros before the data\n");
+    *err_no += 1;
+  }
+  if(sfs_seek_data(fd, 0) != 4096 || sfs_seek_hole(fd, 0) != 0 || sfs_seek_hole(fd, 4096) != size){
+    fprintf(stderr, "Error: \nsfs_seek_data gave %d and sfs_seek_hole %d and %d, should be 4096, 0 and %d\n",
+      sfs_seek_data(fd, 0), sfs_seek_hole(fd, 0), sfs_seek_hole(fd, 4096), size);
+    *err_no += 1;
+  }
+  sfs_fclose(fd);
+  sfs_remove("SPARSE.txt");
+
+  //Punch the second block and the middle of the last one out of a full file
+  fd = sfs_fopen("PUNCH.txt");
+  sfs_fwrite(fd, text, length);
+  if(sfs_fallocate(fd, 1024, 1024, SFS_FALLOC_PUNCH_HOLE) < 0 || sfs_fallocate(fd, 3500, 100, SFS_FALLOC_PUNCH_HOLE) < 0){
+    fprintf(stderr, "ERROR: sfs_fallocate could not punch a hole\n");
+    *err_no += 1;
+  }
+  if(sfs_get_file_size("PUNCH.txt") != length){
+    fprintf(stderr, "ERROR: Punching a hole changed the file size to %d\n", sfs_get_file_size("PUNCH.txt"));
+    *err_no += 1;
+  }
+  memset(text + 1024, 0, 1024);
+  memset(text + 3500, 0, 100);
+  sfs_frseek(fd, 0);
+  if(sfs_fread(fd, buf, length) != length || memcmp(buf, text, length) != 0){
+    fprintf(stderr, "Error: \nThe punched file does not read back as zeros in the holes and its data elsewhere\n");
+    *err_no += 1;
+  }
+  //Only the whole block is a hole, the zeroed bytes of the last block are still data
+  if(sfs_seek_hole(fd, 0) != 1024 || sfs_seek_data(fd, 1024) != 2048 || sfs_seek_hole(fd, 2048) != length){
+    fprintf(stderr, "Error: \nsfs_seek_hole gave %d and %d and sfs_seek_data %d, should be 1024, %d and 2048\n",
+      sfs_seek_hole(fd, 0), sfs_seek_hole(fd, 2048), sfs_seek_data(fd, 1024), length);
+    *err_no += 1;
+  }
+  sfs_fclose(fd);
+  sfs_remove("PUNCH.txt");
+
+  free(text);
+  free(buf);
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+/*
+Rewrites the volume in the version 1 layout and mounts it again, which upgrades it to SFS_VERSION. 
+The volume has an inline file that still fits the new inode, one of INODE_INLINE_SIZE+32 bytes that 
+was inline in version 1 and has to move to a data block, and a file with data blocks. 
+All three should read back the same after the upgrade and take writes again. 
+Before that the short inline file is made as long as the other and the bit map leaves one block free, 
+the upgrade should fail without changing a byte of the disk and leave no volume mounted. 
+*/
+int test_upgrade(int *err_no){
+  int long_length = INODE_INLINE_SIZE + 32;
+  int block_length = 2000;
+  char *long_text = rand_text(long_length);
+  char *block_text = rand_text(block_length);
+  char *buf = calloc(block_length + 1, sizeof(char));
+  mksfs(1);
+
+  int fd = sfs_fopen("INLINE.txt");
+  sfs_fwrite(fd, "Small enough for any inode", 26);
+  sfs_fclose(fd);
+  fd = sfs_fopen("LONGINLINE.txt");
+  sfs_fwrite(fd, long_text, long_length);
+  sfs_fclose(fd);
+  fd = sfs_fopen("BLOCKS.txt");
+  sfs_fwrite(fd, block_text, block_length);
+  sfs_fclose(fd);
+
+  //Build the version 1 metadata from the current one
+  I_Node *inodes = malloc(INODE_TABLE_BLOCKS*BLOCK_SIZE);
+  I_Node_V1 *old_inodes = calloc(INODE_TABLE_BLOCKS_V1, BLOCK_SIZE);
+  Bit_Map_Block *map = malloc(BLOCK_SIZE);
+  Super_Node *super_node = malloc(BLOCK_SIZE);
+  void *block = malloc(BLOCK_SIZE);
+  read_blocks(INODE_TABLE_START, INODE_TABLE_BLOCKS, inodes);
+  read_blocks(BIT_MAP_START, 1, map);
+  for(int b = DIRECTORY_START + 1; b <= DIRECTORY_START_V1; b++){
+    if(map->bm[b]){
+      fprintf(stderr, "Error: \nBlock %d is in use, the test can not lay the volume out in version 1\n", b);
+      *err_no += 1;
+    }
+  }
+  for(int i = 0; i < INODE_COUNT; i++){
+    old_inodes[i].size = inodes[i].size;
+    old_inodes[i].is_free = inodes[i].is_free;
+    old_inodes[i].flags = inodes[i].flags;
+    old_inodes[i].indirect_pointer = -1;
+    memset(old_inodes[i].block_pointers, 0xff, sizeof(old_inodes[i].block_pointers));
+    if(inodes[i].flags & INODE_INLINE){
+      memcpy(old_inodes[i].inline_data, inodes[i].inline_data, INODE_INLINE_SIZE);
+    }else if(!inodes[i].is_free && inodes[i].size == long_length){
+      //Version 1 kept this file in its inode, its block was never taken
+      read_blocks(inodes[i].block_pointers[0], 1, block);
+      memcpy(old_inodes[i].inline_data, block, long_length);
+      old_inodes[i].flags |= INODE_INLINE;
+      map->bm[inodes[i].block_pointers[0]] = 0;
+    }else{
+      memcpy(old_inodes[i].block_pointers, inodes[i].block_pointers, sizeof(inodes[i].block_pointers));
+    }
+  }
+  for(int b = 0; b <= DIRECTORY_START_V1; b++){
+    map->bm[b] = 1;
+  }
+  //No checksums on a version 1 volume
+  memset(&map->checksums, 0, sizeof(map->checksums));
+  //The bigger version 1 inode table covers the current root node, move the root first
+  read_blocks(DIRECTORY_START, 1, block);
+  write_blocks(DIRECTORY_START_V1, 1, block);
+  write_blocks(INODE_TABLE_START, INODE_TABLE_BLOCKS_V1, old_inodes);
+  write_blocks(BIT_MAP_START_V1, 1, map);
+  read_blocks(SUPER_BLOCK, 1, super_node);
+  super_node->version = 0;
+  write_blocks(SUPER_BLOCK, 1, super_node);
+
+  //Two inline files need a block and one block is free
+  I_Node_V1 *full_inodes = malloc(INODE_TABLE_BLOCKS_V1 * BLOCK_SIZE);
+  Bit_Map_Block *full_map = malloc(BLOCK_SIZE);
+  memcpy(full_inodes, old_inodes, INODE_TABLE_BLOCKS_V1 * BLOCK_SIZE);
+  memcpy(full_map, map, BLOCK_SIZE);
+  for(int i = 0; i < INODE_COUNT; i++){
+    if(!full_inodes[i].is_free && (full_inodes[i].flags & INODE_INLINE) && full_inodes[i].size == 26){
+      full_inodes[i].size = long_length;
+    }
+  }
+  int free_block = -1;
+  for(int b = 0; b < MAX_BLOCK; b++){
+    if(!full_map->bm[b] && free_block == -1){
+      free_block = b;
+    }else{
+      full_map->bm[b] = 1;
+    }
+  }
+  write_blocks(INODE_TABLE_START, INODE_TABLE_BLOCKS_V1, full_inodes);
+  write_blocks(BIT_MAP_START_V1, 1, full_map);
+  char *disk = malloc(MAX_BLOCK * BLOCK_SIZE);
+  char *disk_after = malloc(MAX_BLOCK * BLOCK_SIZE);
+  read_blocks(0, MAX_BLOCK, disk);
+  mksfs(0);
+  read_blocks(0, MAX_BLOCK, disk_after);
+  if(memcmp(disk, disk_after, MAX_BLOCK * BLOCK_SIZE) != 0){
+    fprintf(stderr, "ERROR: An upgrade that failed on a full disk changed the disk\n");
+    *err_no += 1;
+  }
+  if(sfs_get_file_size("INLINE.txt") != -1 || sfs_fopen("NEW.txt") != -1){
+    fprintf(stderr, "ERROR: The volume can be used after its upgrade failed\n");
+    *err_no += 1;
+  }
+  read_blocks(0, MAX_BLOCK, disk_after);
+  if(memcmp(disk, disk_after, MAX_BLOCK * BLOCK_SIZE) != 0){
+    fprintf(stderr, "ERROR: A call after a failed upgrade wrote to the disk\n");
+    *err_no += 1;
+  }
+  write_blocks(INODE_TABLE_START, INODE_TABLE_BLOCKS_V1, old_inodes);
+  write_blocks(BIT_MAP_START_V1, 1, map);
+
+  mksfs(0);
+  read_blocks(SUPER_BLOCK, 1, super_node);
+  if(super_node->version != SFS_VERSION){
+    fprintf(stderr, "ERROR: The volume was not upgraded, its version is %d\n", super_node->version);
+    *err_no += 1;
+  }
+  if(sfs_get_file_size("INLINE.txt") != 26 || sfs_get_file_size("LONGINLINE.txt") != long_length || sfs_get_file_size("BLOCKS.txt") != block_length){
+    fprintf(stderr, "ERROR: Invalid file sizes after the upgrade.\nGiven: %d %d %d, Actual: 26 %d %d\n",
+      sfs_get_file_size("INLINE.txt"), sfs_get_file_size("LONGINLINE.txt"), sfs_get_file_size("BLOCKS.txt"), long_length, block_length);
+    *err_no += 1;
+  }
+  fd = sfs_fopen("INLINE.txt");
+  memset(buf, 0, block_length);
+  if(sfs_fread(fd, buf, 26) != 26 || strcmp(buf, "Small enough for any inode") != 0){
+    fprintf(stderr, "Error: \nThe inline file does not read back after the upgrade\n");
+    *err_no += 1;
+  }
+  sfs_fclose(fd);
+  fd = sfs_fopen("LONGINLINE.txt");
+  if(sfs_fread(fd, buf, long_length) != long_length || memcmp(buf, long_text, long_length) != 0){
+    fprintf(stderr, "Error: \nThe inline file longer than the new inode does not read back after the upgrade\n");
+    *err_no += 1;
+  }
+  //It grows from its new data block like any other file
+  sfs_fwrite(fd, test_str, strlen(test_str));
+  sfs_frseek(fd, long_length);
+  memset(buf, 0, block_length);
+  if(sfs_fread(fd, buf, strlen(test_str)) != (int)strlen(test_str) || strcmp(buf, test_str) != 0){
+    fprintf(stderr, "Error: \nA write to an upgraded file does not read back\n");
+    *err_no += 1;
+  }
+  sfs_fclose(fd);
+  fd = sfs_fopen("BLOCKS.txt");
+  if(sfs_fread(fd, buf, block_length) != block_length || memcmp(buf, block_text, block_length) != 0){
+    fprintf(stderr, "Error: \nThe file with data blocks does not read back after the upgrade\n");
+    *err_no += 1;
+  }
+  sfs_fclose(fd);
+  sfs_remove("INLINE.txt");
+  sfs_remove("LONGINLINE.txt");
+  sfs_remove("BLOCKS.txt");
+
+  free(inodes);
+  free(old_inodes);
+  free(map);
+  free(full_inodes);
+  free(full_map);
+  free(disk);
+  free(disk_after);
+  free(super_node);
+  free(block);
+  free(long_text);
+  free(block_text);
+  free(buf);
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+/*
+Opens one file on more descriptors than the file system has inodes. Each descriptor should have 
+its own read and write pointers over the same data, and sfs_remove should close all of them. 
+*/
+int test_multiple_fds(int *err_no){
+  int fd_count = 300;
+  int *fds = malloc(fd_count * sizeof(int));
+  char *buf = calloc(strlen(test_str) + 1, sizeof(char));
+  for(int i = 0; i < fd_count; i++){
+    fds[i] = sfs_fopen("SHARED.txt");
+    if(fds[i] < 0 || (i > 0 && fds[i] == fds[i - 1])){
+      fprintf(stderr, "ERROR: Open number %d of the same file gave fd %d\n", i, fds[i]);
+      *err_no += 1;
+      break;
+    }
+  }
+
+  //A write through one descriptor is seen by the others, which still read from their own pointers
+  sfs_fwrite(fds[0], test_str, strlen(test_str));
+  sfs_fwrite(fds[1], "Over", 4);
+  if(sfs_fread(fds[2], buf, 4) != 4 || strncmp(buf, "Over", 4) != 0){
+    fprintf(stderr, "Error: \nA write through one fd does not read back through another\n");
+    *err_no += 1;
+  }
+  memset(buf, 0, strlen(test_str));
+  if(sfs_fread(fds[fd_count - 1], buf, 10) != 10 || strncmp(buf, "Overhic Ca", 10) != 0 || sfs_fread(fds[2], buf, 2) != 2 || strncmp(buf, "hi", 2) != 0){
+    fprintf(stderr, "Error: \nThe read pointers of the fds of one file are not independent\n");
+    *err_no += 1;
+  }
+
+  //Removing the file closes every descriptor open on it
+  sfs_fclose(fds[3]);
+  if(sfs_remove("SHARED.txt") < 0){
+    fprintf(stderr, "ERROR: Could not remove a file open on several fds\n");
+    *err_no += 1;
+  }
+  for(int i = 0; i < fd_count; i++){
+    if(sfs_fread(fds[i], buf, 1) != -1 || sfs_fclose(fds[i]) != -1){
+      fprintf(stderr, "Error: \nfd %d is still open after its file was removed\n", fds[i]);
+      *err_no += 1;
+      break;
+    }
+  }
+
+  free(fds);
+  free(buf);
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+/*
+Runs the consistency checker with options on the disk image and returns its exit code, -1 if it did not run.
+*/
+int run_fsck(char *options){
+  char command[512];
+  snprintf(command, sizeof(command), "%s %s file_system > /dev/null", FSCK_PATH, options);
+  int status = system(command);
+  return status != -1 && WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/*
+Corrupts the volume behind the back of the file system and checks it with the consistency checker. 
+A leaked block and an orphan inode should be found (exit 4), repaired with -r (exit 1) and gone on the 
+next run (exit 0), after which the volume mounts with its file intact. A data block that fails its 
+checksum can not be repaired, it is still there after -r (exit 4). 
+*/
+int test_fsck(int *err_no){
+  int length = 2 * 1024;
+  int blocks[2];
+  char *text = rand_text(length);
+  char *buf = calloc(length + 1, sizeof(char));
+  Bit_Map_Block *map = malloc(BLOCK_SIZE);
+  I_Node *inodes = malloc(INODE_TABLE_BLOCKS * BLOCK_SIZE);
+  mksfs(1);
+  sfs_set_volume_checksums(1);
+  int fd = sfs_fopen("CHECKED.txt");
+  sfs_fwrite(fd, text, length);
+  sfs_fclose(fd);
+  if(run_fsck("-j 4") != 0){
+    fprintf(stderr, "ERROR: The consistency checker did not run or found problems on a clean volume\n");
+    *err_no += 1;
+  }
+
+  //A block counted in the bit map that nothing uses, and an inode in use that has no name
+  read_blocks(BIT_MAP_START, 1, map);
+  read_blocks(INODE_TABLE_START, INODE_TABLE_BLOCKS, inodes);
+  for(int b = MAX_BLOCK - 1; b > DIRECTORY_START; b--){
+    if(!map->bm[b]){
+      map->bm[b] = 1;
+      break;
+    }
+  }
+  for(int i = 1; i < INODE_COUNT; i++){
+    if(inodes[i].is_free){
+      inodes[i].is_free = 0;
+      inodes[i].flags = INODE_INLINE;
+      inodes[i].size = 0;
+      break;
+    }
+  }
+  for(int i = 0; i < INODE_TABLE_BLOCKS; i++){
+    map->checksums.crc[INODE_TABLE_START + i] = crc32c((char*)inodes + i * BLOCK_SIZE, BLOCK_SIZE);
+  }
+  map->self_crc = crc32c(map, offsetof(Bit_Map_Block, self_crc));
+  write_blocks(INODE_TABLE_START, INODE_TABLE_BLOCKS, inodes);
+  write_blocks(BIT_MAP_START, 1, map);
+
+  int found = run_fsck("-j 4");
+  int repaired = run_fsck("-r -j 4");
+  int clean = run_fsck("-j 4");
+  if(found != 4 || repaired != 1 || clean != 0){
+    fprintf(stderr, "ERROR: The consistency checker exited with %d, %d with -r and %d after, should be 4, 1 and 0\n", found, repaired, clean);
+    *err_no += 1;
+  }
+  mksfs(0);
+  fd = sfs_fopen("CHECKED.txt");
+  if(sfs_fread(fd, buf, length) != length || memcmp(buf, text, length) != 0){
+    fprintf(stderr, "Error: \nA file does not read back after the volume was repaired\n");
+    *err_no += 1;
+  }
+  sfs_fclose(fd);
+
+  //A data block that fails its checksum
+  if(find_copy_blocks(0, text, length, blocks) != 2){
+    fprintf(stderr, "Error: \nThe blocks of the file were not found on the disk\n");
+    *err_no += 1;
+  }else{
+    read_blocks(blocks[1], 1, buf);
+    memcpy(buf, "Corrupted block!", 16);
+    write_blocks(blocks[1], 1, buf);
+    repaired = run_fsck("-r -j 4");
+    found = run_fsck("-j 4");
+    if(repaired != 4 || found != 4){
+      fprintf(stderr, "ERROR: The consistency checker exited with %d with -r and %d after on a bad data block, should be 4 and 4\n", repaired, found);
+      *err_no += 1;
+    }
+  }
+
+  mksfs(1);
+  free(text);
+  free(buf);
+  free(map);
+  free(inodes);
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
 }
\ No newline at end of file
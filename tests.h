@@ -65,5 +65,22 @@ int test_overflow_open(int *file_id, int *file_sizes, int *write_ptr, char **fil
 int test_get_file_name(char **file_names, int num_file, int *err_no);
 int test_get_file_size(int *file_size, char **file_names, int num_file, int *err_no);
 
+//Feature functions, each runs on its own files and removes them at the end
+int test_compression(int *err_no);
+int test_dedup(int *err_no);
+int test_clone_copy_on_write(int *err_no);
+int test_snapshot(int *err_no);
+int test_mirror_failover(int *err_no);
+int test_defrag(int *err_no);
+int test_fallocate(int *err_no);
+int test_holes(int *err_no);
+int test_upgrade(int *err_no);
+int test_multiple_fds(int *err_no);
+int test_fsck(int *err_no);
+
 //Help functionn
-int free_name_element(char **name_list, int num_file);
\ No newline at end of file
+int free_name_element(char **name_list, int num_file);
+int find_copy_blocks(int copy, char *text, int length, int *blocks);
+int fragment_file(char *name, char *text, int length);
+int count_nonzero(char *buf, int length);
+int run_fsck(char *options);
\ No newline at end of file